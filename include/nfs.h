@@ -11,6 +11,8 @@
 #include <stddef.h>
 #include "ddriver.h"
 #include "errno.h"
+#include <pthread.h>
+#include <sys/uio.h>
 #include "types.h"
 
 #define NFS_MAGIC       0x52415453           /* TODO: Define by yourself */
@@ -24,24 +26,193 @@
 *******************************************************************************/
 char* 			   nfs_get_fname(const char* path);
 int 			   nfs_calc_lvl(const char * path);
-int 			   nfs_driver_read(int offset, uint8_t *out_content, int size);
-int 			   nfs_driver_write(int offset, uint8_t *in_content, int size);
+const char* 	   nfs_next_fname(const char* path, char* fname);
+uint32_t 		   nfs_crc32(const uint8_t* buf, int size);
+int 			   nfs_driver_read(long offset, uint8_t *out_content, int size);
+int 			   nfs_driver_write(long offset, uint8_t *in_content, int size);
+int 			   nfs_dev_read(long offset, uint8_t *out_content, int size);
+int 			   nfs_dev_write(long offset, uint8_t *in_content, int size);
 
 
 int 			   nfs_mount(struct custom_options options);
 int 			   nfs_umount();
 
+struct nfs_dentry* new_dentry(struct nfs_inode* parent, const char * fname, NFS_FILE_TYPE ftype);
 int 			   nfs_alloc_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
 int 			   nfs_drop_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
 struct nfs_inode*  nfs_alloc_inode(struct nfs_dentry * dentry);
-void 			   nfs_alloc_datamap(struct nfs_inode * inode);
-void 			   nfs_alloc_datamap2(struct nfs_dentry * dentry);
+int 			   nfs_alloc_data_run(int goal, int want, int* got, boolean is_reserved);
+void 			   nfs_free_data_blk(int dat);
+void 			   nfs_free_data_run(int dat, int cnt);
+int 			   nfs_reserve_data(int cnt);
+void 			   nfs_release_data(int cnt);
+int 			   nfs_reserve_blks(struct nfs_inode* inode, int blks);
+int 			   nfs_map_data(struct nfs_inode* inode, int blks);
+int 			   nfs_resize_data(struct nfs_inode* inode, int size);
+void 			   nfs_shrink_data(struct nfs_inode* inode, int blks);
 int 			   nfs_sync_inode(struct nfs_inode * inode);
+int 			   nfs_sync_super();
 int 			   nfs_drop_inode(struct nfs_inode * inode);
+void 			   nfs_free_dentry(struct nfs_dentry * dentry);
+void 			   nfs_get_inode(struct nfs_inode * inode);
+void 			   nfs_put_inode(struct nfs_inode * inode);
 struct nfs_inode*  nfs_read_inode(struct nfs_dentry * dentry, int ino);
+int 			   nfs_read_inline(struct nfs_inode* inode, uint8_t* buf);
 struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir);
 
 struct nfs_dentry* nfs_lookup(const char * path, boolean * is_find, boolean* is_root);
+struct nfs_dentry* nfs_lookup_nolock(const char * path, boolean * is_find, boolean* is_root);
+/******************************************************************************
+* SECTION: nfs_group.c
+*******************************************************************************/
+int 			   nfs_mkfs(int bytes_per_inode, int blks_per_group);
+int 			   nfs_group_init(const struct nfs_super_d* super_d);
+int 			   nfs_group_sync();
+int 			   nfs_group_alloc_inode(int parent_ino, boolean is_dir);
+void 			   nfs_group_free_inode(int ino);
+int 			   nfs_group_alloc_data(int goal, int want, int* got);
+void 			   nfs_group_free_data(int dat, int cnt);
+void 			   nfs_group_destroy();
+/******************************************************************************
+* SECTION: nfs_space.c
+*******************************************************************************/
+void 			   nfs_space_init();
+int 			   nfs_space_alloc(int goal, int want, int* got);
+void 			   nfs_space_free(int start, int len);
+int 			   nfs_space_free_cnt();
+void 			   nfs_space_destroy();
+void 			   nfs_space_get_stats(struct nfs_space_stats* stats);
+/******************************************************************************
+* SECTION: nfs_bitmap.c
+*******************************************************************************/
+int 			   nfs_bitmap_find_zero(const uint8_t* map, int nbits, int start);
+int 			   nfs_bitmap_find_one(const uint8_t* map, int nbits, int start);
+int 			   nfs_bitmap_alloc(uint8_t* map, int nbits, int goal, int* hint);
+void 			   nfs_bitmap_free(uint8_t* map, int bit, int* hint);
+int 			   nfs_bitmap_count(const uint8_t* map, int nbits);
+/******************************************************************************
+* SECTION: nfs_extent.c
+*******************************************************************************/
+struct nfs_extent* nfs_extent_get(struct nfs_inode* inode, int idx);
+int 			   nfs_extent_bmap(struct nfs_inode* inode, int lblk);
+int 			   nfs_extent_append(struct nfs_inode* inode, int dat, int cnt);
+int 			   nfs_extent_grow(struct nfs_inode* inode, int blks, boolean is_reserved);
+void 			   nfs_extent_shrink(struct nfs_inode* inode, int blks);
+int 			   nfs_extent_sync(struct nfs_inode* inode, uint8_t* buf, int size);
+int 			   nfs_extent_load(struct nfs_inode* inode);
+int 			   nfs_extent_read(struct nfs_inode* inode, uint8_t* buf, int size);
+int 			   nfs_extent_pread(struct nfs_inode* inode, uint8_t* buf, int size, int offset);
+int 			   nfs_extent_readahead(struct nfs_inode* inode, int lblk, int cnt);
+/******************************************************************************
+* SECTION: nfs_dir.c
+*******************************************************************************/
+uint32_t 		   nfs_name_hash(const char* fname);
+void 			   nfs_dir_attach(struct nfs_inode* inode, struct nfs_dentry* dentry);
+void 			   nfs_dir_detach(struct nfs_inode* inode, struct nfs_dentry* dentry);
+int 			   nfs_dir_lookup(struct nfs_inode* inode, const char* fname, struct nfs_dentry** dentry);
+boolean 		   nfs_dir_peek(struct nfs_inode* inode, const char* fname, struct nfs_dentry** dentry);
+boolean 		   nfs_dir_find_rcu(struct nfs_inode* inode, const char* fname, struct nfs_dentry** dentry);
+const char* 	   nfs_dir_name_alloc(struct nfs_inode* inode, const char* fname);
+void 			   nfs_dir_name_release(struct nfs_inode* inode, boolean is_deferred);
+void 			   nfs_dentry_rename(struct nfs_inode* inode, struct nfs_dentry* dentry, const char* fname);
+int 			   nfs_dir_load(struct nfs_inode* inode);
+int 			   nfs_dir_reserve(struct nfs_inode* inode, int name_len);
+int 			   nfs_dir_sync(struct nfs_inode* inode);
+/******************************************************************************
+* SECTION: nfs_cache.c
+*******************************************************************************/
+int 			   nfs_cache_init(int nblks);
+boolean 		   nfs_cache_enabled();
+void 			   nfs_cache_lock();
+void 			   nfs_cache_unlock();
+struct nfs_cache_blk* nfs_cache_get(int blkno);
+struct nfs_cache_blk* nfs_cache_modify(int blkno);
+int 			   nfs_cache_prefetch(int blkno, int cnt);
+struct nfs_cache_blk* nfs_cache_overwrite(int blkno);
+void 			   nfs_cache_put(struct nfs_cache_blk* blk);
+int 			   nfs_cache_readahead(int blkno, int cnt);
+void 			   nfs_cache_mark_dirty(struct nfs_cache_blk* blk);
+int 			   nfs_cache_flush();
+int 			   nfs_cache_destroy();
+void 			   nfs_cache_get_stats(struct nfs_cache_stats* stats);
+/******************************************************************************
+* SECTION: nfs_backend.c
+*******************************************************************************/
+int 			   nfs_backend_open(const char* device, long* sz_disk, int* sz_io);
+int 			   nfs_backend_rwv(NFS_AIO_OP op, long offset, const struct iovec* iov, int iovcnt);
+int 			   nfs_backend_fd();
+/******************************************************************************
+* SECTION: nfs_iov.c
+*******************************************************************************/
+void 			   nfs_iov_account(int iovcnt, long bytes);
+int 			   nfs_dev_readv(long offset, const struct iovec* iov, int iovcnt);
+int 			   nfs_dev_writev(long offset, const struct iovec* iov, int iovcnt);
+void 			   nfs_iobatch_begin();
+boolean 		   nfs_iobatch_active();
+int 			   nfs_iobatch_add(long offset, uint8_t* buf, int size);
+int 			   nfs_iobatch_barrier(long offset, int size);
+int 			   nfs_iobatch_end();
+void 			   nfs_iov_destroy();
+void 			   nfs_iov_get_stats(struct nfs_iov_stats* stats);
+/******************************************************************************
+* SECTION: nfs_aio.c
+*******************************************************************************/
+int 			   nfs_aio_init(int workers);
+void 			   nfs_aio_group_init(struct nfs_aio_group* group);
+void 			   nfs_aio_submit(struct nfs_aio_group* group, struct nfs_aio_req* req);
+int 			   nfs_aio_wait(struct nfs_aio_group* group);
+boolean 		   nfs_aio_poll(struct nfs_aio_group* group);
+void 			   nfs_aio_group_destroy(struct nfs_aio_group* group);
+void 			   nfs_aio_destroy();
+void 			   nfs_aio_get_stats(struct nfs_aio_stats* stats);
+/******************************************************************************
+* SECTION: nfs_pcache.c
+*******************************************************************************/
+void 			   nfs_pcache_init();
+boolean 		   nfs_pcache_get(const char* path, struct nfs_dentry** dentry, boolean* is_find);
+void 			   nfs_pcache_put(const char* path, struct nfs_dentry* dentry, boolean is_find);
+void 			   nfs_pcache_invalidate(const char* path, boolean subtree);
+void 			   nfs_pcache_destroy();
+void 			   nfs_pcache_get_stats(struct nfs_pcache_stats* stats);
+/******************************************************************************
+* SECTION: nfs_rcu.c
+*******************************************************************************/
+void 			   nfs_rcu_read_lock();
+void 			   nfs_rcu_read_unlock();
+void 			   nfs_rcu_free(void* ptr);
+void 			   nfs_rcu_free_to(struct nfs_slab* slab, void* ptr);
+void 			   nfs_rcu_destroy();
+void 			   nfs_rcu_account(boolean is_fallback);
+void 			   nfs_rcu_get_stats(struct nfs_rcu_stats* stats);
+void 			   nfs_seq_write_begin(unsigned* seq);
+void 			   nfs_seq_write_end(unsigned* seq);
+unsigned 		   nfs_seq_read_begin(const unsigned* seq);
+boolean 		   nfs_seq_read_retry(const unsigned* seq, unsigned start);
+/******************************************************************************
+* SECTION: nfs_slab.c
+*******************************************************************************/
+void 			   nfs_slab_init(struct nfs_slab* slab, const char* name, int obj_size);
+void* 			   nfs_slab_alloc(struct nfs_slab* slab);
+void 			   nfs_slab_reserve(struct nfs_slab* slab, int cnt);
+void 			   nfs_slab_free(struct nfs_slab* slab, void* obj);
+void 			   nfs_slab_destroy(struct nfs_slab* slab);
+void 			   nfs_slab_get_stats(struct nfs_slab* slab, struct nfs_slab_stats* stats);
+/******************************************************************************
+* SECTION: nfs_data.c
+*******************************************************************************/
+void 			   nfs_data_attach(struct nfs_inode* inode, uint8_t* data, int cap);
+void 			   nfs_data_resize(struct nfs_inode* inode, int cap);
+int 			   nfs_data_load(struct nfs_inode* inode);
+void 			   nfs_data_release(struct nfs_inode* inode);
+void 			   nfs_data_readahead(struct nfs_file* file, off_t offset, size_t size);
+/******************************************************************************
+* SECTION: nfs_writeback.c
+*******************************************************************************/
+void 			   nfs_mark_dirty(struct nfs_inode* inode, flag16 flags);
+void 			   nfs_clear_dirty(struct nfs_inode* inode);
+int 			   nfs_writeback();
+int 			   nfs_flusher_start();
+void 			   nfs_flusher_stop_wait();
 /******************************************************************************
 * SECTION: nfs.c
 *******************************************************************************/
@@ -62,9 +233,15 @@ int   			   nfs_rmdir(const char *);
 int   			   nfs_rename(const char *, const char *);
 int   			   nfs_utimens(const char *, const struct timespec tv[2]);
 int   			   nfs_truncate(const char *, off_t);
+int   			   nfs_ftruncate(const char *, off_t, struct fuse_file_info *);
+int   			   nfs_fgetattr(const char *, struct stat *, struct fuse_file_info *);
+int   			   nfs_flush(const char *, struct fuse_file_info *);
+int   			   nfs_fsync(const char *, int, struct fuse_file_info *);
 			
 int   			   nfs_open(const char *, struct fuse_file_info *);
+int   			   nfs_release(const char *, struct fuse_file_info *);
 int   			   nfs_opendir(const char *, struct fuse_file_info *);
+int   			   nfs_releasedir(const char *, struct fuse_file_info *);
 /******************************************************************************
 * SECTION: nfs_debug.c
 *******************************************************************************/
@@ -7,6 +7,11 @@
 typedef int          boolean;
 typedef uint16_t     flag16;
 
+typedef enum nfs_aio_op {
+    NFS_AIO_READ,
+    NFS_AIO_WRITE
+} NFS_AIO_OP;
+
 typedef enum nfs_file_type {
     NFS_REG_FILE,
     NFS_DIR,
@@ -40,6 +45,12 @@ typedef enum nfs_file_type {
 #define NFS_MAX_FILE_NAME       128
 #define NFS_INODE_PER_FILE      1
 #define NFS_DATA_PER_FILE       1
+#define NFS_INLINE_EXTENTS      4                     /* inode内联的extent个数 */
+#define NFS_INODE_INLINE_SZ     64                    /* 磁盘inode记录中内联区的字节数 */
+#define NFS_LAYOUT_VERSION      2                     /* 磁盘布局版本，旧镜像为0 */
+#define NFS_DEFAULT_BYTES_PER_INODE 8192              /* 每多少字节设备空间分配一个inode */
+#define NFS_DIR_HASH_MIN        8                     /* 目录内存哈希表的最小桶数 */
+#define NFS_DIR_BUCKET_SPILL    0x1                   /* 桶满，有目录项顺延到下一个桶 */
 #define NFS_DEFAULT_PERM        0777
 
 #define NFS_IOC_MAGIC           'S'
@@ -47,135 +58,522 @@ typedef enum nfs_file_type {
 
 #define NFS_FLAG_BUF_DIRTY      0x1
 #define NFS_FLAG_BUF_OCCUPY     0x2
+#define NFS_FLAG_BUF_PENDING    0x4                   /* 异步预读尚未完成 */
+#define NFS_FLAG_BUF_BUSY       0x8                   /* 正在锁外读入或写回 */
+
+#define NFS_DEFAULT_CACHE_BLKS  1024                  /* 默认缓存1024个IO单元 */
+#define NFS_DEFAULT_FLUSH_INTERVAL 5                  /* 后台刷写间隔（秒） */
+#define NFS_DEFAULT_DATA_BUDGET 16384                 /* 文件数据内存上限（KB） */
+#define NFS_DEFAULT_IMAGE_SZ    (4 * 1024 * 1024)     /* 新建镜像文件的大小，与ddriver一致 */
+#define NFS_BACKEND_IO_SZ       512                   /* 镜像文件后端的IO单元，与ddriver一致 */
+#define NFS_DIRECT_ALIGN        4096                  /* O_DIRECT缓冲区对齐 */
+#define NFS_DEFAULT_AIO_WORKERS 4                     /* 异步IO工作线程数 */
+#define NFS_AIO_RING            256                   /* 提交环大小，也是在途请求的上限 */
+#define NFS_RA_MIN_BLKS         2                     /* 顺序读的初始预读窗口（块） */
+#define NFS_RA_MAX_BLKS         64                    /* 预读窗口上限（块） */
+#define NFS_IOV_MAX             1024                  /* 一次向量IO的最大段数，同Linux的UIO_MAXIOV */
+#define NFS_PCACHE_MAX          4096                  /* 路径缓存最多缓存的路径数 */
+#define NFS_PCACHE_BUCKETS      4096                  /* 路径缓存哈希桶数，须为2的幂 */
+#define NFS_RCU_BATCH           64                    /* 延迟释放的对象积累到此数时尝试回收 */
+#define NFS_SLAB_CHUNK_SZ       65536                 /* slab每次向malloc申请的字节数 */
+#define NFS_SLAB_ALIGN          16                    /* slab对象的对齐 */
+#define NFS_NAME_CHUNK_MIN      256                   /* 目录文件名区的首块字节数，之后逐块翻倍 */
+#define NFS_NAME_CHUNK_MAX      4096                  /* 文件名区单块的字节数上限 */
+#define NFS_INODE_DEAD          (-1)                  /* refcnt的终值：inode正在或已经释放 */
+
+#define NFS_INODE_DIRTY_META    0x1                   /* inode本身（大小、extent等）已修改 */
+#define NFS_INODE_DIRTY_DATA    0x2                   /* 普通文件数据已修改 */
+#define NFS_INODE_DIRTY_DENTRY  0x4                   /* 目录项已增删 */
+#define NFS_INODE_DIRTY_ALL     (NFS_INODE_DIRTY_META | NFS_INODE_DIRTY_DATA | NFS_INODE_DIRTY_DENTRY)
 /******************************************************************************
 * SECTION: Macro Function
 *******************************************************************************/
 #define NFS_IO_SZ()                     (nfs_super.sz_io)
 #define NFS_DISK_SZ()                   (nfs_super.sz_disk)
 #define NFS_DRIVER()                    (nfs_super.driver_fd)
+#define NFS_RENAME_RDLOCK()             pthread_rwlock_rdlock(&nfs_super.rename_lock)
+#define NFS_RENAME_WRLOCK()             do { pthread_rwlock_wrlock(&nfs_super.rename_lock);         \
+                                             nfs_seq_write_begin(&nfs_super.rename_seq); } while (0)
+#define NFS_RENAME_UNLOCK()             pthread_rwlock_unlock(&nfs_super.rename_lock)
+#define NFS_RENAME_WRUNLOCK()           do { nfs_seq_write_end(&nfs_super.rename_seq);              \
+                                             pthread_rwlock_unlock(&nfs_super.rename_lock); } while (0)
+#define NFS_ALLOC_LOCK()                pthread_mutex_lock(&nfs_super.alloc_lock)
+#define NFS_ALLOC_UNLOCK()              pthread_mutex_unlock(&nfs_super.alloc_lock)
+#define NFS_INODE_RDLOCK(pinode)        pthread_rwlock_rdlock(&(pinode)->lock)
+#define NFS_INODE_WRLOCK(pinode)        pthread_rwlock_wrlock(&(pinode)->lock)
+#define NFS_INODE_UNLOCK(pinode)        pthread_rwlock_unlock(&(pinode)->lock)
+#define NFS_STAT_ADD(counter, n)        __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#define NFS_RCU_ASSIGN(p, v)            __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define NFS_RCU_DEREF(p)                __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define NFS_RB_ENTRY(node, type, member) ((type*)((uint8_t*)(node) - offsetof(type, member)))
 
 #define NFS_ROUND_DOWN(value, round)    (value % round == 0 ? value : (value / round) * round)
 #define NFS_ROUND_UP(value, round)      (value % round == 0 ? value : (value / round + 1) * round)
 
-#define NFS_BLKS_SZ(blks)               (2 * blks * NFS_IO_SZ())
-#define NFS_ASSIGN_FNAME(pnfs_dentry, _fname) memcpy(pnfs_dentry->fname, _fname, strlen(_fname))
-#define NFS_INO_OFS(ino)                (nfs_super.inode_offset + NFS_BLKS_SZ(ino))
-#define NFS_DATA_OFS(dat)               (nfs_super.data_offset + NFS_BLKS_SZ(dat))
+#define NFS_BITMAP_TEST(map, bit)       (((map)[(bit) / UINT8_BITS] >> ((bit) % UINT8_BITS)) & 0x1)
+#define NFS_BITMAP_SET(map, bit)        ((map)[(bit) / UINT8_BITS] |= (uint8_t)(0x1 << ((bit) % UINT8_BITS)))
+#define NFS_BITMAP_CLEAR(map, bit)      ((map)[(bit) / UINT8_BITS] &= (uint8_t)(~(0x1 << ((bit) % UINT8_BITS))))
+
+#define NFS_BLKS_SZ(blks)               (2 * (blks) * NFS_IO_SZ())
+#define NFS_EXTENTS_PER_BLK()           ((int)(NFS_BLKS_SZ(1) / sizeof(struct nfs_extent)))
+#define NFS_DIR_BUCKET_CAP()            ((int)(NFS_BLKS_SZ(1) - sizeof(struct nfs_dir_bucket_d)))
+#define NFS_DENTRY_D_SZ(name_len)       ((int)NFS_ROUND_UP((sizeof(struct nfs_dentry_d) + (name_len) + 1), 4))
+#define NFS_DENTRY_D_NAME(pdentry_d)    ((char*)((pdentry_d) + 1))
+#define NFS_DENTRY_D_NEXT(pdentry_d)    ((struct nfs_dentry_d*)((uint8_t*)(pdentry_d) + \
+                                                                NFS_DENTRY_D_SZ((pdentry_d)->name_len)))
+#define NFS_INODES_PER_BLK()            ((int)(NFS_BLKS_SZ(1) / sizeof(struct nfs_inode_d)))
+#define NFS_BITS_PER_BLK()              (NFS_BLKS_SZ(1) * UINT8_BITS)
+#define NFS_INO_GROUP(ino)              ((ino) / nfs_super.inodes_per_group)
+#define NFS_DATA_GROUP(dat)             ((dat) / nfs_super.data_per_group)
+#define NFS_GROUP_FIRST_INO(group)      ((group) * nfs_super.inodes_per_group)
+#define NFS_GROUP_FIRST_DATA(group)     ((group) * nfs_super.data_per_group)
+#define NFS_GROUP_OFS(group)            ((long)(group) * nfs_super.group_sz)
+#define NFS_IMAP_OFS(group)             (nfs_super.map_inode_offset + NFS_GROUP_OFS(group))
+#define NFS_DMAP_OFS(group)             (nfs_super.map_data_offset + NFS_GROUP_OFS(group))
+#define NFS_INO_OFS(ino)                (nfs_super.inode_offset + NFS_GROUP_OFS(NFS_INO_GROUP(ino)) + \
+                                         (long)((ino) % nfs_super.inodes_per_group) * (long)sizeof(struct nfs_inode_d))
+#define NFS_INO_BLK_OFS(ino)            (nfs_super.inode_offset + NFS_GROUP_OFS(NFS_INO_GROUP(ino)) + \
+                                         NFS_BLKS_SZ((long)((ino) % nfs_super.inodes_per_group) / NFS_INODES_PER_BLK()))
+#define NFS_DATA_OFS(dat)               (nfs_super.data_offset + NFS_GROUP_OFS(NFS_DATA_GROUP(dat)) + \
+                                         NFS_BLKS_SZ((long)((dat) % nfs_super.data_per_group)))
 
 #define NFS_IS_DIR(pinode)              (pinode->dentry->ftype == NFS_DIR)
 #define NFS_IS_REG(pinode)              (pinode->dentry->ftype == NFS_REG_FILE)
 #define NFS_IS_SYM_LINK(pinode)         (pinode->dentry->ftype == NFS_SYM_LINK)
+#define NFS_IS_INLINE(pinode)           ((pinode)->blk_cnt == 0 && (pinode)->size > 0 && \
+                                         (pinode)->size <= NFS_INODE_INLINE_SZ) /* 普通文件：内容在inode记录中 */
 /******************************************************************************
 * SECTION: FS Specific Structure - In memory structure
 *******************************************************************************/
 struct nfs_dentry;
 struct nfs_inode;
 struct nfs_super;
+struct nfs_cache_ra;
 
 struct custom_options {
 	const char*        device;
+	int                cache_blks;                    /* 块缓存大小（IO单元个数），0表示不缓存 */
+	boolean            readdir_stat;                  /* readdir时读入子inode并返回完整属性 */
+	int                flush_interval;                /* 后台刷写间隔（秒），0表示只在fsync/umount时写回 */
+	int                data_budget;                   /* 内存中文件数据上限（KB），0表示不限 */
+	int                aio_workers;                   /* 异步IO工作线程数，0表示同步执行 */
+	boolean            debug;                         /* umount时输出各模块的统计 */
 	boolean            show_help;
 };
 
+struct nfs_cache_blk
+{
+    int                    blkno;                     /* IO单元号 */
+    flag16                 flags;                     /* NFS_FLAG_BUF_DIRTY | NFS_FLAG_BUF_OCCUPY | NFS_FLAG_BUF_PENDING | NFS_FLAG_BUF_BUSY */
+    int                    refs;                      /* 钉住计数，非0时不会被淘汰或写回 */
+    uint8_t*               data;
+    struct nfs_cache_blk*  hnext;                     /* 哈希链 / 空闲链 */
+    struct nfs_cache_blk*  lru_prev;
+    struct nfs_cache_blk*  lru_next;
+    struct nfs_cache_ra*   ra;                        /* PENDING时所属的预读请求 */
+    pthread_cond_t         wait;                      /* BUSY、PENDING清除或refs归0时广播 */
+};
+
+struct nfs_cache_stats
+{
+    long               hits;
+    long               misses;
+    long               prefetched;                    /* 由nfs_cache_prefetch成批读入的块 */
+    long               readahead;                     /* 异步预读的块 */
+    long               ra_waits;                      /* 访问时预读尚未完成、需要等待的次数 */
+    long               evicts;
+    long               writebacks;
+};
+
+struct nfs_cache
+{
+    int                    nblks;
+    int                    nbuckets;
+    struct nfs_cache_blk*  blks;
+    struct nfs_cache_blk** buckets;
+    struct nfs_cache_blk*  free_list;
+    struct nfs_cache_blk*  lru_head;                  /* 最近使用 */
+    struct nfs_cache_blk*  lru_tail;                  /* 最久未使用 */
+    struct nfs_cache_ra*   ra_list;                   /* 在途的预读 */
+    int                    ra_blks;                   /* 在途预读占用的块数 */
+    struct nfs_cache_stats stats;
+};
+
+struct nfs_backend                                    /* 块设备后端，偏移和长度均按IO单元对齐 */
+{
+    const char*        name;                          /* --device前缀 */
+    int                (*open)(const char* path, long* sz_disk, int* sz_io);
+    int                (*read)(long offset, uint8_t* buf, int size);
+    int                (*write)(long offset, uint8_t* buf, int size);
+    int                (*readv)(long offset, const struct iovec* iov, int iovcnt);
+    int                (*writev)(long offset, const struct iovec* iov, int iovcnt);
+    int                (*sync)();                     /* 落盘 */
+    void               (*close)();
+    boolean            serial;                        /* 不能被多个线程同时调用 */
+};
+
+struct nfs_ioreq                                      /* 批量写中的一段，buf归批次所有 */
+{
+    long               offset;
+    uint8_t*           buf;
+    int                size;
+};
+
+struct nfs_iov_stats
+{
+    long               reqs;                          /* 提交的读写段数 */
+    long               runs;                          /* 交给后端的连续传输次数 */
+    long               bytes;
+};
+
+struct nfs_aio_group                                  /* 一组异步请求，nfs_aio_wait等待全部完成 */
+{
+    pthread_mutex_t    lock;
+    pthread_cond_t     cond;
+    int                inflight;
+    int                ret;                           /* 第一个出错请求之后的错误码 */
+};
+
+struct nfs_aio_req
+{
+    NFS_AIO_OP         op;
+    long               offset;                        /* 按IO单元对齐 */
+    struct iovec*      iov;
+    int                iovcnt;
+    int                ret;
+    void               (*done)(struct nfs_aio_req*);  /* 完成回调，在工作线程中调用，可为NULL */
+    void*              arg;
+    struct nfs_aio_group* group;
+};
+
+struct nfs_cache_ra                                   /* 一次异步预读，覆盖一段连续的IO单元 */
+{
+    struct nfs_aio_group   group;
+    struct nfs_aio_req     req;
+    struct nfs_cache_blk** blks;
+    struct iovec*          iov;
+    int                    cnt;
+    boolean                waiting;                   /* 已有线程在锁外等待其完成 */
+    struct nfs_cache_ra*   next;
+};
+
+struct nfs_aio_stats
+{
+    long               submitted;
+    long               completed;
+    int                max_depth;                     /* 最大在途请求数 */
+};
+
+struct nfs_pcache_ent
+{
+    char*                  path;                      /* 完整路径 */
+    uint32_t               hash;                      /* nfs_name_hash(path) */
+    struct nfs_dentry*     dentry;                    /* nfs_lookup的返回值 */
+    boolean                is_find;                   /* FALSE为负项（ENOENT） */
+    struct nfs_pcache_ent* hnext;
+    struct nfs_pcache_ent* lru_prev;
+    struct nfs_pcache_ent* lru_next;
+};
+
+struct nfs_pcache_stats
+{
+    long               hits;
+    long               neg_hits;
+    long               misses;
+    long               invalidations;
+};
+
+struct nfs_pcache
+{
+    struct nfs_pcache_ent*  buckets[NFS_PCACHE_BUCKETS];
+    struct nfs_pcache_ent*  lru_head;
+    struct nfs_pcache_ent*  lru_tail;
+    int                     cnt;
+    struct nfs_pcache_stats stats;
+};
+
+struct nfs_rcu_reader                                 /* 每个线程一个，记录其所在的读侧临界区 */
+{
+    uint64_t               epoch;                     /* 进入时的全局纪元，0表示不在临界区 */
+    int                    nesting;
+    boolean                in_use;                    /* 属于某个存活的线程 */
+    long                   walks;                     /* 无锁完成的路径查找 */
+    long                   fallbacks;                 /* 改走加锁路径的查找 */
+    struct nfs_rcu_reader* next;
+};
+
+struct nfs_slab_chunk                                 /* slab向malloc申请的一块，其后紧跟对象 */
+{
+    struct nfs_slab_chunk* next;
+    int                    cnt;
+};
+
+struct nfs_name_chunk                                 /* 目录文件名区的一块，其后紧跟以'\0'结尾的文件名 */
+{
+    struct nfs_name_chunk* next;
+    int                    used;
+    int                    cap;
+};
+
+struct nfs_slab_stats
+{
+    long               objs;                          /* 已申请的对象数 */
+    long               active;                        /* 使用中的对象数 */
+    long               chunks;
+    long               bytes;                         /* 向malloc申请的字节数 */
+};
+
+struct nfs_slab                                       /* 一类定长对象的缓存 */
+{
+    const char*            name;
+    int                    obj_size;                  /* 按NFS_SLAB_ALIGN向上取整 */
+    int                    per_chunk;
+    pthread_mutex_t        lock;
+    void*                  free_list;                 /* 空闲对象的首个字存放下一个空闲对象 */
+    int                    free_cnt;
+    struct nfs_slab_chunk* chunks;
+    struct nfs_slab_stats  stats;
+};
+
+struct nfs_rcu_node                                   /* 一个延迟释放的对象 */
+{
+    void*                  ptr;
+    struct nfs_slab*       slab;                      /* 归还到的slab，NULL表示free */
+    uint64_t               epoch;                     /* 摘下时的全局纪元 */
+    struct nfs_rcu_node*   next;
+};
+
+struct nfs_rcu_stats
+{
+    long               walks;
+    long               fallbacks;
+    long               deferred;
+    long               freed;
+};
+
+struct nfs_extent
+{
+    int                start;                         /* 起始数据块号 */
+    int                len;                           /* 连续块数 */
+};
+
+struct nfs_rb_node                                    /* 红黑树节点，嵌入到所属对象中 */
+{
+    struct nfs_rb_node* parent;
+    struct nfs_rb_node* child[2];                     /* 0为左，1为右 */
+    boolean             is_red;
+};
+
+struct nfs_free_extent                                /* 一段空闲数据块，不跨块组 */
+{
+    struct nfs_rb_node by_start;                      /* 按start排序 */
+    struct nfs_rb_node by_len;                        /* 按(len, start)排序 */
+    int                start;
+    int                len;
+};
+
+struct nfs_space_stats
+{
+    int                extents;                       /* 空闲extent数 */
+    int                free_blks;
+    int                max_len;                       /* 最长的空闲extent */
+};
+
 struct nfs_inode
 {
+    pthread_rwlock_t   lock;                          /* 目录：目录项；普通文件：数据、大小和extent */
     int                ino;                           /* 在inode位图中的下标 */
     int                size;                          /* 文件已占用空间 */
     char               target_path[NFS_MAX_FILE_NAME];/* store traget path when it is a symlink */
     int                dir_cnt;
     struct nfs_dentry* dentry;                        /* 指向该inode的dentry */
     struct nfs_dentry* dentrys;                       /* 所有目录项 */
-    uint8_t*           data;           
-    // int                dat[nfs_DATA_PER_FILE]; //该inode对应文件占用的数据块在data位图中的下标
-    int                dat;
+    uint8_t*           data;                          /* 首次读写时读入，NULL表示未读入 */
+    int                data_cap;                      /* data缓冲区字节数 */
+    struct nfs_inode*  data_prev;                     /* 数据LRU，data非NULL时位于其中 */
+    struct nfs_inode*  data_next;
+    int                blk_cnt;                       /* 已映射的数据块数 */
+    int                rsv_blks;                      /* 已预留、写回时才分配的数据块数 */
+    boolean            rsv_meta;                      /* 预留块可能用尽内联extent时，为溢出块多预留的一块 */
+    int                ext_cnt;
+    struct nfs_extent  extents[NFS_INLINE_EXTENTS];   /* 内联extent */
+    int                ext_blk;                       /* 溢出extent块的数据块号，-1表示无 */
+    struct nfs_extent* ext_overflow;                  /* 溢出extent，第NFS_INLINE_EXTENTS个起 */
+    int                dir_buckets;                   /* 目录在磁盘上的哈希桶数 */
+    boolean            is_loaded;                     /* 目录项是否已全部读入 */
+    struct nfs_dentry** dhash;                        /* 目录项内存哈希表，首次查找时建立 */
+    int                dhash_size;
+    int                dhash_cnt;
+    struct nfs_name_chunk* names;                     /* 目录项文件名区，写入后不再修改 */
+    int                names_used;                    /* 文件名区已用字节数 */
+    int                names_live;                    /* 其中仍在目录中的文件名字节数 */
+    int                dir_bytes;                     /* 目录项写成磁盘记录的总字节数，决定桶数 */
+    int                dir_version;                   /* 目录项增删时递增，readdir游标据此失效 */
+    unsigned           dir_seq;                       /* 哈希表修改期间为奇数，无锁查找据此重试 */
+    int                refcnt;                        /* 打开的句柄、游标和进行中的操作数，原子增减 */
+    boolean            is_orphan;                     /* 已被删除，最后一个引用释放时释放，在ref_lock下置位 */
+    boolean            is_dentry_kept;                /* 已摘下的dentry由最后一个引用一起释放，受ref_lock保护 */
+    flag16             flags;                         /* NFS_INODE_DIRTY_*，非0时位于脏链表中 */
+    struct nfs_inode*  dirty_prev;
+    struct nfs_inode*  dirty_next;
 };  
 
-struct nfs_dentry
+struct nfs_dentry                                     /* 查找用到的字段在前半，与其余字段共占一个缓存行 */
 {
-    char               fname[NFS_MAX_FILE_NAME];
+    struct nfs_dentry* hnext;                         /* 父目录哈希表中的下一项 */
+    uint32_t           hash;                          /* nfs_name_hash(fname) */
+    uint16_t           name_len;
+    uint8_t            ftype;                         /* NFS_FILE_TYPE */
+    const char*        fname;                         /* 位于父目录的文件名区 */
+    struct nfs_inode*  inode;                         /* 指向inode */
     struct nfs_dentry* parent;                        /* 父亲Inode的dentry */
     struct nfs_dentry* brother;                       /* 兄弟 */
+    struct nfs_dentry** pprev;                        /* 指向前一项的brother或父目录的dentrys，未挂入时为NULL */
     int                ino;
-    int                dat;                           /* 指向的dat号 */
-    struct nfs_inode*  inode;                         /* 指向inode */
-    NFS_FILE_TYPE      ftype;
+    int                dat;                           /* 磁盘目录项中保留的字段，新建的为-1 */
+};
+
+struct nfs_file                                       /* open放入fi->fh */
+{
+    struct nfs_inode*  inode;                         /* 持有一个引用 */
+    pthread_mutex_t    ra_lock;                       /* 同一句柄上的并发read */
+    off_t              ra_prev;                       /* 上次read的结束偏移，下一次从这里读即为顺序读 */
+    off_t              ra_stride;                     /* 上次read与它之前一次read之间跳过的字节数 */
+    int                ra_window;                     /* 当前预读窗口（块），0表示未在预读 */
+    int                ra_end;                        /* 已发起预读的逻辑块上界 */
+};
+
+struct nfs_dir_cursor                                 /* opendir放入fi->fh */
+{
+    struct nfs_inode*  inode;                         /* 持有一个引用 */
+    struct nfs_dentry* next;                          /* 下一个要返回的目录项 */
+    off_t              offset;                        /* next的偏移 */
+    int                version;                       /* 对应inode->dir_version */
+};
+
+struct nfs_group                                      /* 块组的内存状态，由alloc_lock保护 */
+{
+    int                free_inodes;
+    int                free_data;
+    int                ino_hint;                      /* 本组中该位之前的inode全部已占用 */
+    boolean            is_imap_dirty;                 /* 本组inode位图块待写回 */
+    boolean            is_dmap_dirty;                 /* 本组数据位图块待写回 */
 };
 
 struct nfs_super
 {
     int                driver_fd;
+    const struct nfs_backend* backend;
     
     int                sz_io;
-    int                sz_disk;
+    long               sz_disk;
     int                sz_usage;
     
     int                max_ino;
+    int                max_data;
     uint8_t*           map_inode;
     uint8_t*           map_data;
 
-    int                map_inode_blks;
-    int                map_inode_offset;
+    int                map_inode_blks;                /* 每组的位图块数 */
+    long               map_inode_offset;              /* 以下偏移均为组0的，组g再加g * group_sz */
     
     int                map_data_blks;
-    int                map_data_offset;
+    long               map_data_offset;
+
+    long               data_offset;
+    long               inode_offset;
 
-    int                data_offset;
-    int                inode_offset;
+    int                group_cnt;
+    long               group_sz;                      /* 相邻两组的间距（字节） */
+    int                inodes_per_group;              /* ino按组连续编号 */
+    int                data_per_group;                /* 数据块号按组连续编号，最后一组可能不满 */
+    struct nfs_group*  groups;
+    int                dir_rotor;                     /* 上一个顶层目录所在的组 */
+    int                rsv_data;                      /* 各文件预留的数据块总数，由alloc_lock保护 */
 
     boolean            is_mounted;
+    boolean            is_map_dirty;                  /* 位图或超级块待写回 */
+    struct nfs_inode*  dirty_list;                    /* 脏inode链表 */
+    int                dirty_cnt;
+    struct nfs_inode*  data_lru_head;                 /* 最近读写的文件数据 */
+    struct nfs_inode*  data_lru_tail;
+    long               data_bytes;                    /* 内存中文件数据总字节数 */
+    long               data_loads;
+    long               data_evicts;
+    long               rmw_reads;                     /* 部分写预读的字节数 */
+    long               rmw_saved;                     /* 整单元写省去的预读字节数 */
+    pthread_rwlock_t   rename_lock;                   /* 目录树结构，见nfs.c中的锁说明 */
+    unsigned           rename_seq;                    /* 持rename_lock写锁期间为奇数 */
+    pthread_mutex_t    alloc_lock;                    /* 位图、分配提示、is_map_dirty */
+    pthread_mutex_t    itable_lock;                   /* 同一块中inode记录的读-改-写 */
+    pthread_mutex_t    ref_lock;                      /* inode的释放：is_orphan、refcnt置为NFS_INODE_DEAD */
+    pthread_mutex_t    dirty_lock;                    /* 脏链表和inode->flags的修改 */
+    pthread_mutex_t    data_lock;                     /* 数据LRU和data_bytes等计数 */
+    struct nfs_slab    dentry_slab;
+    struct nfs_slab    inode_slab;
 
     struct nfs_dentry* root_dentry;
 };
 
-static inline struct nfs_dentry* new_dentry(char * fname, NFS_FILE_TYPE ftype) {
-    struct nfs_dentry * dentry = (struct nfs_dentry *)malloc(sizeof(struct nfs_dentry));
-    memset(dentry, 0, sizeof(struct nfs_dentry));
-    NFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype   = ftype;
-    dentry->ino     = -1;
-    dentry->inode   = NULL;
-    dentry->parent  = NULL;
-    dentry->brother = NULL;                                            
-    return dentry;
-}
-
 /******************************************************************************
 * SECTION: FS Specific Structure - Disk structure
 *******************************************************************************/
-struct nfs_super_d
+struct nfs_super_d                                    /* 由nfs_mkfs按设备大小写入 */
 {
     uint32_t           magic_num;
     int                sz_usage;
     
     int                max_ino;
-    int                map_inode_blks;
-    int                map_inode_offset;
-    
-    int                map_data_blks;
-    int                map_data_offset;
-
-    int                data_offset;
-    int                inode_offset;
+    int                max_data;
+    int                map_inode_blks;                /* 每组 */
+    int                map_data_blks;                 /* 每组 */
+    int                blk_sz;                        /* 格式化时的NFS_BLKS_SZ(1) */
+    int                bytes_per_inode;
+    int                group_cnt;
+    int                blks_per_group;
+    int                layout_version;                /* NFS_LAYOUT_VERSION，与版本1的位置相同 */
+    int                inodes_per_group;
+    int                data_per_group;
+    int                itable_blks;                   /* 每组inode表的块数 */
+    int64_t            sz_disk;                       /* 格式化时的设备大小 */
+    int64_t            group_sz;
+    int64_t            map_inode_offset;              /* 组0的各区域偏移 */
+    int64_t            map_data_offset;
+    int64_t            inode_offset;
+    int64_t            data_offset;
 };
 
-struct nfs_inode_d
+struct nfs_inode_d                                    /* 定长128字节，紧密排列在inode区 */
 {
     int                ino;                           /* 在inode位图中的下标 */
-    int                size;                          /* 文件已占用空间 */
-    char               target_path[NFS_MAX_FILE_NAME];/* store traget path when it is a symlink */
+    int                size;                          /* 文件已占用空间，软链接为目标路径长度 */
     int                dir_cnt;
-    NFS_FILE_TYPE      ftype;   
-    // int                dat[nfs_DATA_PER_FILE]; //该inode对应文件占用的数据块在data位图中的下标
-    int                dat;
-};  
+    uint8_t            ftype;                         /* NFS_FILE_TYPE */
+    uint8_t            rsv[3];
+    int                blk_cnt;
+    int                ext_cnt;
+    struct nfs_extent  extents[NFS_INLINE_EXTENTS];
+    int                ext_blk;
+    int                dir_buckets;
+    uint8_t            inline_data[NFS_INODE_INLINE_SZ];/* 软链接目标短于此时内联；普通文件不超过此且无数据块时内联 */
+};
+
+struct nfs_dir_bucket_d                               /* 目录桶块头，其后紧跟变长的nfs_dentry_d记录 */
+{
+    uint32_t           csum;                          /* 块头其余字段和已用记录的CRC32 */
+    uint16_t           cnt;
+    uint16_t           flags;
+    uint32_t           used;                          /* 记录占用的字节数 */
+};
 
-struct nfs_dentry_d
+struct nfs_dentry_d                                   /* 其后紧跟以'\0'结尾的文件名，整条记录4字节对齐 */
 {
-    char               fname[NFS_MAX_FILE_NAME];
-    NFS_FILE_TYPE      ftype;
     int                ino;                           /* 指向的ino号 */
     int                dat;                           /* 指向的dat号 */
-};  
+    uint8_t            ftype;
+    uint8_t            name_len;
+    uint16_t           rsv;
+};
 
 
 #endif /* _TYPES_H_ */
\ No newline at end of file
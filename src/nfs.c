@@ -13,6 +13,12 @@ struct custom_options nfs_options;
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {
 	OPTION("--device=%s", device),
+	OPTION("--cache_blks=%d", cache_blks),
+	OPTION("--readdir_stat", readdir_stat),
+	OPTION("--flush_interval=%d", flush_interval),
+	OPTION("--data_budget=%d", data_budget),
+	OPTION("--aio_workers=%d", aio_workers),
+	OPTION("--debug", debug),
 	OPTION("-h", show_help),
 	OPTION("--help", show_help),
 	FUSE_OPT_END
@@ -25,23 +31,39 @@ static struct fuse_operations operations = {
 	.getattr = nfs_getattr,							  /* 获取文件属性，类似stat，必须完成 */
 	.readdir = nfs_readdir,							  /* 填充dentrys */
 	.mknod = nfs_mknod,							      /* 创建文件，touch相关 */
-	.write = NULL,								  /* 写入文件 */
-	.read = NULL,								  /* 读文件 */
+	.write = nfs_write,								  /* 写入文件 */
+	.read = nfs_read,								  /* 读文件 */
 	.utimens = nfs_utimens,							  /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  /* 改变文件大小 */
-	.unlink = NULL,							  /* 删除文件 */
-	.rmdir	= NULL,							  /* 删除目录， rm -r */
-	.rename = NULL,							  /* 重命名，mv */
+	.truncate = nfs_truncate,						  /* 改变文件大小 */
+	.ftruncate = nfs_ftruncate,						  /* 按句柄改变文件大小 */
+	.fgetattr = nfs_fgetattr,						  /* 按句柄获取文件属性 */
+	.unlink = nfs_unlink,							  /* 删除文件 */
+	.rmdir	= nfs_rmdir,							  /* 删除目录， rm -r */
+	.rename = nfs_rename,							  /* 重命名，mv */
 	.readlink = NULL,						  /* 读链接 */
 	.symlink = NULL,							  /* 软链接 */
 
-	.open = NULL,							
-	.opendir = NULL,
+	.open = nfs_open,								  /* 文件句柄放入fi->fh */
+	.release = nfs_release,
+	.flush = nfs_flush,								  /* close时写回该文件 */
+	.fsync = nfs_fsync,								  /* 写回该文件并落盘 */
+	.opendir = nfs_opendir,
+	.releasedir = nfs_releasedir,
 	.access = NULL
 };
 /******************************************************************************
 * SECTION: Function Implementation
 *******************************************************************************/
+/*
+ * FUSE多线程调用以下操作，各操作自行加锁。锁的顺序（由外到内）：
+ *   rename_lock -> 目录inode锁（父目录先于子项）-> 文件inode锁 -> data_lock、dirty_lock
+ *   -> ref_lock、alloc_lock、inode表锁、路径缓存锁 -> 块缓存锁 -> 批量写锁 -> 设备锁
+ * 路径查找、新建、删除文件持rename_lock读锁；删除目录和rename会改动子树，持写锁。
+ * nfs_lookup返回的inode已被引用，之后的读写不再需要rename_lock：read持inode读锁，
+ * write、truncate和写回持写锁，不同文件上的读写互不等待。
+ * 只读的操作用nfs_lookup_nolock，先在RCU读侧临界区内无锁查找，失败时才取rename_lock；
+ * 被删除的dentry、inode和目录哈希表经nfs_rcu_free延迟到读者退出后释放
+ */
 void* nfs_init(struct fuse_conn_info * conn_info) {
 	if (nfs_mount(nfs_options) != NFS_ERROR_NONE) {
         NFS_DBG("[%s] mount error\n", __func__);
@@ -60,78 +82,221 @@ void nfs_destroy(void* p) {
 	return;
 }
 /**
- * @brief 
+ * @brief 在父目录下新建文件、目录或软链接
+ * 
+ * 持父目录写锁再查一次，同名的并发创建只有一个成功
  * 
  * @param path 
- * @param mode 
+ * @param ftype 
+ * @param target 软链接指向的路径，其他类型为NULL
  * @return int 
  */
-int nfs_mkdir(const char* path, mode_t mode) {
-	(void)mode;
+static int nfs_create(const char* path, NFS_FILE_TYPE ftype, const char* target) {
 	boolean is_find, is_root;
-	char* fname;
-	struct nfs_dentry* last_dentry = nfs_lookup(path, &is_find, &is_root);
+	char* fname = nfs_get_fname(path);
+	struct nfs_dentry* last_dentry;
 	struct nfs_dentry* dentry;
+	struct nfs_inode*  parent;
 	struct nfs_inode*  inode;
+	boolean is_long_link = target != NULL && strnlen(target, NFS_MAX_FILE_NAME - 1) >= NFS_INODE_INLINE_SZ;
+	int ret = NFS_ERROR_NONE;
 
+	NFS_RENAME_RDLOCK();
+	last_dentry = nfs_lookup(path, &is_find, &is_root);
+	if (last_dentry == NULL) {
+		NFS_RENAME_UNLOCK();
+		return -NFS_ERROR_IO;
+	}
+	parent      = last_dentry->inode;
+	NFS_INODE_WRLOCK(parent);
 	if (is_find) {
-		return -NFS_ERROR_EXISTS;
+		ret = -NFS_ERROR_EXISTS;
 	}
-
-	if (NFS_IS_REG(last_dentry->inode)) {
-		return -NFS_ERROR_UNSUPPORTED;
+	else if (!NFS_IS_DIR(parent)) {
+		ret = -NFS_ERROR_UNSUPPORTED;
 	}
-
-	fname  = nfs_get_fname(path);
-	dentry = new_dentry(fname, NFS_DIR); 
-	nfs_alloc_datamap2(dentry);
-	dentry->parent = last_dentry;
-	inode  = nfs_alloc_inode(dentry);
-	nfs_alloc_dentry(last_dentry->inode, dentry);
-	
-	return NFS_ERROR_NONE;
+	else if (nfs_dir_lookup(parent, fname, &dentry) != NFS_ERROR_NONE) {
+		ret = -NFS_ERROR_IO;
+	}
+	else if (dentry != NULL) {						  /* 查找之后被并发创建 */
+		ret = -NFS_ERROR_EXISTS;
+	}
+	else if (nfs_dir_reserve(parent, strlen(fname)) != NFS_ERROR_NONE) {
+		ret = parent->is_loaded ? -NFS_ERROR_NOSPACE : -NFS_ERROR_IO; /* 未读入即目录读不出 */
+	}
+	else if (is_long_link && nfs_reserve_data(1) != NFS_ERROR_NONE) {
+		ret = -NFS_ERROR_NOSPACE;
+	}
+	else {
+		dentry = new_dentry(parent, fname, ftype);
+		dentry->parent = last_dentry;
+		inode  = nfs_alloc_inode(dentry);
+		if (inode == NULL) {						  /* inode位图已满 */
+			nfs_slab_free(&nfs_super.dentry_slab, dentry);
+			if (is_long_link) {
+				nfs_release_data(1);
+			}
+			ret = -NFS_ERROR_NOSPACE;
+		}
+		else {
+			if (target != NULL) {					  /* 写回前设置好目标路径 */
+				NFS_INODE_WRLOCK(inode);
+				strncpy(inode->target_path, target, NFS_MAX_FILE_NAME - 1);
+				inode->size     = strlen(inode->target_path);
+				inode->rsv_blks = is_long_link ? 1 : 0; /* 较长的目标写在数据块中，见nfs_sync_symlink */
+				nfs_mark_dirty(inode, NFS_INODE_DIRTY_ALL);
+				NFS_INODE_UNLOCK(inode);
+			}
+			nfs_alloc_dentry(parent, dentry);		  /* 目录已由nfs_dir_reserve读入，不会失败 */
+			nfs_pcache_invalidate(path, FALSE);		  /* 删除负项 */
+		}
+	}
+	NFS_INODE_UNLOCK(parent);
+	nfs_put_inode(parent);
+	NFS_RENAME_UNLOCK();
+	return ret;
 }
 /**
- * @brief 获取文件属性
+ * @brief 
  * 
- * @param path 相对于挂载点的路径
- * @param nfs_stat 返回状态
+ * @param path 
+ * @param mode 
  * @return int 
  */
-int nfs_getattr(const char* path, struct stat * nfs_stat) {
+int nfs_mkdir(const char* path, mode_t mode) {
+	(void)mode;
+	return nfs_create(path, NFS_DIR, NULL);
+}
+/**
+ * @brief 取得操作的inode：已open的文件直接用fi->fh中的句柄，否则按路径查找并引用
+ * 
+ * @param path 
+ * @param fi 可以为NULL
+ * @param inode 取得的inode，用完后调用nfs_file_put
+ * @return int 不存在返回-NFS_ERROR_NOTFOUND，读不出返回-NFS_ERROR_IO
+ */
+static int nfs_file_inode(const char* path, struct fuse_file_info* fi, struct nfs_inode** inode) {
 	boolean	is_find, is_root;
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
-	if (is_find == FALSE) {
+	struct nfs_dentry* dentry;
+
+	if (fi != NULL && fi->fh != 0) {
+		*inode = ((struct nfs_file*)(uintptr_t)fi->fh)->inode;
+		return NFS_ERROR_NONE;
+	}
+	dentry = nfs_lookup_nolock(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NFS_ERROR_IO;
+	}
+	if (!is_find) {
+		nfs_put_inode(dentry->inode);
 		return -NFS_ERROR_NOTFOUND;
 	}
+	*inode = dentry->inode;
+	return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放nfs_file_inode按路径查找时取得的引用
+ * 
+ * @param inode 
+ * @param fi 
+ */
+static void nfs_file_put(struct nfs_inode* inode, struct fuse_file_info* fi) {
+	if (fi == NULL || fi->fh == 0) {
+		nfs_put_inode(inode);
+	}
+}
+/**
+ * @brief 由dentry填充文件属性，inode未读入时先读入
+ * 
+ * @param dentry 已引用其inode，或持有父目录的写锁
+ * @param nfs_stat 
+ * @return int 
+ */
+static int nfs_fill_stat(struct nfs_dentry* dentry, struct stat * nfs_stat) {
+	struct nfs_inode* inode;
+
+	if (dentry->inode == NULL) {
+		NFS_RCU_ASSIGN(dentry->inode, nfs_read_inode(dentry, dentry->ino));
+	}
+	inode = dentry->inode;
+	if (inode == NULL) {
+		return -NFS_ERROR_IO;
+	}
+	memset(nfs_stat, 0, sizeof(struct stat));
 
-	if (NFS_IS_DIR(dentry->inode)) {
+	NFS_INODE_RDLOCK(inode);
+	if (NFS_IS_DIR(inode)) {
 		nfs_stat->st_mode = S_IFDIR | NFS_DEFAULT_PERM;
-		nfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct nfs_dentry_d);
+		nfs_stat->st_size = inode->dir_cnt * sizeof(struct nfs_dentry_d);
 	}
-	else if (NFS_IS_REG(dentry->inode)) {
+	else if (NFS_IS_REG(inode)) {
 		nfs_stat->st_mode = S_IFREG | NFS_DEFAULT_PERM;
-		nfs_stat->st_size = dentry->inode->size;
+		nfs_stat->st_size = inode->size;
 	}
-	else if (NFS_IS_SYM_LINK(dentry->inode)) {
+	else if (NFS_IS_SYM_LINK(inode)) {
 		nfs_stat->st_mode = S_IFLNK | NFS_DEFAULT_PERM;
-		nfs_stat->st_size = dentry->inode->size;
+		nfs_stat->st_size = inode->size;
 	}
+	NFS_INODE_UNLOCK(inode);
 
+	nfs_stat->st_ino     = dentry->ino;
 	nfs_stat->st_nlink = 1;
 	nfs_stat->st_uid 	 = getuid();
 	nfs_stat->st_gid 	 = getgid();
 	nfs_stat->st_atime   = time(NULL);
 	nfs_stat->st_mtime   = time(NULL);
 	nfs_stat->st_blksize = NFS_IO_SZ();
+	return NFS_ERROR_NONE;
+}
+/**
+ * @brief 获取文件属性
+ * 
+ * @param path 相对于挂载点的路径
+ * @param nfs_stat 返回状态
+ * @return int 
+ */
+int nfs_getattr(const char* path, struct stat * nfs_stat) {
+	boolean	is_find, is_root;
+	struct nfs_dentry* dentry;
+	int ret;
+
+	dentry = nfs_lookup_nolock(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		nfs_put_inode(dentry->inode);
+		return -NFS_ERROR_NOTFOUND;
+	}
+
+	ret = nfs_fill_stat(dentry, nfs_stat);
+	if (ret < 0) {
+		nfs_put_inode(dentry->inode);
+		return ret;
+	}
 
 	if (is_root) {
 		nfs_stat->st_size	= nfs_super.sz_usage; 
 		nfs_stat->st_blocks = NFS_DISK_SZ() / NFS_IO_SZ();
 		nfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
 	}
+	nfs_put_inode(dentry->inode);
 	return NFS_ERROR_NONE;
 }
+/**
+ * @brief 获取已open文件的属性，不查找路径
+ * 
+ * @param path 
+ * @param nfs_stat 
+ * @param fi 
+ * @return int 
+ */
+int nfs_fgetattr(const char* path, struct stat * nfs_stat, struct fuse_file_info* fi) {
+	if (fi == NULL || fi->fh == 0) {
+		return nfs_getattr(path, nfs_stat);
+	}
+	return nfs_fill_stat(((struct nfs_file*)(uintptr_t)fi->fh)->inode->dentry, nfs_stat);
+}
 /**
  * @brief 
  * 
@@ -146,6 +311,11 @@ int nfs_getattr(const char* path, struct stat * nfs_stat) {
  * stbuf: 文件状态，可忽略
  * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
  * 
+ * filler返回1表示buf已满。一次调用尽量填满buf，游标保存在nfs_opendir
+ * 放入fi->fh的nfs_dir_cursor中，下一次从游标处继续，不必从链表头重新数。
+ * 
+ * 持目录读锁遍历；目录未完整读入或需要读入子inode（readdir_stat）时持写锁
+ * 
  * @param offset 
  * @param fi 
  * @return int 
@@ -153,20 +323,70 @@ int nfs_getattr(const char* path, struct stat * nfs_stat) {
 int nfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    struct fuse_file_info * fi) {
     boolean	is_find, is_root;
-	int		cur_dir = offset;
-
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
+	struct nfs_dir_cursor  tmp_cursor;
+	struct nfs_dir_cursor* cursor = (struct nfs_dir_cursor*)(uintptr_t)fi->fh;
+	struct nfs_dentry* dentry;
 	struct nfs_dentry* sub_dentry;
 	struct nfs_inode* inode;
-	if (is_find) {
-		inode = dentry->inode;
-		sub_dentry = nfs_get_dentry(inode, cur_dir);
-		if (sub_dentry) {
-			filler(buf, sub_dentry->fname, NULL, ++offset);
+	struct stat sub_stat;
+	int ret = NFS_ERROR_NONE;
+
+	if (cursor == NULL) {							  /* 未经opendir，临时游标 */
+		dentry = nfs_lookup_nolock(path, &is_find, &is_root);
+		if (dentry == NULL) {
+			return -NFS_ERROR_IO;
 		}
-		return NFS_ERROR_NONE;
+		if (!is_find) {
+			nfs_put_inode(dentry->inode);
+			return -NFS_ERROR_NOTFOUND;
+		}
+		memset(&tmp_cursor, 0, sizeof(struct nfs_dir_cursor));
+		tmp_cursor.inode  = dentry->inode;
+		tmp_cursor.offset = -1;
+		cursor = &tmp_cursor;
+	}
+	inode = cursor->inode;
+
+	NFS_INODE_RDLOCK(inode);
+	if (!inode->is_loaded || nfs_options.readdir_stat) {
+		NFS_INODE_UNLOCK(inode);
+		NFS_INODE_WRLOCK(inode);
+	}
+	if (nfs_dir_load(inode) != NFS_ERROR_NONE) {	  /* 只有未经opendir的临时游标会走到这里 */
+		cursor->next = NULL;
+		ret = -NFS_ERROR_IO;
+	}
+	else if (cursor->offset != offset || cursor->version != inode->dir_version) {
+		cursor->next    = nfs_get_dentry(inode, offset);   /* seek或目录被修改过，重新定位 */
+		cursor->offset  = offset;
+		cursor->version = inode->dir_version;
+	}
+
+	while (cursor->next) {
+		sub_dentry = cursor->next;
+		if (nfs_options.readdir_stat) {
+			ret = nfs_fill_stat(sub_dentry, &sub_stat);
+			if (ret < 0) {
+				break;
+			}
+		}
+		else {										  /* 只给出类型，不读子inode */
+			memset(&sub_stat, 0, sizeof(struct stat));
+			sub_stat.st_ino  = sub_dentry->ino;
+			sub_stat.st_mode = sub_dentry->ftype == NFS_DIR ? S_IFDIR : 
+							   sub_dentry->ftype == NFS_SYM_LINK ? S_IFLNK : S_IFREG;
+		}
+		if (filler(buf, sub_dentry->fname, &sub_stat, cursor->offset + 1)) {
+			break;									  /* buf已满 */
+		}
+		cursor->next = sub_dentry->brother;
+		cursor->offset++;
+	}
+	NFS_INODE_UNLOCK(inode);
+	if (cursor == &tmp_cursor) {
+		nfs_put_inode(inode);
 	}
-	return -NFS_ERROR_NOTFOUND;
+	return ret;
 }
 /**
  * @brief 
@@ -177,34 +397,38 @@ int nfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t off
  * @return int 
  */
 int nfs_mknod(const char* path, mode_t mode, dev_t dev) {
-	boolean	is_find, is_root;
-	
-	struct nfs_dentry* last_dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_dentry* dentry;
-	struct nfs_inode* inode;
-	char* fname;
-	
-	if (is_find == TRUE) {
-		return -NFS_ERROR_EXISTS;
+	return nfs_create(path, S_ISDIR(mode) ? NFS_DIR : NFS_REG_FILE, NULL);
+}
+/**
+ * @brief 写入已加写锁的inode
+ * 
+ * @param inode 
+ * @param buf 
+ * @param size 
+ * @param offset 
+ * @return int 
+ */
+static int nfs_write_inode(struct nfs_inode* inode, const char* buf, size_t size, off_t offset) {
+	if (NFS_IS_DIR(inode)) {
+		return -NFS_ERROR_ISDIR;	
 	}
 
-	fname = nfs_get_fname(path);
-	
-	if (S_ISREG(mode)) {
-		dentry = new_dentry(fname, NFS_REG_FILE);
+	if (inode->size < offset) {
+		return -NFS_ERROR_SEEK;
 	}
-	else if (S_ISDIR(mode)) {
-		dentry = new_dentry(fname, NFS_DIR);
+
+	if (nfs_data_load(inode) != NFS_ERROR_NONE) {
+		return -NFS_ERROR_IO;
 	}
-	else {
-		dentry = new_dentry(fname, NFS_REG_FILE);
+	if (nfs_resize_data(inode, offset + size) != NFS_ERROR_NONE) {
+		return -NFS_ERROR_NOSPACE;
 	}
-	nfs_alloc_datamap2(dentry);
-	dentry->parent = last_dentry;
-	inode = nfs_alloc_inode(dentry);
-	nfs_alloc_dentry(last_dentry->inode, dentry);
 
-	return NFS_ERROR_NONE;
+	memcpy(inode->data + offset, buf, size);
+	inode->size = offset + size > inode->size ? offset + size : inode->size;
+	nfs_mark_dirty(inode, NFS_INODE_DIRTY_META | NFS_INODE_DIRTY_DATA);
+	
+	return size;
 }
 /**
  * @brief 
@@ -218,16 +442,32 @@ int nfs_mknod(const char* path, mode_t mode, dev_t dev) {
  */
 int nfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-    boolean	is_find, is_root;
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode*  inode;
+	int ret = nfs_file_inode(path, fi, &inode);
 	
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
+	if (ret != NFS_ERROR_NONE) {
+		return ret;
 	}
+	NFS_INODE_WRLOCK(inode);
+	ret = nfs_write_inode(inode, buf, size, offset);
+	NFS_INODE_UNLOCK(inode);
+	nfs_file_put(inode, fi);
+	return ret;
+}
+/**
+ * @brief 从已加锁的inode读出
+ * 
+ * @param inode 
+ * @param file 已open的句柄，按路径读时为NULL
+ * @param buf 
+ * @param size 
+ * @param offset 
+ * @return int 
+ */
+static int nfs_read_inode_data(struct nfs_inode* inode, struct nfs_file* file, char* buf,
+							   size_t size, off_t offset) {
+	uint8_t inline_data[NFS_INODE_INLINE_SZ];
 
-	inode = dentry->inode;
-	
 	if (NFS_IS_DIR(inode)) {
 		return -NFS_ERROR_ISDIR;	
 	}
@@ -236,13 +476,37 @@ int nfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		return -NFS_ERROR_SEEK;
 	}
 
-	memcpy(inode->data + offset, buf, size);
-	inode->size = offset + size > inode->size ? offset + size : inode->size;
-	
-	return size;
+	if (offset + size > inode->size) {				  /* 不读出文件末尾之后的内容 */
+		size = inode->size - offset;
+	}
+	if (size == 0) {
+		return 0;
+	}
+	if (inode->data == NULL && NFS_IS_INLINE(inode)) { /* 内联的内容已被丢弃，从inode记录读出 */
+		if (nfs_read_inline(inode, inline_data) != NFS_ERROR_NONE) {
+			return -NFS_ERROR_IO;
+		}
+		memcpy(buf, inline_data + offset, size);
+		return size;
+	}
+	if (inode->data == NULL && nfs_cache_enabled()) {  /* 经块缓存只读需要的块，顺序读时预读 */
+		if (file != NULL) {
+			nfs_data_readahead(file, offset, size);
+		}
+		if (nfs_extent_pread(inode, (uint8_t *)buf, size, offset) != NFS_ERROR_NONE) {
+			return -NFS_ERROR_IO;
+		}
+		return size;
+	}
+	if (nfs_data_load(inode) != NFS_ERROR_NONE) {
+		return -NFS_ERROR_IO;
+	}
+	memcpy(buf, inode->data + offset, size);
+
+	return size;			   
 }
 /**
- * @brief 
+ * @brief 持inode读锁读，同一文件的读可以并发；需要读入整个文件数据时改持写锁
  * 
  * @param path 
  * @param buf 
@@ -253,27 +517,80 @@ int nfs_write(const char* path, const char* buf, size_t size, off_t offset,
  */
 int nfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	boolean	is_find, is_root;
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode*  inode;
+	struct nfs_file*   file  = fi != NULL ? (struct nfs_file*)(uintptr_t)fi->fh : NULL;
+	int ret = nfs_file_inode(path, fi, &inode);
 
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
+	if (ret != NFS_ERROR_NONE) {
+		return ret;
 	}
-
-	inode = dentry->inode;
-	
-	if (NFS_IS_DIR(inode)) {
-		return -NFS_ERROR_ISDIR;	
+	NFS_INODE_RDLOCK(inode);
+	if (inode->data == NULL && !nfs_cache_enabled()) {
+		NFS_INODE_UNLOCK(inode);
+		NFS_INODE_WRLOCK(inode);
 	}
+	ret = nfs_read_inode_data(inode, file, buf, size, offset);
+	NFS_INODE_UNLOCK(inode);
+	nfs_file_put(inode, fi);
+	return ret;
+}
+/**
+ * @brief 持目录写锁完整读入目录，之后对它的修改不会因读入失败而中断
+ * 
+ * @param inode 目录inode
+ * @return int 
+ */
+static int nfs_load_dir(struct nfs_inode* inode) {
+	int ret;
 
-	if (inode->size < offset) {
-		return -NFS_ERROR_SEEK;
-	}
+	NFS_INODE_WRLOCK(inode);
+	ret = nfs_dir_load(inode);
+	NFS_INODE_UNLOCK(inode);
+	return ret;
+}
+/**
+ * @brief 删除nfs_lookup得到的dentry，调用者持有rename_lock
+ * 
+ * 持父目录写锁确认dentry仍在目录中，并发删除同一文件时只有一个成功
+ * 
+ * @param path 
+ * @param dentry 其inode已被nfs_lookup引用，这里释放
+ * @param is_find 
+ * @param is_root 
+ * @return int 
+ */
+static int nfs_remove(const char* path, struct nfs_dentry* dentry, boolean is_find,
+					  boolean is_root) {
+	struct nfs_inode* inode = dentry->inode;
+	struct nfs_inode* parent;
+	struct nfs_dentry* found;
+	int ret = NFS_ERROR_NONE;
 
-	memcpy(buf, inode->data + offset, size);
+	if (is_find == FALSE || is_root) {
+		nfs_put_inode(inode);
+		return is_find ? -NFS_ERROR_INVAL : -NFS_ERROR_NOTFOUND;
+	}
 
-	return size;			   
+	parent = dentry->parent->inode;
+	NFS_INODE_WRLOCK(parent);
+	if (nfs_dir_load(parent) != NFS_ERROR_NONE) {	  /* 先完整读入，之后的摘除不会失败 */
+		ret = -NFS_ERROR_IO;
+	}
+	else if (nfs_dir_lookup(parent, dentry->fname, &found) != NFS_ERROR_NONE || found != dentry) {
+		ret = -NFS_ERROR_NOTFOUND;					  /* 已被并发删除 */
+	}
+	else if (NFS_IS_DIR(inode) && nfs_load_dir(inode) != NFS_ERROR_NONE) {
+		ret = -NFS_ERROR_IO;						  /* 读不出的子树无法回收，不删除 */
+	}
+	else {
+		nfs_pcache_invalidate(path, NFS_IS_DIR(inode)); /* 目录连同其下路径一起失效 */
+		ret = nfs_drop_inode(inode);
+		nfs_drop_dentry(parent, dentry);
+		nfs_free_dentry(dentry);					  /* 仍被打开时保留到最后一次关闭 */
+	}
+	NFS_INODE_UNLOCK(parent);
+	nfs_put_inode(inode);
+	return ret;
 }
 /**
  * @brief 
@@ -283,72 +600,145 @@ int nfs_read(const char* path, char* buf, size_t size, off_t offset,
  */
 int nfs_unlink(const char* path) {
 	boolean	is_find, is_root;
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_inode*  inode;
+	struct nfs_dentry* dentry;
+	int ret;
 
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
+	NFS_RENAME_RDLOCK();
+	dentry = nfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		NFS_RENAME_UNLOCK();
+		return -NFS_ERROR_IO;
 	}
-
-	inode = dentry->inode;
-
-	nfs_drop_inode(inode);
-	nfs_drop_dentry(dentry->parent->inode, dentry);
-	return NFS_ERROR_NONE;
+	if (is_find && !is_root && NFS_IS_DIR(dentry->inode)) {
+		nfs_put_inode(dentry->inode);
+		NFS_RENAME_UNLOCK();
+		return nfs_rmdir(path);
+	}
+	ret = nfs_remove(path, dentry, is_find, is_root);
+	NFS_RENAME_UNLOCK();
+	return ret;
 }
 /**
  * @brief 删除路径时的步骤
  * rm ./tests/mnt/j/ -r
  *  1) Step 1. rm ./tests/mnt/j/j
  *  2) Step 2. rm ./tests/mnt/j
+ * 
+ * 删除整棵子树，持rename_lock写锁，期间没有路径查找
+ * 
  * @param path 
  * @return int 
  */
 int nfs_rmdir(const char* path) {
-	return nfs_unlink(path);
+	boolean	is_find, is_root;
+	struct nfs_dentry* dentry;
+	int ret;
+
+	NFS_RENAME_WRLOCK();
+	dentry = nfs_lookup(path, &is_find, &is_root);
+	ret    = dentry == NULL ? -NFS_ERROR_IO : nfs_remove(path, dentry, is_find, is_root);
+	NFS_RENAME_WRUNLOCK();
+	return ret;
 }
 /**
- * @brief 
+ * @brief 将from_dentry移到to，调用者持有rename_lock写锁
  * 
+ * 没有并发的命名空间修改，只需在修改目录时持其写锁，与写回和readdir互斥
+ * 
+ * @param from_dentry 
  * @param from 
  * @param to 
  * @return int 
  */
-int nfs_rename(const char* from, const char* to) {
-	int ret = NFS_ERROR_NONE;
+static int nfs_move(struct nfs_dentry* from_dentry, const char* from, const char* to) {
 	boolean	is_find, is_root;
-	struct nfs_dentry* from_dentry = nfs_lookup(from, &is_find, &is_root);
-	struct nfs_inode*  from_inode;
-	struct nfs_dentry* to_dentry;
-	mode_t mode = 0;
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
+	struct nfs_dentry* to_dentry = nfs_lookup(to, &is_find, &is_root);
+	struct nfs_inode*  to_inode;
+	struct nfs_dentry* to_parent;
+	struct nfs_inode*  from_parent;
+	int ret;
+
+	if (to_dentry == NULL) {
+		return -NFS_ERROR_IO;
+	}
+	to_inode  = to_dentry->inode;
+	to_parent = is_find ? to_dentry->parent : to_dentry;
+	if (is_find && NFS_IS_DIR(to_inode) && to_inode->dir_cnt > 0) {
+		nfs_put_inode(to_inode);
+		return -ENOTEMPTY;
+	}
+	if (!NFS_IS_DIR(to_parent->inode)) {
+		nfs_put_inode(to_inode);
+		return -ENOTDIR;
+	}
+	NFS_INODE_WRLOCK(to_parent->inode);				  /* 先预留目的目录的桶块，之后的加入不会失败 */
+	ret = nfs_dir_reserve(to_parent->inode, strlen(nfs_get_fname(to)));
+	NFS_INODE_UNLOCK(to_parent->inode);
+	if (ret != NFS_ERROR_NONE) {
+		nfs_put_inode(to_inode);
+		return ret;
+	}
+	from_parent = from_dentry->parent->inode;
+	if (nfs_load_dir(from_parent) != NFS_ERROR_NONE) { /* 源目录也先完整读入，之后的摘除不会失败 */
+		nfs_put_inode(to_inode);
+		return -NFS_ERROR_IO;
 	}
 
-	if (strcmp(from, to) == 0) {
-		return NFS_ERROR_NONE;
+	if (is_find) {									  /* 目的文件已存在，先删除 */
+		NFS_INODE_WRLOCK(to_parent->inode);
+		nfs_pcache_invalidate(to, NFS_IS_DIR(to_inode));
+		nfs_drop_inode(to_inode);
+		nfs_drop_dentry(to_parent->inode, to_dentry);
+		nfs_free_dentry(to_dentry);
+		NFS_INODE_UNLOCK(to_parent->inode);
 	}
+	nfs_put_inode(to_inode);						  /* to_parent在持有写锁期间不会被删除 */
+													  /* 复用原dentry，inode和子目录项的指针保持不变 */
+	NFS_INODE_WRLOCK(from_parent);
+	nfs_drop_dentry(from_parent, from_dentry);
+	NFS_INODE_UNLOCK(from_parent);
 
-	from_inode = from_dentry->inode;
-	
-	if (NFS_IS_DIR(from_inode)) {
-		mode = S_IFDIR;
+	NFS_INODE_WRLOCK(to_parent->inode);
+	nfs_dentry_rename(to_parent->inode, from_dentry, nfs_get_fname(to));
+	from_dentry->parent = to_parent;
+	nfs_alloc_dentry(to_parent->inode, from_dentry);
+	NFS_INODE_UNLOCK(to_parent->inode);
+	nfs_pcache_invalidate(from, NFS_IS_DIR(from_dentry->inode));
+	nfs_pcache_invalidate(to, FALSE);				  /* 删除负项 */
+	return NFS_ERROR_NONE;
+}
+/**
+ * @brief 
+ * 
+ * @param from 
+ * @param to 
+ * @return int 
+ */
+int nfs_rename(const char* from, const char* to) {
+	boolean	is_find, is_root;
+	struct nfs_dentry* from_dentry;
+	int ret;
+
+	NFS_RENAME_WRLOCK();
+	from_dentry = nfs_lookup(from, &is_find, &is_root);
+	if (from_dentry == NULL) {
+		NFS_RENAME_WRUNLOCK();
+		return -NFS_ERROR_IO;
 	}
-	else if (NFS_IS_REG(from_inode)) {
-		mode = S_IFREG;
+	if (is_find == FALSE) {
+		ret = -NFS_ERROR_NOTFOUND;
 	}
-	
-	ret = nfs_mknod(to, mode, (dev_t)NULL);//强转了NULL的类型解决报错
-	if (ret != NFS_ERROR_NONE) {					  /* 保证目的文件不存在 */
-		return ret;
+	else if (is_root) {
+		ret = -NFS_ERROR_INVAL;
 	}
-	
-	to_dentry = nfs_lookup(to, &is_find, &is_root);	  
-	nfs_drop_inode(to_dentry->inode);				  /* 保证生成的inode被释放 */	
-	to_dentry->ino = from_inode->ino;				  /* 指向新的inode */
-	to_dentry->inode = from_inode;
-	
-	nfs_drop_dentry(from_dentry->parent->inode, from_dentry);
+	else if (strcmp(from, to) == 0) {
+		ret = NFS_ERROR_NONE;
+	}
+	else {
+		ret = nfs_move(from_dentry, from, to);
+	}
+	nfs_put_inode(from_dentry->inode);
+	NFS_RENAME_WRUNLOCK();
 	return ret;
 }
 /**
@@ -359,17 +749,7 @@ int nfs_rename(const char* from, const char* to) {
  * @return int 
  */
 int nfs_symlink(const char* path, const char* link){
-	int ret = NFS_ERROR_NONE;
-	boolean	is_find, is_root;
-	ret = nfs_mknod(link, S_IFREG, (dev_t)NULL);
-	struct nfs_dentry* dentry = nfs_lookup(link, &is_find, &is_root);
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
-	}
-	dentry->ftype = NFS_SYM_LINK;
-	struct nfs_inode* inode = dentry->inode;
-	memcpy(inode->target_path, path, NFS_MAX_FILE_NAME);
-	return ret;
+	return nfs_create(link, NFS_SYM_LINK, path);
 }
 /**
  * @brief 
@@ -383,36 +763,79 @@ int nfs_readlink (const char *path, char *buf, size_t size){
 	/* nfs 暂未实现硬链接，只支持软链接 */
 	boolean	is_find, is_root;
 	ssize_t llen;
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
+	struct nfs_dentry* dentry;
+	struct nfs_inode* inode;
+
+	dentry = nfs_lookup_nolock(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NFS_ERROR_IO;
 	}
-	if (dentry->ftype != NFS_SYM_LINK){
-		return -NFS_ERROR_INVAL;
+	inode  = dentry->inode;
+	if (is_find == FALSE || dentry->ftype != NFS_SYM_LINK) {
+		nfs_put_inode(inode);
+		return is_find ? -NFS_ERROR_INVAL : -NFS_ERROR_NOTFOUND;
 	}
-	struct nfs_inode* inode = dentry->inode;
+	NFS_INODE_RDLOCK(inode);
 	llen = strlen(inode->target_path);
-	if(size < 0){
-		return -NFS_ERROR_INVAL;
+	if(llen > size){
+		strncpy(buf, inode->target_path, size);
+		buf[size] = '\0';
 	}else{
-		if(llen > size){
-			strncpy(buf, inode->target_path, size);
-			buf[size] = '\0';
-		}else{
-			strncpy(buf, inode->target_path, llen);
-			buf[llen] = '\0';
-		}
+		strncpy(buf, inode->target_path, llen);
+		buf[llen] = '\0';
 	}
+	NFS_INODE_UNLOCK(inode);
+	nfs_put_inode(inode);
 	return NFS_ERROR_NONE;
 }
 /**
- * @brief 
+ * @brief 解析一次路径，将文件句柄放入fi->fh，之后的read/write不再查找路径
  * 
  * @param path 
  * @param fi 
  * @return int 
  */
 int nfs_open(const char* path, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct nfs_dentry* dentry;
+	struct nfs_file*   file;
+
+	dentry = nfs_lookup_nolock(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NFS_ERROR_IO;
+	}
+	if (is_find == FALSE || NFS_IS_DIR(dentry->inode)) {
+		nfs_put_inode(dentry->inode);
+		return is_find ? -NFS_ERROR_ISDIR : -NFS_ERROR_NOTFOUND;
+	}
+
+	file = (struct nfs_file*)malloc(sizeof(struct nfs_file));
+	file->inode     = dentry->inode;				  /* nfs_lookup的引用交给句柄 */
+	file->ra_prev   = 0;
+	file->ra_stride = 0;
+	file->ra_window = 0;
+	file->ra_end    = 0;
+	pthread_mutex_init(&file->ra_lock, NULL);
+	fi->fh = (uint64_t)(uintptr_t)file;
+	return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放open分配的句柄，文件已被删除且这是最后一个句柄时释放inode
+ * 
+ * @param path 
+ * @param fi 
+ * @return int 
+ */
+int nfs_release(const char* path, struct fuse_file_info* fi) {
+	struct nfs_file* file = (struct nfs_file*)(uintptr_t)fi->fh;
+
+	if (file == NULL) {
+		return NFS_ERROR_NONE;
+	}
+	nfs_put_inode(file->inode);
+	pthread_mutex_destroy(&file->ra_lock);
+	free(file);
+	fi->fh = 0;
 	return NFS_ERROR_NONE;
 }
 /**
@@ -423,6 +846,56 @@ int nfs_open(const char* path, struct fuse_file_info* fi) {
  * @return int 
  */
 int nfs_opendir(const char* path, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct nfs_dentry* dentry;
+	struct nfs_inode*  inode;
+	struct nfs_dir_cursor* cursor;
+	int ret = NFS_ERROR_NONE;
+
+	dentry = nfs_lookup_nolock(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NFS_ERROR_IO;
+	}
+	inode  = dentry->inode;
+	if (is_find == FALSE || !NFS_IS_DIR(inode)) {
+		nfs_put_inode(inode);
+		return is_find ? -ENOTDIR : -NFS_ERROR_NOTFOUND;
+	}
+
+	NFS_INODE_WRLOCK(inode);
+	if (nfs_dir_load(inode) != NFS_ERROR_NONE) {
+		ret = -NFS_ERROR_IO;
+	}
+	else {
+		cursor = (struct nfs_dir_cursor*)malloc(sizeof(struct nfs_dir_cursor));
+		cursor->inode   = inode;					  /* nfs_lookup的引用交给游标 */
+		cursor->next    = inode->dentrys;
+		cursor->offset  = 0;
+		cursor->version = inode->dir_version;
+		fi->fh = (uint64_t)(uintptr_t)cursor;
+	}
+	NFS_INODE_UNLOCK(inode);
+	if (ret != NFS_ERROR_NONE) {
+		nfs_put_inode(inode);
+	}
+	return ret;
+}
+/**
+ * @brief 释放opendir分配的游标
+ * 
+ * @param path 
+ * @param fi 
+ * @return int 
+ */
+int nfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	struct nfs_dir_cursor* cursor = (struct nfs_dir_cursor*)(uintptr_t)fi->fh;
+
+	if (cursor == NULL) {
+		return NFS_ERROR_NONE;
+	}
+	nfs_put_inode(cursor->inode);
+	free(cursor);
+	fi->fh = 0;
 	return NFS_ERROR_NONE;
 }
 /**
@@ -435,8 +908,13 @@ int nfs_opendir(const char* path, struct fuse_file_info* fi) {
 boolean nfs_access(const char* path, int type) {
 	boolean	is_find, is_root;
 	boolean is_access_ok = FALSE;
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_inode*  inode;
+	struct nfs_dentry* dentry;
+
+	dentry = nfs_lookup_nolock(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return FALSE;
+	}
+	nfs_put_inode(dentry->inode);
 
 	switch (type)
 	{
@@ -470,6 +948,34 @@ int nfs_utimens(const char* path, const struct timespec tv[2]) {
 	(void)path;
 	return NFS_ERROR_NONE;
 }
+/**
+ * @brief 改变文件大小
+ * 
+ * @param inode 调用者持有其写锁
+ * @param offset 
+ * @return int 
+ */
+static int nfs_truncate_inode(struct nfs_inode* inode, off_t offset) {
+	if (NFS_IS_DIR(inode)) {
+		return -NFS_ERROR_ISDIR;
+	}
+
+	if (offset > inode->size) {						  /* 扩展部分补0，需要读入数据 */
+		if (nfs_data_load(inode) != NFS_ERROR_NONE) {
+			return -NFS_ERROR_IO;
+		}
+		if (nfs_resize_data(inode, offset) != NFS_ERROR_NONE) {
+			return -NFS_ERROR_NOSPACE;
+		}
+		memset(inode->data + inode->size, 0, offset - inode->size);
+		nfs_mark_dirty(inode, NFS_INODE_DIRTY_DATA);
+	}
+	nfs_shrink_data(inode, NFS_ROUND_UP(offset, NFS_BLKS_SZ(1)) / NFS_BLKS_SZ(1));
+	inode->size = offset;
+	nfs_mark_dirty(inode, NFS_INODE_DIRTY_META);
+
+	return NFS_ERROR_NONE;
+}
 /**
  * @brief 
  * 
@@ -478,23 +984,76 @@ int nfs_utimens(const char* path, const struct timespec tv[2]) {
  * @return int 
  */
 int nfs_truncate(const char* path, off_t offset) {
-	boolean	is_find, is_root;
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_inode*  inode;
+	return nfs_ftruncate(path, offset, NULL);
+}
+/**
+ * @brief 对已open的文件改变大小
+ * 
+ * @param path 
+ * @param offset 
+ * @param fi 
+ * @return int 
+ */
+int nfs_ftruncate(const char* path, off_t offset, struct fuse_file_info* fi) {
+	struct nfs_inode* inode;
+	int ret = nfs_file_inode(path, fi, &inode);
 	
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
+	if (ret != NFS_ERROR_NONE) {
+		return ret;
 	}
-	
-	inode = dentry->inode;
+	NFS_INODE_WRLOCK(inode);
+	ret = nfs_truncate_inode(inode, offset);
+	NFS_INODE_UNLOCK(inode);
+	nfs_file_put(inode, fi);
+	return ret;
+}
+/**
+ * @brief close时调用，将该文件的脏inode和数据写入块缓存，由后台刷写或fsync落盘
+ * 
+ * @param path 
+ * @param fi 
+ * @return int 
+ */
+int nfs_flush(const char* path, struct fuse_file_info* fi) {
+	struct nfs_inode* inode;
+	int ret = nfs_file_inode(path, fi, &inode);
 
-	if (NFS_IS_DIR(inode)) {
-		return -NFS_ERROR_ISDIR;
+	if (ret != NFS_ERROR_NONE) {
+		return ret;
 	}
+	NFS_INODE_WRLOCK(inode);
+	if (__atomic_load_n(&inode->is_orphan, __ATOMIC_SEQ_CST)) {
+		ret = NFS_ERROR_NONE;						  /* 已删除但仍打开，无需写回 */
+	}
+	else {
+		ret = nfs_sync_inode(inode);
+	}
+	NFS_INODE_UNLOCK(inode);
+	nfs_file_put(inode, fi);
+	return ret;
+}
+/**
+ * @brief 写回该文件及位图，并将块缓存中的脏块写到设备
+ * 
+ * @param path 
+ * @param datasync 
+ * @param fi 
+ * @return int 
+ */
+int nfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	int ret = nfs_flush(path, fi);
+	(void)datasync;
 
-	inode->size = offset;
-
-	return NFS_ERROR_NONE;
+	if (ret != NFS_ERROR_NONE) {
+		return ret;
+	}
+	if (nfs_sync_super() != NFS_ERROR_NONE) {		  /* 位图未修改时直接返回 */
+		return -NFS_ERROR_IO;
+	}
+	if (nfs_cache_flush() != NFS_ERROR_NONE) {
+		return -NFS_ERROR_IO;
+	}
+	return nfs_super.backend->sync();
 }
 /**
  * @brief 展示nfs用法
@@ -506,8 +1065,24 @@ void nfs_usage() {
 	printf("Author: Deadpool <deadpoolmine@qq.com>\n");
 	printf("Description: A Filesystem in UserSpacE (FUSE) sample file system \n");
 	printf("\n");
-	printf("Usage: ./nfs-fuse --device=[device path] mntpoint\n");
+	printf("Usage: ./nfs-fuse --device=[backend:][device path] mntpoint\n");
 	printf("mount device to mntpoint with nfs\n");
+	printf("backends: ddriver (default when built with libddriver), file (pread/pwrite),\n");
+	printf("          direct (O_DIRECT), mmap; images are created at %d bytes if empty\n",
+		   NFS_DEFAULT_IMAGE_SZ);
+	printf("\n");
+	printf("nfs options\n");
+	printf("    --cache_blks=[n]       block cache size in IO units (default %d, 0 disables)\n",
+		   NFS_DEFAULT_CACHE_BLKS);
+	printf("    --readdir_stat         return full attributes from readdir\n");
+	printf("    --flush_interval=[s]   write back dirty inodes every s seconds (default %d, 0 disables)\n",
+		   NFS_DEFAULT_FLUSH_INTERVAL);
+	printf("    --data_budget=[KB]     memory for cached file data (default %d, 0 unlimited)\n",
+		   NFS_DEFAULT_DATA_BUDGET);
+	printf("    --aio_workers=[n]      threads issuing device io in parallel (default %d, 0 synchronous;\n"
+		   "                           io_uring on the file backend when built with liburing)\n",
+		   NFS_DEFAULT_AIO_WORKERS);
+	printf("    --debug                print cache and allocator statistics at umount\n");
 	printf("=================================================================\n");
 	printf("FUSE general options\n");
 	return;
@@ -521,6 +1096,10 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	nfs_options.device = strdup("/home/students/200110514/ddriver");
+	nfs_options.cache_blks = NFS_DEFAULT_CACHE_BLKS;
+	nfs_options.flush_interval = NFS_DEFAULT_FLUSH_INTERVAL;
+	nfs_options.data_budget = NFS_DEFAULT_DATA_BUDGET;
+	nfs_options.aio_workers = NFS_DEFAULT_AIO_WORKERS;
 
 	if (fuse_opt_parse(&args, &nfs_options, option_spec, NULL) == -1)
 		return -NFS_ERROR_INVAL;
@@ -0,0 +1,339 @@
+#include "../include/nfs.h"
+#ifdef NFS_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/******************************************************************************
+* SECTION: Global Static Var
+*******************************************************************************/
+static struct nfs_aio_req*   nfs_aio_ring[NFS_AIO_RING];  /* 提交环 */
+static int                   nfs_aio_head;
+static int                   nfs_aio_cnt;
+static pthread_mutex_t       nfs_aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t        nfs_aio_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t        nfs_aio_not_full  = PTHREAD_COND_INITIALIZER;
+static pthread_t*            nfs_aio_workers;
+static int                   nfs_aio_nworkers;            /* 0表示同步执行 */
+static boolean               nfs_aio_stop;
+static int                   nfs_aio_inflight;
+static struct nfs_aio_stats  nfs_aio_stats;
+#ifdef NFS_HAVE_LIBURING
+static struct io_uring       nfs_uring;
+static boolean               nfs_uring_active = FALSE;
+static pthread_t             nfs_uring_reaper;
+#endif
+/**
+ * @brief 请求完成：记录结果、调用回调、通知等待的group
+ *
+ * 回调之后不再访问req，回调可以释放它
+ *
+ * @param req
+ * @param ret
+ */
+static void nfs_aio_complete(struct nfs_aio_req* req, int ret) {
+    struct nfs_aio_group* group = req->group;
+
+    req->ret = ret;
+    if (req->done != NULL) {
+        req->done(req);
+    }
+    pthread_mutex_lock(&group->lock);
+    if (ret != NFS_ERROR_NONE) {
+        group->ret = ret;
+    }
+    if (--group->inflight == 0) {
+        pthread_cond_broadcast(&group->cond);
+    }
+    pthread_mutex_unlock(&group->lock);
+
+    pthread_mutex_lock(&nfs_aio_lock);
+    nfs_aio_inflight--;
+    nfs_aio_stats.completed++;
+    pthread_cond_signal(&nfs_aio_not_full);
+    pthread_mutex_unlock(&nfs_aio_lock);
+}
+/**
+ * @brief 工作线程：从提交环取请求，同步执行后完成
+ *
+ * @param arg
+ * @return void*
+ */
+static void* nfs_aio_worker(void* arg) {
+    struct nfs_aio_req* req;
+
+    pthread_mutex_lock(&nfs_aio_lock);
+    while (TRUE) {
+        while (nfs_aio_cnt == 0 && !nfs_aio_stop) {
+            pthread_cond_wait(&nfs_aio_not_empty, &nfs_aio_lock);
+        }
+        if (nfs_aio_cnt == 0) {                       /* 已停止且环已取空 */
+            break;
+        }
+        req          = nfs_aio_ring[nfs_aio_head];
+        nfs_aio_head = (nfs_aio_head + 1) % NFS_AIO_RING;
+        nfs_aio_cnt--;
+        pthread_mutex_unlock(&nfs_aio_lock);
+
+        nfs_aio_complete(req, nfs_backend_rwv(req->op, req->offset, req->iov, req->iovcnt));
+
+        pthread_mutex_lock(&nfs_aio_lock);
+    }
+    pthread_mutex_unlock(&nfs_aio_lock);
+    return NULL;
+}
+#ifdef NFS_HAVE_LIBURING
+static long nfs_aio_req_len(struct nfs_aio_req* req) {
+    long len = 0;
+    int i;
+    for (i = 0; i < req->iovcnt; i++) {
+        len += req->iov[i].iov_len;
+    }
+    return len;
+}
+/**
+ * @brief io_uring完成线程，读完成队列并调用nfs_aio_complete
+ *
+ * 传输不完整时同步重做整个请求；收到data为NULL的NOP时退出
+ *
+ * @param arg
+ * @return void*
+ */
+static void* nfs_uring_reap(void* arg) {
+    struct io_uring_cqe* cqe;
+    struct nfs_aio_req*  req;
+    int res;
+
+    while (io_uring_wait_cqe(&nfs_uring, &cqe) == 0) {
+        req = (struct nfs_aio_req*)io_uring_cqe_get_data(cqe);
+        res = cqe->res;
+        io_uring_cqe_seen(&nfs_uring, cqe);
+        if (req == NULL) {
+            break;
+        }
+        if (res != nfs_aio_req_len(req)) {
+            res = nfs_backend_rwv(req->op, req->offset, req->iov, req->iovcnt);
+        }
+        else {
+            res = NFS_ERROR_NONE;
+        }
+        nfs_aio_complete(req, res);
+    }
+    return NULL;
+}
+/**
+ * @brief file后端可用时改用io_uring提交
+ *
+ * @return boolean
+ */
+static boolean nfs_uring_start() {
+    if (nfs_backend_fd() < 0 || io_uring_queue_init(NFS_AIO_RING, &nfs_uring, 0) < 0) {
+        return FALSE;
+    }
+    if (pthread_create(&nfs_uring_reaper, NULL, nfs_uring_reap, NULL) != 0) {
+        io_uring_queue_exit(&nfs_uring);
+        return FALSE;
+    }
+    nfs_uring_active = TRUE;
+    return TRUE;
+}
+/**
+ * @brief 调用者持有nfs_aio_lock，且在途请求数小于NFS_AIO_RING
+ *
+ * @param req
+ */
+static void nfs_uring_submit(struct nfs_aio_req* req) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&nfs_uring);
+
+    if (req == NULL) {
+        io_uring_prep_nop(sqe);
+    }
+    else if (req->op == NFS_AIO_READ) {
+        io_uring_prep_readv(sqe, nfs_backend_fd(), req->iov, req->iovcnt, req->offset);
+    }
+    else {
+        io_uring_prep_writev(sqe, nfs_backend_fd(), req->iov, req->iovcnt, req->offset);
+    }
+    io_uring_sqe_set_data(sqe, req);
+    io_uring_submit(&nfs_uring);
+}
+
+static void nfs_uring_stop() {
+    pthread_mutex_lock(&nfs_aio_lock);
+    nfs_uring_submit(NULL);
+    pthread_mutex_unlock(&nfs_aio_lock);
+    pthread_join(nfs_uring_reaper, NULL);
+    io_uring_queue_exit(&nfs_uring);
+    nfs_uring_active = FALSE;
+}
+#endif /* NFS_HAVE_LIBURING */
+/**
+ * @brief 启动异步IO引擎，mount时在后端打开之后调用
+ *
+ * 不支持并发调用的后端（ddriver）同步执行，保证与同步IO之间的顺序
+ *
+ * @param workers 工作线程数，0表示同步执行
+ * @return int
+ */
+int nfs_aio_init(int workers) {
+    int i;
+
+    memset(&nfs_aio_stats, 0, sizeof(struct nfs_aio_stats));
+    nfs_aio_head     = 0;
+    nfs_aio_cnt      = 0;
+    nfs_aio_inflight = 0;
+    nfs_aio_stop     = FALSE;
+    nfs_aio_nworkers = 0;
+    if (workers <= 0 || nfs_super.backend->serial) {
+        return NFS_ERROR_NONE;
+    }
+#ifdef NFS_HAVE_LIBURING
+    if (nfs_uring_start()) {
+        nfs_aio_nworkers = workers;
+        return NFS_ERROR_NONE;
+    }
+#endif
+    nfs_aio_workers = (pthread_t*)malloc(workers * sizeof(pthread_t));
+    for (i = 0; i < workers; i++) {
+        if (pthread_create(&nfs_aio_workers[i], NULL, nfs_aio_worker, NULL) != 0) {
+            break;
+        }
+    }
+    nfs_aio_nworkers = i;
+    return i > 0 ? NFS_ERROR_NONE : -NFS_ERROR_INVAL;
+}
+/**
+ * @brief 初始化一组请求的完成计数
+ *
+ * @param group
+ */
+void nfs_aio_group_init(struct nfs_aio_group* group) {
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->cond, NULL);
+    group->inflight = 0;
+    group->ret      = NFS_ERROR_NONE;
+}
+/**
+ * @brief 提交一个异步请求，提交环满时阻塞
+ *
+ * req及其iov、缓冲区须保持有效直到完成回调返回或nfs_aio_wait返回
+ *
+ * @param group
+ * @param req op、offset、iov、iovcnt、done、arg已填好
+ */
+void nfs_aio_submit(struct nfs_aio_group* group, struct nfs_aio_req* req) {
+    long bytes = 0;
+    int i;
+
+    for (i = 0; i < req->iovcnt; i++) {
+        bytes += req->iov[i].iov_len;
+    }
+    nfs_iov_account(req->iovcnt, bytes);
+    req->group = group;
+    pthread_mutex_lock(&group->lock);
+    group->inflight++;
+    pthread_mutex_unlock(&group->lock);
+
+    pthread_mutex_lock(&nfs_aio_lock);
+    while (nfs_aio_nworkers > 0 && nfs_aio_inflight >= NFS_AIO_RING) {
+        pthread_cond_wait(&nfs_aio_not_full, &nfs_aio_lock);
+    }
+    nfs_aio_stats.submitted++;
+    nfs_aio_inflight++;
+    if (nfs_aio_inflight > nfs_aio_stats.max_depth) {
+        nfs_aio_stats.max_depth = nfs_aio_inflight;
+    }
+    if (nfs_aio_nworkers == 0) {                      /* 同步执行 */
+        pthread_mutex_unlock(&nfs_aio_lock);
+        nfs_aio_complete(req, nfs_backend_rwv(req->op, req->offset, req->iov, req->iovcnt));
+        return;
+    }
+#ifdef NFS_HAVE_LIBURING
+    if (nfs_uring_active) {
+        nfs_uring_submit(req);
+        pthread_mutex_unlock(&nfs_aio_lock);
+        return;
+    }
+#endif
+    nfs_aio_ring[(nfs_aio_head + nfs_aio_cnt) % NFS_AIO_RING] = req;
+    nfs_aio_cnt++;
+    pthread_cond_signal(&nfs_aio_not_empty);
+    pthread_mutex_unlock(&nfs_aio_lock);
+}
+/**
+ * @brief 等待group中的请求全部完成
+ *
+ * @param group
+ * @return int 任一请求出错时返回其错误码
+ */
+int nfs_aio_wait(struct nfs_aio_group* group) {
+    int ret;
+
+    pthread_mutex_lock(&group->lock);
+    while (group->inflight > 0) {
+        pthread_cond_wait(&group->cond, &group->lock);
+    }
+    ret = group->ret;
+    pthread_mutex_unlock(&group->lock);
+    return ret;
+}
+/**
+ * @brief group中的请求是否都已完成，不阻塞
+ *
+ * @param group
+ * @return boolean
+ */
+boolean nfs_aio_poll(struct nfs_aio_group* group) {
+    boolean done;
+
+    pthread_mutex_lock(&group->lock);
+    done = group->inflight == 0;
+    pthread_mutex_unlock(&group->lock);
+    return done;
+}
+/**
+ * @brief 释放group，须在nfs_aio_wait之后调用
+ *
+ * @param group
+ */
+void nfs_aio_group_destroy(struct nfs_aio_group* group) {
+    pthread_mutex_destroy(&group->lock);
+    pthread_cond_destroy(&group->cond);
+}
+/**
+ * @brief 执行完已提交的请求后停止工作线程，umount时在后端关闭之前调用
+ *
+ */
+void nfs_aio_destroy() {
+    int i;
+
+#ifdef NFS_HAVE_LIBURING
+    if (nfs_uring_active) {
+        nfs_uring_stop();
+        nfs_aio_nworkers = 0;
+    }
+#endif
+    if (nfs_aio_nworkers > 0) {
+        pthread_mutex_lock(&nfs_aio_lock);
+        nfs_aio_stop = TRUE;
+        pthread_cond_broadcast(&nfs_aio_not_empty);
+        pthread_mutex_unlock(&nfs_aio_lock);
+        for (i = 0; i < nfs_aio_nworkers; i++) {
+            pthread_join(nfs_aio_workers[i], NULL);
+        }
+        free(nfs_aio_workers);
+        nfs_aio_workers  = NULL;
+        nfs_aio_nworkers = 0;
+    }
+}
+/**
+ * @brief 获取异步IO统计
+ *
+ * @param stats
+ */
+void nfs_aio_get_stats(struct nfs_aio_stats* stats) {
+    pthread_mutex_lock(&nfs_aio_lock);
+    *stats = nfs_aio_stats;
+    pthread_mutex_unlock(&nfs_aio_lock);
+}
@@ -0,0 +1,517 @@
+#define _GNU_SOURCE                                   /* O_DIRECT */
+#include "../include/nfs.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/******************************************************************************
+* SECTION: Global Static Var
+*******************************************************************************/
+static int                   nfs_image_fd = -1;       /* file/direct/mmap后端的镜像文件 */
+static long                  nfs_image_sz;
+static uint8_t*              nfs_image_map;           /* mmap后端的映射 */
+#ifdef NFS_HAVE_DDRIVER
+static pthread_mutex_t       nfs_ddriver_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static void nfs_image_close() {
+    if (nfs_image_fd >= 0) {
+        close(nfs_image_fd);
+        nfs_image_fd = -1;
+    }
+}
+
+/**
+ * @brief 打开镜像文件，新建或空文件扩展到NFS_DEFAULT_IMAGE_SZ
+ *
+ * @param path
+ * @param flags 额外的open标志
+ * @param sz_disk
+ * @param sz_io
+ * @return int
+ */
+static int nfs_image_open(const char* path, int flags, long* sz_disk, int* sz_io) {
+    struct stat st;
+
+    nfs_image_fd = open(path, O_RDWR | O_CREAT | flags, 0644);
+    if (nfs_image_fd < 0) {
+        NFS_DBG("[%s] open %s: %s\n", __func__, path, strerror(errno));
+        return -NFS_ERROR_IO;
+    }
+    if (fstat(nfs_image_fd, &st) < 0) {
+        nfs_image_close();
+        return -NFS_ERROR_IO;
+    }
+    if (st.st_size == 0) {
+        if (ftruncate(nfs_image_fd, NFS_DEFAULT_IMAGE_SZ) < 0) {
+            nfs_image_close();
+            return -NFS_ERROR_IO;
+        }
+        st.st_size = NFS_DEFAULT_IMAGE_SZ;
+    }
+    nfs_image_sz = NFS_ROUND_DOWN(st.st_size, NFS_BACKEND_IO_SZ);
+    *sz_disk     = nfs_image_sz;
+    *sz_io       = NFS_BACKEND_IO_SZ;
+    return NFS_ERROR_NONE;
+}
+
+static int nfs_image_sync() {
+    return fsync(nfs_image_fd) < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
+}
+/******************************************************************************
+* SECTION: ddriver backend
+*******************************************************************************/
+#ifdef NFS_HAVE_DDRIVER
+static int nfs_ddriver_open(const char* path, long* sz_disk, int* sz_io) {
+    int driver_fd = ddriver_open((char*)path);
+    int disk_sz;
+
+    if (driver_fd < 0) {
+        return driver_fd;
+    }
+    nfs_super.driver_fd = driver_fd;
+    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &disk_sz);
+    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, sz_io);
+    *sz_disk = disk_sz;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 一次seek后按IO单元依次读写各段，省去每段的seek，ddriver每次只能读写一个IO单元
+ *
+ * seek和读写之间不能插入其他线程的IO，整个过程持有nfs_ddriver_lock
+ */
+static int nfs_ddriver_rwv(long offset, const struct iovec* iov, int iovcnt, boolean is_write) {
+    uint8_t* buf;
+    int i, size;
+    int ret = NFS_ERROR_NONE;
+
+    pthread_mutex_lock(&nfs_ddriver_lock);
+    if (ddriver_seek(NFS_DRIVER(), offset, SEEK_SET) < 0) {
+        ret = -NFS_ERROR_SEEK;
+    }
+    for (i = 0; i < iovcnt && ret == NFS_ERROR_NONE; i++) {
+        buf  = (uint8_t*)iov[i].iov_base;
+        size = iov[i].iov_len;
+        while (size != 0)
+        {
+            if ((is_write ? ddriver_write(NFS_DRIVER(), (char*)buf, NFS_IO_SZ())
+                          : ddriver_read(NFS_DRIVER(), (char*)buf, NFS_IO_SZ())) < 0) {
+                ret = -NFS_ERROR_IO;
+                break;
+            }
+            buf  += NFS_IO_SZ();
+            size -= NFS_IO_SZ();
+        }
+    }
+    pthread_mutex_unlock(&nfs_ddriver_lock);
+    return ret;
+}
+
+static int nfs_ddriver_read(long offset, uint8_t* buf, int size) {
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    return nfs_ddriver_rwv(offset, &iov, 1, FALSE);
+}
+
+static int nfs_ddriver_write(long offset, uint8_t* buf, int size) {
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    return nfs_ddriver_rwv(offset, &iov, 1, TRUE);
+}
+
+static int nfs_ddriver_readv(long offset, const struct iovec* iov, int iovcnt) {
+    return nfs_ddriver_rwv(offset, iov, iovcnt, FALSE);
+}
+
+static int nfs_ddriver_writev(long offset, const struct iovec* iov, int iovcnt) {
+    return nfs_ddriver_rwv(offset, iov, iovcnt, TRUE);
+}
+
+static int nfs_ddriver_sync() {
+    return NFS_ERROR_NONE;                            /* ddriver写入即落盘 */
+}
+
+static void nfs_ddriver_close() {
+    ddriver_close(NFS_DRIVER());
+}
+
+static const struct nfs_backend nfs_ddriver_backend = {
+    .name   = "ddriver",
+    .open   = nfs_ddriver_open,
+    .read   = nfs_ddriver_read,
+    .write  = nfs_ddriver_write,
+    .readv  = nfs_ddriver_readv,
+    .writev = nfs_ddriver_writev,
+    .sync   = nfs_ddriver_sync,
+    .close  = nfs_ddriver_close,
+    .serial = TRUE,
+};
+#endif /* NFS_HAVE_DDRIVER */
+/******************************************************************************
+* SECTION: file backend (pread/pwrite)
+*******************************************************************************/
+static int nfs_file_open(const char* path, long* sz_disk, int* sz_io) {
+    return nfs_image_open(path, 0, sz_disk, sz_io);
+}
+/**
+ * @brief 一次pread读完整个范围
+ */
+static int nfs_file_read(long offset, uint8_t* buf, int size) {
+    ssize_t n;
+    while (size > 0) {
+        n = pread(nfs_image_fd, buf, size, offset);
+        if (n <= 0) {
+            return -NFS_ERROR_IO;
+        }
+        buf    += n;
+        offset += n;
+        size   -= n;
+    }
+    return NFS_ERROR_NONE;
+}
+
+static int nfs_file_write(long offset, uint8_t* buf, int size) {
+    ssize_t n;
+    while (size > 0) {
+        n = pwrite(nfs_image_fd, buf, size, offset);
+        if (n <= 0) {
+            return -NFS_ERROR_IO;
+        }
+        buf    += n;
+        offset += n;
+        size   -= n;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief preadv/pwritev一段连续区间，处理部分完成的情况
+ */
+static int nfs_file_rwv(long offset, const struct iovec* iov, int iovcnt, boolean is_write) {
+    struct iovec vec[NFS_IOV_MAX];
+    struct iovec* cur = vec;
+    ssize_t n;
+
+    memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+    while (iovcnt > 0) {
+        n = is_write ? pwritev(nfs_image_fd, cur, iovcnt, offset)
+                     : preadv(nfs_image_fd, cur, iovcnt, offset);
+        if (n <= 0) {
+            return -NFS_ERROR_IO;
+        }
+        offset += n;
+        while (iovcnt > 0 && n >= (ssize_t)cur->iov_len) {
+            n -= cur->iov_len;
+            cur++;
+            iovcnt--;
+        }
+        if (n > 0) {
+            cur->iov_base  = (uint8_t*)cur->iov_base + n;
+            cur->iov_len  -= n;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+static int nfs_file_readv(long offset, const struct iovec* iov, int iovcnt) {
+    return nfs_file_rwv(offset, iov, iovcnt, FALSE);
+}
+
+static int nfs_file_writev(long offset, const struct iovec* iov, int iovcnt) {
+    return nfs_file_rwv(offset, iov, iovcnt, TRUE);
+}
+
+static const struct nfs_backend nfs_file_backend = {
+    .name   = "file",
+    .open   = nfs_file_open,
+    .read   = nfs_file_read,
+    .write  = nfs_file_write,
+    .readv  = nfs_file_readv,
+    .writev = nfs_file_writev,
+    .sync   = nfs_image_sync,
+    .close  = nfs_image_close,
+};
+/******************************************************************************
+* SECTION: direct backend (O_DIRECT)
+*******************************************************************************/
+static int nfs_direct_open(const char* path, long* sz_disk, int* sz_io) {
+    return nfs_image_open(path, O_DIRECT, sz_disk, sz_io);
+}
+/**
+ * @brief 分配size字节、按NFS_DIRECT_ALIGN对齐的缓冲区
+ *
+ * 块缓存中的缓冲区不保证对齐，O_DIRECT要求内存地址、偏移和长度都对齐；
+ * 每次调用单独分配，异步IO的工作线程可以并发使用
+ *
+ * @param size
+ * @return uint8_t*
+ */
+static uint8_t* nfs_direct_bounce(int size) {
+    void* bounce;
+    if (posix_memalign(&bounce, NFS_DIRECT_ALIGN, size) != 0) {
+        return NULL;
+    }
+    return (uint8_t*)bounce;
+}
+
+static int nfs_direct_read(long offset, uint8_t* buf, int size) {
+    uint8_t* bounce;
+    int ret;
+
+    if (((uintptr_t)buf & (NFS_DIRECT_ALIGN - 1)) == 0) {
+        return nfs_file_read(offset, buf, size);
+    }
+    bounce = nfs_direct_bounce(size);
+    if (bounce == NULL) {
+        return -NFS_ERROR_IO;
+    }
+    ret = nfs_file_read(offset, bounce, size);
+    if (ret == NFS_ERROR_NONE) {
+        memcpy(buf, bounce, size);
+    }
+    free(bounce);
+    return ret;
+}
+
+static int nfs_direct_write(long offset, uint8_t* buf, int size) {
+    uint8_t* bounce;
+    int ret;
+
+    if (((uintptr_t)buf & (NFS_DIRECT_ALIGN - 1)) == 0) {
+        return nfs_file_write(offset, buf, size);
+    }
+    bounce = nfs_direct_bounce(size);
+    if (bounce == NULL) {
+        return -NFS_ERROR_IO;
+    }
+    memcpy(bounce, buf, size);
+    ret = nfs_file_write(offset, bounce, size);
+    free(bounce);
+    return ret;
+}
+
+static int nfs_iov_len(const struct iovec* iov, int iovcnt) {
+    int i, size = 0;
+    for (i = 0; i < iovcnt; i++) {
+        size += iov[i].iov_len;
+    }
+    return size;
+}
+/**
+ * @brief 整段读入对齐缓冲区后分散到各段
+ */
+static int nfs_direct_readv(long offset, const struct iovec* iov, int iovcnt) {
+    int size = nfs_iov_len(iov, iovcnt);
+    uint8_t* bounce = nfs_direct_bounce(size);
+    uint8_t* cur = bounce;
+    int i;
+
+    if (bounce == NULL || nfs_file_read(offset, bounce, size) != NFS_ERROR_NONE) {
+        free(bounce);
+        return -NFS_ERROR_IO;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, cur, iov[i].iov_len);
+        cur += iov[i].iov_len;
+    }
+    free(bounce);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 各段聚集到对齐缓冲区后整段写出
+ */
+static int nfs_direct_writev(long offset, const struct iovec* iov, int iovcnt) {
+    int size = nfs_iov_len(iov, iovcnt);
+    uint8_t* bounce = nfs_direct_bounce(size);
+    uint8_t* cur = bounce;
+    int i, ret;
+
+    if (bounce == NULL) {
+        return -NFS_ERROR_IO;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(cur, iov[i].iov_base, iov[i].iov_len);
+        cur += iov[i].iov_len;
+    }
+    ret = nfs_file_write(offset, bounce, size);
+    free(bounce);
+    return ret;
+}
+
+static const struct nfs_backend nfs_direct_backend = {
+    .name   = "direct",
+    .open   = nfs_direct_open,
+    .read   = nfs_direct_read,
+    .write  = nfs_direct_write,
+    .readv  = nfs_direct_readv,
+    .writev = nfs_direct_writev,
+    .sync   = nfs_image_sync,
+    .close  = nfs_image_close,
+};
+/******************************************************************************
+* SECTION: mmap backend
+*******************************************************************************/
+static int nfs_mmap_open(const char* path, long* sz_disk, int* sz_io) {
+    if (nfs_image_open(path, 0, sz_disk, sz_io) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    nfs_image_map = (uint8_t*)mmap(NULL, nfs_image_sz, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, nfs_image_fd, 0);
+    if (nfs_image_map == MAP_FAILED) {
+        nfs_image_map = NULL;
+        nfs_image_close();
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 越过映射末尾的访问会触发SIGBUS，拷贝前检查
+ *
+ * @param offset
+ * @param size
+ * @return boolean
+ */
+static boolean nfs_mmap_in_range(long offset, long size) {
+    return offset >= 0 && size >= 0 && offset + size <= nfs_image_sz;
+}
+
+static int nfs_mmap_read(long offset, uint8_t* buf, int size) {
+    if (!nfs_mmap_in_range(offset, size)) {
+        return -NFS_ERROR_IO;
+    }
+    memcpy(buf, nfs_image_map + offset, size);
+    return NFS_ERROR_NONE;
+}
+
+static int nfs_mmap_write(long offset, uint8_t* buf, int size) {
+    if (!nfs_mmap_in_range(offset, size)) {
+        return -NFS_ERROR_IO;
+    }
+    memcpy(nfs_image_map + offset, buf, size);
+    return NFS_ERROR_NONE;
+}
+
+static int nfs_mmap_readv(long offset, const struct iovec* iov, int iovcnt) {
+    int i;
+    if (!nfs_mmap_in_range(offset, nfs_iov_len(iov, iovcnt))) {
+        return -NFS_ERROR_IO;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, nfs_image_map + offset, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    return NFS_ERROR_NONE;
+}
+
+static int nfs_mmap_writev(long offset, const struct iovec* iov, int iovcnt) {
+    int i;
+    if (!nfs_mmap_in_range(offset, nfs_iov_len(iov, iovcnt))) {
+        return -NFS_ERROR_IO;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(nfs_image_map + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    return NFS_ERROR_NONE;
+}
+
+static int nfs_mmap_sync() {
+    return msync(nfs_image_map, nfs_image_sz, MS_SYNC) < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
+}
+
+static void nfs_mmap_close() {
+    munmap(nfs_image_map, nfs_image_sz);
+    nfs_image_map = NULL;
+    nfs_image_close();
+}
+
+static const struct nfs_backend nfs_mmap_backend = {
+    .name   = "mmap",
+    .open   = nfs_mmap_open,
+    .read   = nfs_mmap_read,
+    .write  = nfs_mmap_write,
+    .readv  = nfs_mmap_readv,
+    .writev = nfs_mmap_writev,
+    .sync   = nfs_mmap_sync,
+    .close  = nfs_mmap_close,
+};
+/******************************************************************************
+* SECTION: backend selection
+*******************************************************************************/
+static const struct nfs_backend* nfs_backends[] = {
+#ifdef NFS_HAVE_DDRIVER
+    &nfs_ddriver_backend,                             /* 无前缀时的默认后端 */
+#endif
+    &nfs_file_backend,
+    &nfs_direct_backend,
+    &nfs_mmap_backend,
+};
+/**
+ * @brief 按--device的前缀选择后端并打开设备
+ *
+ * 格式为[ddriver:|file:|direct:|mmap:]path，无前缀时使用第一个后端
+ *
+ * @param device
+ * @param sz_disk 输出，设备大小
+ * @param sz_io 输出，IO单元大小
+ * @return int
+ */
+int nfs_backend_open(const char* device, long* sz_disk, int* sz_io) {
+    const struct nfs_backend* backend = nfs_backends[0];
+    const char* path = device;
+    const char* sep  = strchr(device, ':');
+    int i, len;
+
+    if (sep != NULL) {
+        len = sep - device;
+        for (i = 0; i < (int)(sizeof(nfs_backends) / sizeof(nfs_backends[0])); i++) {
+            if ((int)strlen(nfs_backends[i]->name) == len &&
+                strncmp(nfs_backends[i]->name, device, len) == 0) {
+                backend = nfs_backends[i];
+                path    = sep + 1;
+                break;
+            }
+        }
+    }
+    NFS_DBG("[%s] %s backend, device %s\n", __func__, backend->name, path);
+    nfs_super.backend = backend;
+    return backend->open(path, sz_disk, sz_io);
+}
+/**
+ * @brief 对一段连续区间做向量读写，后端没有readv/writev时逐段调用read/write
+ *
+ * 不更新统计，可在异步IO的工作线程中调用
+ *
+ * @param op NFS_AIO_READ / NFS_AIO_WRITE
+ * @param offset 区间起始偏移，按IO单元对齐
+ * @param iov 每段长度按IO单元对齐
+ * @param iovcnt 不超过NFS_IOV_MAX
+ * @return int
+ */
+int nfs_backend_rwv(NFS_AIO_OP op, long offset, const struct iovec* iov, int iovcnt) {
+    const struct nfs_backend* backend = nfs_super.backend;
+    int i, ret;
+
+    if (op == NFS_AIO_READ && backend->readv != NULL) {
+        return backend->readv(offset, iov, iovcnt);
+    }
+    if (op == NFS_AIO_WRITE && backend->writev != NULL) {
+        return backend->writev(offset, iov, iovcnt);
+    }
+    for (i = 0; i < iovcnt; i++) {
+        ret = op == NFS_AIO_READ ? backend->read(offset, (uint8_t*)iov[i].iov_base, iov[i].iov_len)
+                                 : backend->write(offset, (uint8_t*)iov[i].iov_base, iov[i].iov_len);
+        if (ret != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        offset += iov[i].iov_len;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief file后端的镜像fd，供io_uring直接提交
+ *
+ * @return int 其他后端返回-1
+ */
+int nfs_backend_fd() {
+    return nfs_super.backend == &nfs_file_backend ? nfs_image_fd : -1;
+}
@@ -0,0 +1,173 @@
+#include "../include/nfs.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+/******************************************************************************
+* SECTION: Macro
+*******************************************************************************/
+#define NFS_BITMAP_WORD_BITS    64
+#define NFS_BITMAP_WORD_FULL    (~(uint64_t)0)
+/**
+ * @brief 读出第word_idx个64位字，位序与按字节访问一致（第i位 = byte[i/8]的第i%8位）
+ *
+ * @param map
+ * @param word_idx
+ * @return uint64_t
+ */
+static inline uint64_t nfs_bitmap_word(const uint8_t* map, int word_idx) {
+    uint64_t word;
+    memcpy(&word, map + (size_t)word_idx * sizeof(uint64_t), sizeof(uint64_t));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+/**
+ * @brief 从word_idx开始跳过全1的字，返回第一个含0位的字下标
+ *
+ * @param map
+ * @param word_idx
+ * @param word_cnt
+ * @return int 没有则返回word_cnt
+ */
+static int nfs_bitmap_skip_full(const uint8_t* map, int word_idx, int word_cnt) {
+#if defined(__AVX2__)
+    __m256i ones = _mm256_set1_epi32(-1);
+    while (word_idx + 4 <= word_cnt) {               /* 一次检查256位 */
+        __m256i v = _mm256_loadu_si256((const __m256i*)(map + (size_t)word_idx * sizeof(uint64_t)));
+        if (!_mm256_testc_si256(v, ones)) {
+            break;
+        }
+        word_idx += 4;
+    }
+#endif
+    while (word_idx < word_cnt && nfs_bitmap_word(map, word_idx) == NFS_BITMAP_WORD_FULL) {
+        word_idx++;
+    }
+    return word_idx;
+}
+/**
+ * @brief 在[start, nbits)中查找第一个0位
+ *
+ * @param map 字节数须为8的倍数
+ * @param nbits 有效位数
+ * @param start
+ * @return int 位下标，找不到返回-1
+ */
+int nfs_bitmap_find_zero(const uint8_t* map, int nbits, int start) {
+    int      word_cnt = NFS_ROUND_UP(nbits, NFS_BITMAP_WORD_BITS) / NFS_BITMAP_WORD_BITS;
+    int      word_idx;
+    int      bit;
+    uint64_t word;
+
+    if (start < 0) {
+        start = 0;
+    }
+    if (start >= nbits) {
+        return -1;
+    }
+    word_idx = start / NFS_BITMAP_WORD_BITS;
+    word     = nfs_bitmap_word(map, word_idx);
+    word    |= ((uint64_t)1 << (start % NFS_BITMAP_WORD_BITS)) - 1;   /* 屏蔽start之前的位 */
+    while (word == NFS_BITMAP_WORD_FULL) {
+        word_idx = nfs_bitmap_skip_full(map, word_idx + 1, word_cnt);
+        if (word_idx >= word_cnt) {
+            return -1;
+        }
+        word = nfs_bitmap_word(map, word_idx);
+    }
+    bit = word_idx * NFS_BITMAP_WORD_BITS + __builtin_ctzll(~word);
+    return bit < nbits ? bit : -1;
+}
+/**
+ * @brief 在[start, nbits)中查找第一个1位
+ *
+ * @param map 字节数须为8的倍数
+ * @param nbits 有效位数
+ * @param start
+ * @return int 位下标，找不到返回nbits
+ */
+int nfs_bitmap_find_one(const uint8_t* map, int nbits, int start) {
+    int      word_cnt = NFS_ROUND_UP(nbits, NFS_BITMAP_WORD_BITS) / NFS_BITMAP_WORD_BITS;
+    int      word_idx;
+    int      bit;
+    uint64_t word;
+
+    if (start >= nbits) {
+        return nbits;
+    }
+    word_idx = start / NFS_BITMAP_WORD_BITS;
+    word     = nfs_bitmap_word(map, word_idx);
+    word    &= ~(((uint64_t)1 << (start % NFS_BITMAP_WORD_BITS)) - 1);  /* 屏蔽start之前的位 */
+    while (word == 0) {
+        if (++word_idx >= word_cnt) {
+            return nbits;
+        }
+        word = nfs_bitmap_word(map, word_idx);
+    }
+    bit = word_idx * NFS_BITMAP_WORD_BITS + __builtin_ctzll(word);
+    return bit < nbits ? bit : nbits;
+}
+/**
+ * @brief 分配一个空闲位，从goal向后查找，找不到则从hint回绕查找
+ *
+ * @param map
+ * @param nbits
+ * @param goal 期望位置
+ * @param hint 该位之前全部已占用，分配最低位后向后推进
+ * @return int 位下标，无空闲返回-1
+ */
+int nfs_bitmap_alloc(uint8_t* map, int nbits, int goal, int* hint) {
+    int     bit = -1;
+    boolean from_hint = FALSE;
+
+    if (goal > *hint && goal < nbits) {
+        bit = nfs_bitmap_find_zero(map, nbits, goal);
+    }
+    if (bit < 0) {                                    /* 回绕，从hint开始找最低空闲位 */
+        bit = nfs_bitmap_find_zero(map, nbits, *hint);
+        from_hint = TRUE;
+    }
+    if (bit < 0) {
+        *hint = nbits;
+        return -1;
+    }
+    NFS_BITMAP_SET(map, bit);
+    if (from_hint) {                                  /* [hint, bit]均已占用 */
+        *hint = bit + 1;
+    }
+    return bit;
+}
+/**
+ * @brief 释放一个位，O(1)
+ *
+ * @param map
+ * @param bit
+ * @param hint
+ */
+void nfs_bitmap_free(uint8_t* map, int bit, int* hint) {
+    NFS_BITMAP_CLEAR(map, bit);
+    if (bit < *hint) {
+        *hint = bit;
+    }
+}
+/**
+ * @brief 统计[0, nbits)中1的个数
+ *
+ * @param map
+ * @param nbits
+ * @return int
+ */
+int nfs_bitmap_count(const uint8_t* map, int nbits) {
+    int      word_cnt = nbits / NFS_BITMAP_WORD_BITS;
+    int      cnt      = 0;
+    int      i;
+
+    for (i = 0; i < word_cnt; i++) {
+        cnt += __builtin_popcountll(nfs_bitmap_word(map, i));
+    }
+    for (i = word_cnt * NFS_BITMAP_WORD_BITS; i < nbits; i++) {
+        cnt += NFS_BITMAP_TEST(map, i);
+    }
+    return cnt;
+}
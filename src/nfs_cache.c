@@ -0,0 +1,741 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/******************************************************************************
+* SECTION: Global Static Var
+*******************************************************************************/
+static struct nfs_cache      nfs_cache;
+static pthread_mutex_t       nfs_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t        nfs_cache_cond  = PTHREAD_COND_INITIALIZER;  /* 有块可以淘汰时通知 */
+/**
+ * @brief 计算IO单元号对应的哈希桶
+ *
+ * @param blkno
+ * @return int
+ */
+static inline int nfs_cache_hash(int blkno) {
+    return (int)(((uint32_t)blkno * 2654435761U) & (uint32_t)(nfs_cache.nbuckets - 1));
+}
+/**
+ * @brief 将缓存块从LRU链表中摘下
+ *
+ * @param blk
+ */
+static void nfs_cache_lru_unlink(struct nfs_cache_blk* blk) {
+    if (blk->lru_prev) {
+        blk->lru_prev->lru_next = blk->lru_next;
+    }
+    else {
+        nfs_cache.lru_head = blk->lru_next;
+    }
+    if (blk->lru_next) {
+        blk->lru_next->lru_prev = blk->lru_prev;
+    }
+    else {
+        nfs_cache.lru_tail = blk->lru_prev;
+    }
+    blk->lru_prev = NULL;
+    blk->lru_next = NULL;
+}
+/**
+ * @brief 将缓存块放到LRU链表头（最近使用）
+ *
+ * @param blk
+ */
+static void nfs_cache_lru_push(struct nfs_cache_blk* blk) {
+    blk->lru_prev = NULL;
+    blk->lru_next = nfs_cache.lru_head;
+    if (nfs_cache.lru_head) {
+        nfs_cache.lru_head->lru_prev = blk;
+    }
+    nfs_cache.lru_head = blk;
+    if (nfs_cache.lru_tail == NULL) {
+        nfs_cache.lru_tail = blk;
+    }
+}
+/**
+ * @brief 从哈希桶中摘下缓存块
+ *
+ * @param blk
+ */
+static void nfs_cache_hash_unlink(struct nfs_cache_blk* blk) {
+    struct nfs_cache_blk** pprev = &nfs_cache.buckets[nfs_cache_hash(blk->blkno)];
+    while (*pprev) {
+        if (*pprev == blk) {
+            *pprev = blk->hnext;
+            break;
+        }
+        pprev = &(*pprev)->hnext;
+    }
+    blk->hnext = NULL;
+}
+/**
+ * @brief 查找IO单元号对应的缓存块
+ *
+ * @param blkno
+ * @return struct nfs_cache_blk* 未命中返回NULL
+ */
+static struct nfs_cache_blk* nfs_cache_find(int blkno) {
+    struct nfs_cache_blk* blk = nfs_cache.buckets[nfs_cache_hash(blkno)];
+    while (blk) {
+        if (blk->blkno == blkno) {
+            return blk;
+        }
+        blk = blk->hnext;
+    }
+    return NULL;
+}
+/**
+ * @brief 将缓存块放回空闲链
+ *
+ * @param blk 已从哈希桶和LRU链表中摘下
+ */
+static void nfs_cache_release(struct nfs_cache_blk* blk) {
+    blk->flags = 0;
+    blk->refs  = 0;
+    blk->hnext = nfs_cache.free_list;
+    nfs_cache.free_list = blk;
+    pthread_cond_signal(&nfs_cache_cond);
+}
+/**
+ * @brief 清除BUSY并唤醒等待该块的线程
+ *
+ * @param blk
+ */
+static void nfs_cache_unbusy(struct nfs_cache_blk* blk) {
+    blk->flags &= ~NFS_FLAG_BUF_BUSY;
+    pthread_cond_broadcast(&blk->wait);
+    pthread_cond_signal(&nfs_cache_cond);
+}
+/**
+ * @brief 写回一个脏块，写设备期间释放缓存锁
+ *
+ * 调用者持有缓存锁且块未被钉住；写出期间块标记为BUSY，访问者在块上等待
+ *
+ * @param blk
+ * @return int
+ */
+static int nfs_cache_writeback(struct nfs_cache_blk* blk) {
+    int ret;
+
+    blk->flags |= NFS_FLAG_BUF_BUSY;
+    nfs_cache_unlock();
+    ret = nfs_dev_write((long)blk->blkno * NFS_IO_SZ(), blk->data, NFS_IO_SZ());
+    nfs_cache_lock();
+    nfs_cache_unbusy(blk);
+    if (ret != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    blk->flags &= ~NFS_FLAG_BUF_DIRTY;
+    nfs_cache.stats.writebacks++;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 将缓存块挂入哈希桶，不放入LRU
+ *
+ * @param blk
+ * @param blkno
+ * @param flags
+ */
+static void nfs_cache_hash_add(struct nfs_cache_blk* blk, int blkno, flag16 flags) {
+    blk->blkno = blkno;
+    blk->flags = NFS_FLAG_BUF_OCCUPY | flags;
+    blk->hnext = nfs_cache.buckets[nfs_cache_hash(blkno)];
+    nfs_cache.buckets[nfs_cache_hash(blkno)] = blk;
+}
+/**
+ * @brief 将读入数据的缓存块挂入哈希桶和LRU头部
+ *
+ * @param blk
+ * @param blkno
+ */
+static void nfs_cache_insert(struct nfs_cache_blk* blk, int blkno) {
+    nfs_cache_hash_add(blk, blkno, 0);
+    nfs_cache_lru_push(blk);
+}
+/**
+ * @brief 收尾一次已完成的预读，成功的块放入LRU，失败的块放回空闲链
+ *
+ * @param ra 请求已完成，nfs_aio_wait不会阻塞
+ */
+static void nfs_cache_ra_finish(struct nfs_cache_ra* ra) {
+    struct nfs_cache_ra** pprev = &nfs_cache.ra_list;
+    struct nfs_cache_blk* blk;
+    int i;
+
+    nfs_aio_wait(&ra->group);
+    nfs_aio_group_destroy(&ra->group);
+    for (i = 0; i < ra->cnt; i++) {
+        blk        = ra->blks[i];
+        blk->ra    = NULL;
+        blk->flags &= ~NFS_FLAG_BUF_PENDING;
+        pthread_cond_broadcast(&blk->wait);
+        if (ra->req.ret == NFS_ERROR_NONE) {
+            nfs_cache_lru_push(blk);
+            pthread_cond_signal(&nfs_cache_cond);
+        }
+        else {
+            nfs_cache_hash_unlink(blk);
+            nfs_cache_release(blk);
+        }
+    }
+    while (*pprev != ra) {
+        pprev = &(*pprev)->next;
+    }
+    *pprev = ra->next;
+    nfs_cache.ra_blks -= ra->cnt;
+    free(ra->blks);
+    free(ra->iov);
+    free(ra);
+}
+/**
+ * @brief 在锁外等待一次预读完成后收尾
+ *
+ * 同一预读只由一个线程等待，其余线程在块上等待PENDING清除
+ *
+ * @param ra
+ */
+static void nfs_cache_ra_wait(struct nfs_cache_ra* ra) {
+    ra->waiting = TRUE;
+    nfs_cache_unlock();
+    nfs_aio_wait(&ra->group);
+    nfs_cache_lock();
+    nfs_cache_ra_finish(ra);
+}
+/**
+ * @brief 找一个还没有线程在等待的预读
+ *
+ * @return struct nfs_cache_ra* 没有时返回NULL
+ */
+static struct nfs_cache_ra* nfs_cache_ra_idle() {
+    struct nfs_cache_ra* ra = nfs_cache.ra_list;
+    while (ra != NULL && ra->waiting) {
+        ra = ra->next;
+    }
+    return ra;
+}
+/**
+ * @brief 收尾已完成的预读；wait为TRUE时等待全部预读完成
+ *
+ * @param wait
+ */
+static void nfs_cache_ra_reap(boolean wait) {
+    struct nfs_cache_ra* ra = nfs_cache.ra_list;
+    struct nfs_cache_ra* next;
+
+    if (wait) {
+        while ((ra = nfs_cache_ra_idle()) != NULL) {
+            nfs_cache_ra_wait(ra);
+        }
+        return;
+    }
+    while (ra != NULL) {
+        next = ra->next;
+        if (!ra->waiting && nfs_aio_poll(&ra->group)) {
+            nfs_cache_ra_finish(ra);
+        }
+        ra = next;
+    }
+}
+/**
+ * @brief 查找缓存块，块正在预读或锁外读入时等待其完成
+ *
+ * @param blkno
+ * @return struct nfs_cache_blk* 未命中返回NULL
+ */
+static struct nfs_cache_blk* nfs_cache_lookup(int blkno) {
+    struct nfs_cache_blk* blk = nfs_cache_find(blkno);
+
+    while (blk != NULL && (blk->flags & (NFS_FLAG_BUF_PENDING | NFS_FLAG_BUF_BUSY))) {
+        if (blk->flags & NFS_FLAG_BUF_PENDING) {
+            nfs_cache.stats.ra_waits++;
+        }
+        if ((blk->flags & NFS_FLAG_BUF_PENDING) && !blk->ra->waiting) {
+            nfs_cache_ra_wait(blk->ra);
+        }
+        else {
+            pthread_cond_wait(&blk->wait, &nfs_cache_mutex);
+        }
+        blk = nfs_cache_find(blkno);                  /* 读入失败或写回后淘汰时已被移除 */
+    }
+    return blk;
+}
+/**
+ * @brief 取得一个空闲缓存块，缓存满时淘汰LRU尾部未被钉住的块
+ *
+ * 写回脏块或等待时会释放缓存锁，返回后调用者须重新查找
+ *
+ * @param wait 没有可淘汰的块时是否等待；一次持有多个BUSY块的调用者不能等待
+ * @return struct nfs_cache_blk*
+ */
+static struct nfs_cache_blk* nfs_cache_grab(boolean wait) {
+    struct nfs_cache_blk* blk;
+    struct nfs_cache_ra*  ra;
+
+    while (TRUE) {
+        if (nfs_cache.free_list) {
+            blk = nfs_cache.free_list;
+            nfs_cache.free_list = blk->hnext;
+            blk->hnext = NULL;
+            return blk;
+        }
+        blk = nfs_cache.lru_tail;                     /* 淘汰最久未使用的块 */
+        while (blk != NULL && (blk->refs > 0 || (blk->flags & NFS_FLAG_BUF_BUSY))) {
+            blk = blk->lru_prev;
+        }
+        if (blk != NULL) {
+            if ((blk->flags & NFS_FLAG_BUF_DIRTY) && 
+                nfs_cache_writeback(blk) != NFS_ERROR_NONE) {
+                return NULL;
+            }
+            nfs_cache_lru_unlink(blk);
+            nfs_cache_hash_unlink(blk);
+            blk->flags = 0;
+            nfs_cache.stats.evicts++;
+            return blk;
+        }
+        if (!wait) {
+            return NULL;
+        }
+        ra = nfs_cache_ra_idle();                     /* 其余块都在预读或被钉住 */
+        if (ra != NULL) {
+            nfs_cache_ra_wait(ra);
+        }
+        else {
+            pthread_cond_wait(&nfs_cache_cond, &nfs_cache_mutex);
+        }
+    }
+}
+/**
+ * @brief 钉住IO单元对应的缓存块，未命中时取得新块
+ *
+ * @param blkno IO单元号
+ * @param fill 未命中时是否从设备读入，读设备期间释放缓存锁
+ * @param is_write 为写而钉住：未命中时计入部分写的预读或省去的预读
+ * @return struct nfs_cache_blk*
+ */
+static struct nfs_cache_blk* nfs_cache_pin(int blkno, boolean fill, boolean is_write) {
+    struct nfs_cache_blk* blk = nfs_cache_lookup(blkno);
+    struct nfs_cache_blk* fresh;
+    int ret;
+
+    while (blk == NULL) {
+        fresh = nfs_cache_grab(TRUE);
+        if (fresh == NULL) {
+            return NULL;
+        }
+        blk = nfs_cache_lookup(blkno);                /* grab可能释放过锁 */
+        if (blk != NULL) {
+            nfs_cache_release(fresh);
+            break;
+        }
+        nfs_cache.stats.misses++;
+        fresh->refs = 1;
+        if (!fill) {
+            if (is_write) {
+                NFS_STAT_ADD(nfs_super.rmw_saved, NFS_IO_SZ()); /* 省去的预读 */
+            }
+            nfs_cache_insert(fresh, blkno);
+            return fresh;
+        }
+        nfs_cache_hash_add(fresh, blkno, NFS_FLAG_BUF_BUSY);
+        nfs_cache_unlock();
+        ret = nfs_dev_read((long)blkno * NFS_IO_SZ(), fresh->data, NFS_IO_SZ());
+        nfs_cache_lock();
+        nfs_cache_unbusy(fresh);
+        if (ret != NFS_ERROR_NONE) {
+            nfs_cache_hash_unlink(fresh);
+            nfs_cache_release(fresh);
+            return NULL;
+        }
+        if (is_write) {
+            NFS_STAT_ADD(nfs_super.rmw_reads, NFS_IO_SZ()); /* 部分写的预读 */
+        }
+        nfs_cache_lru_push(fresh);
+        return fresh;
+    }
+    nfs_cache.stats.hits++;
+    nfs_cache_lru_unlink(blk);
+    nfs_cache_lru_push(blk);
+    blk->refs++;
+    return blk;
+}
+/**
+ * @brief 初始化块缓存
+ *
+ * @param nblks 缓存的IO单元个数，为0时不启用缓存
+ * @return int
+ */
+int nfs_cache_init(int nblks) {
+    int i;
+    uint8_t* pool;
+
+    memset(&nfs_cache, 0, sizeof(struct nfs_cache));
+    if (nblks <= 0) {
+        return NFS_ERROR_NONE;
+    }
+
+    nfs_cache.nbuckets = 1;
+    while (nfs_cache.nbuckets < nblks) {
+        nfs_cache.nbuckets <<= 1;
+    }
+    nfs_cache.buckets = (struct nfs_cache_blk**)calloc(nfs_cache.nbuckets,
+                                                       sizeof(struct nfs_cache_blk*));
+    nfs_cache.blks    = (struct nfs_cache_blk*)calloc(nblks, sizeof(struct nfs_cache_blk));
+    pool              = (uint8_t*)malloc((size_t)nblks * NFS_IO_SZ());
+    if (!nfs_cache.buckets || !nfs_cache.blks || !pool) {
+        free(nfs_cache.buckets);
+        free(nfs_cache.blks);
+        free(pool);
+        memset(&nfs_cache, 0, sizeof(struct nfs_cache));
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < nblks; i++) {
+        pthread_cond_init(&nfs_cache.blks[i].wait, NULL);
+        nfs_cache.blks[i].data  = pool + (size_t)i * NFS_IO_SZ();
+        nfs_cache.blks[i].hnext = nfs_cache.free_list;
+        nfs_cache.free_list     = &nfs_cache.blks[i];
+    }
+    nfs_cache.nblks = nblks;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 块缓存是否启用
+ *
+ * @return boolean
+ */
+boolean nfs_cache_enabled() {
+    return nfs_cache.nblks > 0;
+}
+/**
+ * @brief 加锁块缓存
+ *
+ */
+void nfs_cache_lock() {
+    pthread_mutex_lock(&nfs_cache_mutex);
+}
+
+void nfs_cache_unlock() {
+    pthread_mutex_unlock(&nfs_cache_mutex);
+}
+/**
+ * @brief 获取并钉住IO单元对应的缓存块，未命中时从设备读入，调用者持有缓存锁
+ *
+ * 读设备期间会释放缓存锁。钉住的块在nfs_cache_put之前不会被淘汰或写回，
+ * 调用者可以解锁后访问其内容；一次只钉住一个块
+ *
+ * @param blkno IO单元号
+ * @return struct nfs_cache_blk*
+ */
+struct nfs_cache_blk* nfs_cache_get(int blkno) {
+    return nfs_cache_pin(blkno, TRUE, FALSE);
+}
+/**
+ * @brief 获取并钉住将被部分覆盖的IO单元的缓存块，同nfs_cache_get，未命中时的读入计为预读
+ *
+ * @param blkno IO单元号
+ * @return struct nfs_cache_blk*
+ */
+struct nfs_cache_blk* nfs_cache_modify(int blkno) {
+    return nfs_cache_pin(blkno, TRUE, TRUE);
+}
+/**
+ * @brief 获取并钉住将被整块覆盖的IO单元的缓存块，未命中时不读设备，调用者持有缓存锁
+ *
+ * @param blkno IO单元号
+ * @return struct nfs_cache_blk* 内容未定义，调用者须写满整块
+ */
+struct nfs_cache_blk* nfs_cache_overwrite(int blkno) {
+    return nfs_cache_pin(blkno, FALSE, TRUE);
+}
+/**
+ * @brief 解除nfs_cache_get/nfs_cache_modify/nfs_cache_overwrite的钉住，调用者持有缓存锁
+ *
+ * @param blk
+ */
+void nfs_cache_put(struct nfs_cache_blk* blk) {
+    if (--blk->refs == 0) {
+        pthread_cond_broadcast(&blk->wait);
+        pthread_cond_signal(&nfs_cache_cond);
+    }
+}
+/**
+ * @brief 将[blkno, blkno + cnt)中未缓存的连续IO单元各用一次readv读入缓存
+ *
+ * 多块读取前调用，之后的nfs_cache_get均命中；最多预取缓存容量的一半。调用者持有缓存锁，
+ * 读设备期间释放，读入中的块标记为BUSY
+ *
+ * @param blkno 起始IO单元号
+ * @param cnt IO单元个数
+ * @return int
+ */
+int nfs_cache_prefetch(int blkno, int cnt) {
+    struct nfs_cache_blk* run[NFS_IOV_MAX];
+    struct iovec iov[NFS_IOV_MAX];
+    struct nfs_cache_blk* blk = NULL;
+    int start, n, i, end, ret;
+
+    if (cnt > nfs_cache.nblks / 2) {
+        cnt = nfs_cache.nblks / 2;
+    }
+    end = blkno + cnt;
+    while (blkno < end) {
+        if (nfs_cache_find(blkno) != NULL) {
+            blkno++;
+            continue;
+        }
+        start = blkno;
+        n     = 0;
+        while (blkno < end && n < NFS_IOV_MAX && nfs_cache_find(blkno) == NULL) {
+            blk = nfs_cache_grab(FALSE);
+            if (blk == NULL) {
+                break;
+            }
+            if (nfs_cache_find(blkno) != NULL) {      /* grab释放锁期间已被读入 */
+                nfs_cache_release(blk);
+                break;
+            }
+            nfs_cache_hash_add(blk, blkno, NFS_FLAG_BUF_BUSY);
+            run[n]          = blk;
+            iov[n].iov_base = blk->data;
+            iov[n].iov_len  = NFS_IO_SZ();
+            n++;
+            blkno++;
+        }
+        if (n == 0) {
+            if (blk == NULL) {
+                return -NFS_ERROR_IO;
+            }
+            continue;
+        }
+        nfs_cache_unlock();
+        ret = nfs_dev_readv((long)start * NFS_IO_SZ(), iov, n);
+        nfs_cache_lock();
+        for (i = 0; i < n; i++) {
+            nfs_cache_unbusy(run[i]);
+            if (ret == NFS_ERROR_NONE) {
+                nfs_cache_lru_push(run[i]);
+            }
+            else {
+                nfs_cache_hash_unlink(run[i]);
+                nfs_cache_release(run[i]);
+            }
+        }
+        if (ret != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        nfs_cache.stats.prefetched += n;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 异步预读[blkno, blkno + cnt)中未缓存的IO单元，不等待完成
+ *
+ * 预读中的块已在哈希表中但不在LRU中，不会被淘汰；访问到时由nfs_cache_lookup
+ * 等待完成。在途预读最多占用缓存容量的四分之一
+ *
+ * @param blkno 起始IO单元号
+ * @param cnt IO单元个数
+ * @return int 发起预读的IO单元数
+ */
+int nfs_cache_readahead(int blkno, int cnt) {
+    struct nfs_cache_ra*  ra;
+    struct nfs_cache_blk* blk;
+    int end, i, submitted = 0;
+
+    if (!nfs_cache_enabled()) {
+        return 0;
+    }
+    nfs_cache_lock();
+    nfs_cache_ra_reap(FALSE);
+    if (cnt > nfs_cache.nblks / 4 - nfs_cache.ra_blks) {
+        cnt = nfs_cache.nblks / 4 - nfs_cache.ra_blks;
+    }
+    end = blkno + cnt;
+    while (blkno < end) {
+        if (nfs_cache_find(blkno) != NULL) {
+            blkno++;
+            continue;
+        }
+        ra       = (struct nfs_cache_ra*)calloc(1, sizeof(struct nfs_cache_ra));
+        ra->blks = (struct nfs_cache_blk**)malloc(NFS_IOV_MAX * sizeof(struct nfs_cache_blk*));
+        ra->iov  = (struct iovec*)malloc(NFS_IOV_MAX * sizeof(struct iovec));
+        ra->req.op     = NFS_AIO_READ;
+        ra->req.offset = (long)blkno * NFS_IO_SZ();
+        ra->waiting    = TRUE;                        /* 提交前访问者只能在块上等待 */
+        while (blkno < end && ra->cnt < NFS_IOV_MAX && nfs_cache_find(blkno) == NULL) {
+            blk = nfs_cache_grab(FALSE);
+            if (blk == NULL) {
+                break;
+            }
+            if (nfs_cache_find(blkno) != NULL) {      /* grab释放锁期间已被读入 */
+                nfs_cache_release(blk);
+                break;
+            }
+            nfs_cache_hash_add(blk, blkno, NFS_FLAG_BUF_PENDING);   /* 只挂入哈希表 */
+            blk->ra = ra;
+            ra->blks[ra->cnt]         = blk;
+            ra->iov[ra->cnt].iov_base = blk->data;
+            ra->iov[ra->cnt].iov_len  = NFS_IO_SZ();
+            ra->cnt++;
+            blkno++;
+        }
+        if (ra->cnt == 0) {
+            free(ra->blks);
+            free(ra->iov);
+            free(ra);
+            break;
+        }
+        ra->req.iov    = ra->iov;
+        ra->req.iovcnt = ra->cnt;
+        ra->next          = nfs_cache.ra_list;
+        nfs_cache.ra_list = ra;
+        nfs_cache.ra_blks += ra->cnt;
+        submitted         += ra->cnt;
+        nfs_aio_group_init(&ra->group);
+        nfs_aio_submit(&ra->group, &ra->req);
+        ra->waiting = FALSE;
+        for (i = 0; i < ra->cnt; i++) {
+            pthread_cond_broadcast(&ra->blks[i]->wait);
+        }
+    }
+    nfs_cache.stats.readahead += submitted;
+    nfs_cache_unlock();
+    return submitted;
+}
+/**
+ * @brief 标记缓存块为脏，等待淘汰或flush时写回，调用者持有缓存锁且钉住该块
+ *
+ * @param blk
+ */
+void nfs_cache_mark_dirty(struct nfs_cache_blk* blk) {
+    blk->flags |= NFS_FLAG_BUF_DIRTY;
+}
+static int nfs_cache_cmp_blkno(const void* a, const void* b) {
+    const struct nfs_cache_blk* blk_a = *(const struct nfs_cache_blk**)a;
+    const struct nfs_cache_blk* blk_b = *(const struct nfs_cache_blk**)b;
+    return blk_a->blkno - blk_b->blkno;
+}
+/**
+ * @brief 按IO单元号升序写回所有脏块，块号连续的脏块合并为一次writev
+ *
+ * 脏块被钉住或正在写回时先等待；收集到的块标记为BUSY，之后不能再被钉住，
+ * 各段异步提交，写设备期间释放缓存锁，全部完成后再清除脏标记
+ *
+ * @return int
+ */
+int nfs_cache_flush() {
+    struct nfs_cache_blk* blk;
+    struct nfs_aio_group  group;
+    struct nfs_aio_req*   reqs;
+    struct iovec*         iov;
+    int i, j, n, nreqs = 0;
+    int ret = NFS_ERROR_NONE;
+    struct nfs_cache_blk** dirty;
+    int dirty_cnt = 0;
+
+    if (!nfs_cache_enabled()) {
+        return NFS_ERROR_NONE;
+    }
+    nfs_cache_lock();
+    dirty = (struct nfs_cache_blk**)malloc(nfs_cache.nblks * sizeof(struct nfs_cache_blk*));
+    for (i = 0; i < nfs_cache.nblks; i++) {
+        blk = &nfs_cache.blks[i];
+        while ((blk->flags & NFS_FLAG_BUF_DIRTY) &&
+               (blk->refs > 0 || (blk->flags & NFS_FLAG_BUF_BUSY))) {
+            pthread_cond_wait(&blk->wait, &nfs_cache_mutex);
+        }
+        if (blk->flags & NFS_FLAG_BUF_DIRTY) {
+            blk->flags |= NFS_FLAG_BUF_BUSY;
+            dirty[dirty_cnt++] = blk;
+        }
+    }
+    if (dirty_cnt == 0) {
+        free(dirty);
+        nfs_cache_unlock();
+        return NFS_ERROR_NONE;
+    }
+                                                      /* 按块号顺序写回，减少磁头来回移动 */
+    qsort(dirty, dirty_cnt, sizeof(struct nfs_cache_blk*), nfs_cache_cmp_blkno);
+    reqs = (struct nfs_aio_req*)calloc(dirty_cnt, sizeof(struct nfs_aio_req));
+    iov  = (struct iovec*)malloc(dirty_cnt * sizeof(struct iovec));
+    nfs_aio_group_init(&group);
+    for (i = 0; i < dirty_cnt; i += n) {
+        n = 0;
+        do {
+            iov[i + n].iov_base = dirty[i + n]->data;
+            iov[i + n].iov_len  = NFS_IO_SZ();
+            n++;
+        } while (i + n < dirty_cnt && n < NFS_IOV_MAX &&
+                 dirty[i + n]->blkno == dirty[i]->blkno + n);
+        reqs[nreqs].op     = NFS_AIO_WRITE;
+        reqs[nreqs].offset = (long)dirty[i]->blkno * NFS_IO_SZ();
+        reqs[nreqs].iov    = &iov[i];
+        reqs[nreqs].iovcnt = n;
+        nreqs++;
+    }
+    nfs_cache_unlock();
+    for (j = 0; j < nreqs; j++) {
+        nfs_aio_submit(&group, &reqs[j]);
+    }
+    nfs_aio_wait(&group);
+    nfs_aio_group_destroy(&group);
+    nfs_cache_lock();
+
+    for (i = 0; i < dirty_cnt; i++) {
+        nfs_cache_unbusy(dirty[i]);
+    }
+    for (i = 0, j = 0; j < nreqs; j++) {
+        if (reqs[j].ret != NFS_ERROR_NONE) {          /* 写失败的块保持脏 */
+            ret = -NFS_ERROR_IO;
+            i  += reqs[j].iovcnt;
+            continue;
+        }
+        for (n = 0; n < reqs[j].iovcnt; n++, i++) {
+            dirty[i]->flags &= ~NFS_FLAG_BUF_DIRTY;
+        }
+        nfs_cache.stats.writebacks += reqs[j].iovcnt;
+    }
+    free(reqs);
+    free(iov);
+    free(dirty);
+    nfs_cache_unlock();
+    return ret;
+}
+/**
+ * @brief 写回并释放块缓存
+ *
+ * @return int
+ */
+int nfs_cache_destroy() {
+    struct nfs_cache_stats stats;
+    int ret, i;
+
+    nfs_cache_lock();
+    nfs_cache_ra_reap(TRUE);
+    nfs_cache_unlock();
+    ret = nfs_cache_flush();
+    if (nfs_cache_enabled()) {
+        for (i = 0; i < nfs_cache.nblks; i++) {
+            pthread_cond_destroy(&nfs_cache.blks[i].wait);
+        }
+        free(nfs_cache.blks[0].data);
+        free(nfs_cache.blks);
+        free(nfs_cache.buckets);
+    }
+    stats = nfs_cache.stats;                          /* 留给umount时的统计输出，见nfs_umount */
+    memset(&nfs_cache, 0, sizeof(struct nfs_cache));
+    nfs_cache.stats = stats;
+    return ret;
+}
+/**
+ * @brief 获取缓存统计信息
+ *
+ * @param stats
+ */
+void nfs_cache_get_stats(struct nfs_cache_stats* stats) {
+    nfs_cache_lock();
+    *stats = nfs_cache.stats;
+    nfs_cache_unlock();
+}
@@ -0,0 +1,255 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/**
+ * @brief 将inode插到数据LRU头部，数据LRU和计数都由data_lock保护
+ *
+ * @param inode
+ */
+static void nfs_data_lru_push(struct nfs_inode* inode) {
+    inode->data_prev = NULL;
+    inode->data_next = nfs_super.data_lru_head;
+    if (nfs_super.data_lru_head) {
+        nfs_super.data_lru_head->data_prev = inode;
+    }
+    nfs_super.data_lru_head = inode;
+    if (nfs_super.data_lru_tail == NULL) {
+        nfs_super.data_lru_tail = inode;
+    }
+}
+/**
+ * @brief 将inode从数据LRU中摘除
+ *
+ * @param inode
+ */
+static void nfs_data_lru_unlink(struct nfs_inode* inode) {
+    if (inode->data_prev) {
+        inode->data_prev->data_next = inode->data_next;
+    }
+    else {
+        nfs_super.data_lru_head = inode->data_next;
+    }
+    if (inode->data_next) {
+        inode->data_next->data_prev = inode->data_prev;
+    }
+    else {
+        nfs_super.data_lru_tail = inode->data_prev;
+    }
+    inode->data_prev = NULL;
+    inode->data_next = NULL;
+}
+/**
+ * @brief 释放数据缓冲区，调用者持有data_lock
+ *
+ * @param inode
+ */
+static void nfs_data_detach(struct nfs_inode* inode) {
+    if (inode->data == NULL) {
+        return;
+    }
+    nfs_data_lru_unlink(inode);
+    nfs_super.data_bytes -= inode->data_cap;
+    free(inode->data);
+    inode->data     = NULL;
+    inode->data_cap = 0;
+}
+/**
+ * @brief 超出data_budget时，从LRU尾部开始丢弃干净的文件数据
+ *
+ * 数据未写回的inode不丢弃；keep为当前正在使用的inode，调用者持有它的写锁和data_lock。
+ * 其他inode的锁在data_lock之外，只尝试加锁，正被访问的跳过
+ *
+ * @param keep
+ */
+static void nfs_data_evict(struct nfs_inode* keep) {
+    struct nfs_inode* inode = nfs_super.data_lru_tail;
+    struct nfs_inode* prev;
+    long budget = (long)nfs_options.data_budget * 1024;
+
+    if (budget <= 0) {
+        return;
+    }
+    while (inode != NULL && nfs_super.data_bytes > budget) {
+        prev = inode->data_prev;
+        if (inode != keep && pthread_rwlock_trywrlock(&inode->lock) == 0) {
+            if (!(inode->flags & NFS_INODE_DIRTY_DATA)) {
+                nfs_data_detach(inode);
+                nfs_super.data_evicts++;
+            }
+            NFS_INODE_UNLOCK(inode);
+        }
+        inode = prev;
+    }
+}
+/**
+ * @brief 为inode挂上大小为cap的数据缓冲区并计入data_budget
+ *
+ * @param inode
+ * @param data
+ * @param cap
+ */
+void nfs_data_attach(struct nfs_inode* inode, uint8_t* data, int cap) {
+    pthread_mutex_lock(&nfs_super.data_lock);
+    inode->data     = data;
+    inode->data_cap = cap;
+    nfs_super.data_bytes += cap;
+    nfs_data_lru_push(inode);
+    nfs_data_evict(inode);
+    pthread_mutex_unlock(&nfs_super.data_lock);
+}
+/**
+ * @brief 数据缓冲区扩容后调整计数
+ *
+ * @param inode
+ * @param cap 新的字节数
+ */
+void nfs_data_resize(struct nfs_inode* inode, int cap) {
+    pthread_mutex_lock(&nfs_super.data_lock);
+    nfs_super.data_bytes += cap - inode->data_cap;
+    inode->data_cap       = cap;
+    nfs_data_evict(inode);
+    pthread_mutex_unlock(&nfs_super.data_lock);
+}
+/**
+ * @brief 确保普通文件的数据已读入内存，首次read/write时调用
+ *
+ * @param inode 数据已读入时调用者持有其读锁即可，否则须持有写锁
+ * @return int
+ */
+int nfs_data_load(struct nfs_inode* inode) {
+    uint8_t* data;
+    int      cap;
+
+    if (inode->data != NULL) {                        /* 已读入，移到LRU头部 */
+        pthread_mutex_lock(&nfs_super.data_lock);
+        if (nfs_super.data_lru_head != inode) {
+            nfs_data_lru_unlink(inode);
+            nfs_data_lru_push(inode);
+        }
+        pthread_mutex_unlock(&nfs_super.data_lock);
+        return NFS_ERROR_NONE;
+    }
+    if (NFS_IS_INLINE(inode)) {                       /* 内联的内容在inode记录中 */
+        cap  = NFS_INODE_INLINE_SZ + 1;
+        data = (uint8_t *)calloc(1, cap);
+        if (nfs_read_inline(inode, data) != NFS_ERROR_NONE) {
+            free(data);
+            return -NFS_ERROR_IO;
+        }
+        memset(data + inode->size, 0, cap - inode->size);
+    }
+    else {
+        cap  = NFS_BLKS_SZ(inode->blk_cnt) + 1;
+        data = (uint8_t *)calloc(1, cap);
+        if (nfs_extent_read(inode, data, NFS_BLKS_SZ(inode->blk_cnt)) != NFS_ERROR_NONE) {
+            free(data);
+            return -NFS_ERROR_IO;
+        }
+    }
+    NFS_STAT_ADD(nfs_super.data_loads, 1);
+    nfs_data_attach(inode, data, cap);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放inode的数据缓冲区，下次访问时重新读入
+ *
+ * @param inode
+ */
+void nfs_data_release(struct nfs_inode* inode) {
+    pthread_mutex_lock(&nfs_super.data_lock);
+    nfs_data_detach(inode);
+    pthread_mutex_unlock(&nfs_super.data_lock);
+}
+/**
+ * @brief 扩大预读窗口：从NFS_RA_MIN_BLKS开始，每发起一次预读翻倍，直到NFS_RA_MAX_BLKS
+ *
+ * @param file
+ */
+static void nfs_data_ra_grow(struct nfs_file* file) {
+    file->ra_window = file->ra_window == 0 ? NFS_RA_MIN_BLKS :
+                      file->ra_window * 2 > NFS_RA_MAX_BLKS ? NFS_RA_MAX_BLKS :
+                      file->ra_window * 2;
+}
+/**
+ * @brief 跨步读的预读：只预读之后几次read将要读的块，跳过的块不读
+ *
+ * @param file 调用者持有ra_lock
+ * @param offset 本次read的起点
+ * @param size
+ */
+static void nfs_data_readahead_stride(struct nfs_file* file, off_t offset, size_t size) {
+    struct nfs_inode* inode = file->inode;
+    off_t pitch = file->ra_stride + size;             /* 相邻两次read起点的距离 */
+    int   per   = (size + NFS_BLKS_SZ(1) - 1) / NFS_BLKS_SZ(1);
+    off_t pos   = offset + pitch * (file->ra_window / per / 2 + 1);
+    int   blks  = 0;
+    int   start, end;
+
+    if ((pos + size - 1) / NFS_BLKS_SZ(1) < file->ra_end) {
+        return;                                       /* 已预读到窗口后半段的read */
+    }
+    nfs_data_ra_grow(file);
+    for (pos = offset + pitch; blks < file->ra_window && pos < inode->size; pos += pitch) {
+        start = pos / NFS_BLKS_SZ(1);
+        end   = (pos + size - 1) / NFS_BLKS_SZ(1) + 1;
+        start = start > file->ra_end ? start : file->ra_end;
+        end   = end < inode->blk_cnt ? end : inode->blk_cnt;
+        if (start < end) {
+            nfs_extent_readahead(inode, start, end - start);
+            blks        += end - start;
+            file->ra_end = end;
+        }
+    }
+}
+/**
+ * @brief 顺序读和跨步读检测与预读，未读入数据的文件经块缓存读取前调用
+ *
+ * 本次read从上次read的结束处开始即为顺序读：预读窗口见nfs_data_ra_grow，读到窗口
+ * 后半段时发起下一窗口，使IO与应用处理重叠。连续两次read前向跳过相同的字节数即为跨步读：
+ * 跳过不足一块时按顺序读预读，否则见nfs_data_readahead_stride。其余视为随机访问，关闭预读。
+ * 同一句柄上的并发read由ra_lock串行
+ *
+ * @param file 打开的文件，调用者持有其inode的读锁
+ * @param offset
+ * @param size 已按文件大小截断，不为0
+ */
+void nfs_data_readahead(struct nfs_file* file, off_t offset, size_t size) {
+    struct nfs_inode* inode = file->inode;
+    int last = (offset + size - 1) / NFS_BLKS_SZ(1);  /* 本次读到的最后一个逻辑块 */
+    off_t gap;
+    int start, end;
+
+    pthread_mutex_lock(&file->ra_lock);
+    gap = offset - file->ra_prev;
+    if (gap != 0 && (gap < 0 || gap != file->ra_stride)) {
+        file->ra_prev   = offset + size;              /* 随机访问，回退；记下跳过的字节数以发现跨步 */
+        file->ra_stride = gap;
+        file->ra_window = 0;
+        file->ra_end    = 0;
+        pthread_mutex_unlock(&file->ra_lock);
+        return;
+    }
+    file->ra_prev   = offset + size;
+    file->ra_stride = gap;
+    if (gap >= NFS_BLKS_SZ(1)) {
+        nfs_data_readahead_stride(file, offset, size);
+        pthread_mutex_unlock(&file->ra_lock);
+        return;
+    }
+    if (file->ra_end - (last + 1) > file->ra_window / 2) {
+        pthread_mutex_unlock(&file->ra_lock);
+        return;                                       /* 已预读的部分还够用 */
+    }
+    nfs_data_ra_grow(file);
+    start = file->ra_end > last + 1 ? file->ra_end : last + 1;
+    end   = last + 1 + file->ra_window;
+    if (end > inode->blk_cnt) {
+        end = inode->blk_cnt;
+    }
+    if (start < end) {
+        nfs_extent_readahead(inode, start, end - start);
+    }
+    file->ra_end = end;
+    pthread_mutex_unlock(&file->ra_lock);
+}
@@ -7,7 +7,7 @@ void nfs_dump_map() {
     int byte_cursor = 0;
     int bit_cursor = 0;
 
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_inode_blks); 
+    for (byte_cursor = 0; byte_cursor < nfs_super.group_cnt * nfs_super.inodes_per_group / UINT8_BITS; 
          byte_cursor+=4)
     {
         for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
@@ -35,7 +35,7 @@ void nfs_dump_data_map() {
     int byte_cursor = 0;
     int bit_cursor = 0;
 
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_data_blks); 
+    for (byte_cursor = 0; byte_cursor < nfs_super.group_cnt * nfs_super.data_per_group / UINT8_BITS; 
          byte_cursor+=4)
     {
         for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
@@ -0,0 +1,585 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/**
+ * @brief 文件名哈希（FNV-1a），同时决定磁盘上的桶号，不可随意修改
+ *
+ * @param fname
+ * @return uint32_t
+ */
+uint32_t nfs_name_hash(const char* fname) {
+    uint32_t hash = 2166136261U;
+    while (*fname) {
+        hash ^= (uint8_t)*fname++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+/**
+ * @brief 将dentry加入目录的内存哈希表
+ *
+ * 哈希表可能正被nfs_dir_find_rcu无锁读取，指针以原子方式发布
+ *
+ * @param inode 目录inode
+ * @param dentry
+ */
+static void nfs_dir_index_insert(struct nfs_inode* inode, struct nfs_dentry* dentry) {
+    int bucket = dentry->hash & (inode->dhash_size - 1);
+    NFS_RCU_ASSIGN(dentry->hnext, inode->dhash[bucket]);
+    NFS_RCU_ASSIGN(inode->dhash[bucket], dentry);
+}
+/**
+ * @brief 按当前目录项数(重新)建立内存哈希表，调用者已进入dir_seq的写区间
+ *
+ * 旧表可能仍有无锁读者，延迟释放
+ *
+ * @param inode 目录inode
+ */
+static void nfs_dir_index_build(struct nfs_inode* inode) {
+    struct nfs_dentry* dentry_cursor;
+    int cnt  = 0;
+    int size = NFS_DIR_HASH_MIN;
+
+    for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother) {
+        cnt++;
+    }
+    while (size < cnt) {
+        size <<= 1;
+    }
+    nfs_rcu_free(inode->dhash);
+    NFS_RCU_ASSIGN(inode->dhash, (struct nfs_dentry**)calloc(size, sizeof(struct nfs_dentry*)));
+    NFS_RCU_ASSIGN(inode->dhash_size, size);
+    inode->dhash_cnt  = cnt;
+    for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother) {
+        nfs_dir_index_insert(inode, dentry_cursor);
+    }
+}
+/**
+ * @brief 在内存中查找目录项
+ *
+ * 沿哈希链只比较dentry前部的hash和name_len，都相同时才读文件名区
+ *
+ * @param inode 目录inode
+ * @param fname
+ * @return struct nfs_dentry*
+ */
+static struct nfs_dentry* nfs_dir_find(struct nfs_inode* inode, const char* fname) {
+    struct nfs_dentry* dentry_cursor;
+    uint32_t hash = nfs_name_hash(fname);
+    int len = strlen(fname);
+
+    if (inode->dhash == NULL) {                       /* 首次查找时建立哈希表 */
+        nfs_seq_write_begin(&inode->dir_seq);
+        nfs_dir_index_build(inode);
+        nfs_seq_write_end(&inode->dir_seq);
+    }
+    dentry_cursor = inode->dhash[hash & (inode->dhash_size - 1)];
+    while (dentry_cursor) {
+        if (dentry_cursor->hash == hash && dentry_cursor->name_len == len &&
+            memcmp(dentry_cursor->fname, fname, len) == 0) {
+            return dentry_cursor;
+        }
+        dentry_cursor = dentry_cursor->hnext;
+    }
+    return NULL;
+}
+/**
+ * @brief 为目录的文件名区追加一块，块大小从NFS_NAME_CHUNK_MIN逐块翻倍到NFS_NAME_CHUNK_MAX
+ *
+ * @param inode 目录inode
+ * @param need 至少需要的字节数
+ * @return struct nfs_name_chunk*
+ */
+static struct nfs_name_chunk* nfs_dir_name_grow(struct nfs_inode* inode, int need) {
+    struct nfs_name_chunk* chunk;
+    int cap = inode->names ? inode->names->cap * 2 : NFS_NAME_CHUNK_MIN;
+
+    if (cap > NFS_NAME_CHUNK_MAX) {
+        cap = NFS_NAME_CHUNK_MAX;
+    }
+    if (cap < need) {
+        cap = need;
+    }
+    chunk = (struct nfs_name_chunk*)malloc(sizeof(struct nfs_name_chunk) + cap);
+    chunk->used  = 0;
+    chunk->cap   = cap;
+    chunk->next  = inode->names;
+    inode->names = chunk;
+    return chunk;
+}
+/**
+ * @brief 将仍在目录中的文件名拷到一块新的文件名区，丢弃已删除和移走的文件名
+ *
+ * 拷贝后的文件名内容不变，无锁读者读到新旧哪个指针都可以；旧块延迟释放
+ *
+ * @param inode 目录inode，调用者持有其写锁
+ * @param extra 新块在现有文件名之外预留的字节数
+ */
+static void nfs_dir_name_compact(struct nfs_inode* inode, int extra) {
+    struct nfs_name_chunk* chunk_cursor = inode->names;
+    struct nfs_name_chunk* chunk_next;
+    struct nfs_name_chunk* chunk;
+    struct nfs_dentry*     dentry_cursor;
+    char* name;
+
+    inode->names = NULL;
+    chunk = nfs_dir_name_grow(inode, inode->names_live + extra);
+    for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother) {
+        name = (char*)(chunk + 1) + chunk->used;
+        memcpy(name, dentry_cursor->fname, dentry_cursor->name_len + 1);
+        chunk->used += dentry_cursor->name_len + 1;
+        NFS_RCU_ASSIGN(dentry_cursor->fname, (const char*)name);
+    }
+    inode->names_used = chunk->used;
+    while (chunk_cursor) {
+        chunk_next = chunk_cursor->next;
+        nfs_rcu_free(chunk_cursor);
+        chunk_cursor = chunk_next;
+    }
+}
+/**
+ * @brief 将文件名存入目录的文件名区
+ *
+ * 只追加，写入后不再修改；当前块写满时，若已失效的文件名超过一半则先压缩
+ *
+ * @param inode 目录inode，调用者持有其写锁
+ * @param fname
+ * @return const char* 目录释放前一直有效
+ */
+const char* nfs_dir_name_alloc(struct nfs_inode* inode, const char* fname) {
+    struct nfs_name_chunk* chunk = inode->names;
+    int len  = strlen(fname) + 1;
+    int dead = inode->names_used - inode->names_live;
+    char* name;
+
+    if (chunk == NULL || chunk->used + len > chunk->cap) {
+        if (dead > NFS_NAME_CHUNK_MIN && dead * 2 > inode->names_used) {
+            nfs_dir_name_compact(inode, len);
+        }
+        chunk = inode->names;
+        if (chunk == NULL || chunk->used + len > chunk->cap) {
+            chunk = nfs_dir_name_grow(inode, len);
+        }
+    }
+    name = (char*)(chunk + 1) + chunk->used;
+    memcpy(name, fname, len);
+    chunk->used       += len;
+    inode->names_used += len;
+    return name;
+}
+/**
+ * @brief 释放目录的文件名区
+ *
+ * @param inode 目录inode
+ * @param is_deferred 无锁查找可能仍在读时为TRUE，延迟释放
+ */
+void nfs_dir_name_release(struct nfs_inode* inode, boolean is_deferred) {
+    struct nfs_name_chunk* chunk;
+
+    while (inode->names) {
+        chunk        = inode->names;
+        inode->names = chunk->next;
+        if (is_deferred) {
+            nfs_rcu_free(chunk);
+        }
+        else {
+            free(chunk);
+        }
+    }
+    inode->names_used = 0;
+    inode->names_live = 0;
+    inode->dir_bytes  = 0;
+}
+/**
+ * @brief 将dentry挂到目录下，不改变dir_cnt
+ *
+ * @param inode 目录inode
+ * @param dentry
+ */
+void nfs_dir_attach(struct nfs_inode* inode, struct nfs_dentry* dentry) {
+    nfs_seq_write_begin(&inode->dir_seq);
+    NFS_RCU_ASSIGN(dentry->hash, nfs_name_hash(dentry->fname));
+    inode->names_live += dentry->name_len + 1;
+    inode->dir_bytes  += NFS_DENTRY_D_SZ(dentry->name_len);
+    dentry->brother = inode->dentrys;
+    dentry->pprev   = &inode->dentrys;
+    if (inode->dentrys != NULL) {
+        inode->dentrys->pprev = &dentry->brother;
+    }
+    inode->dentrys  = dentry;
+    if (inode->dhash != NULL) {
+        if (++inode->dhash_cnt > inode->dhash_size) { /* 负载因子超过1，扩容 */
+            nfs_dir_index_build(inode);
+        }
+        else {
+            nfs_dir_index_insert(inode, dentry);
+        }
+    }
+    nfs_seq_write_end(&inode->dir_seq);
+}
+/**
+ * @brief 将dentry从目录的内存哈希表中移除
+ *
+ * @param inode 目录inode
+ * @param dentry
+ */
+void nfs_dir_detach(struct nfs_inode* inode, struct nfs_dentry* dentry) {
+    struct nfs_dentry** pprev;
+
+    inode->names_live -= dentry->name_len + 1;        /* 文件名留在文件名区，压缩时丢弃 */
+    inode->dir_bytes  -= NFS_DENTRY_D_SZ(dentry->name_len);
+    if (inode->dhash == NULL) {
+        return;
+    }
+    nfs_seq_write_begin(&inode->dir_seq);
+    pprev = &inode->dhash[dentry->hash & (inode->dhash_size - 1)];
+    while (*pprev) {
+        if (*pprev == dentry) {
+            NFS_RCU_ASSIGN(*pprev, dentry->hnext);
+            inode->dhash_cnt--;
+            break;
+        }
+        pprev = &(*pprev)->hnext;
+    }
+    NFS_RCU_ASSIGN(dentry->hnext, NULL);
+    nfs_seq_write_end(&inode->dir_seq);
+}
+/**
+ * @brief 修改已摘下的dentry的文件名，rename时使用
+ *
+ * 新文件名存入目的目录的文件名区后整体发布，无锁读者读到的新旧文件名都完整；
+ * 读者由rename_seq发现变化
+ *
+ * @param inode 目的目录inode，调用者持有其写锁
+ * @param dentry
+ * @param fname
+ */
+void nfs_dentry_rename(struct nfs_inode* inode, struct nfs_dentry* dentry, const char* fname) {
+    NFS_RCU_ASSIGN(dentry->name_len, (uint16_t)strlen(fname));
+    NFS_RCU_ASSIGN(dentry->fname, nfs_dir_name_alloc(inode, fname));
+}
+/**
+ * @brief 计算桶块的校验和，覆盖块头（除校验和本身）和已用的记录
+ *
+ * @param bucket_d used已确认不越界
+ * @return uint32_t
+ */
+static uint32_t nfs_dir_bucket_csum(struct nfs_dir_bucket_d* bucket_d) {
+    return nfs_crc32((uint8_t*)bucket_d + sizeof(uint32_t),
+                     sizeof(struct nfs_dir_bucket_d) - sizeof(uint32_t) + bucket_d->used);
+}
+/**
+ * @brief 校验读入的桶块
+ *
+ * @param bucket_d
+ * @return int 损坏返回-NFS_ERROR_IO
+ */
+static int nfs_dir_check_bucket(struct nfs_dir_bucket_d* bucket_d) {
+    if ((int)bucket_d->used > NFS_DIR_BUCKET_CAP() ||
+        bucket_d->csum != nfs_dir_bucket_csum(bucket_d)) {
+        NFS_DBG("[%s] directory block checksum mismatch\n", __func__);
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 读入目录的第bucket个桶块并校验
+ *
+ * @param inode
+ * @param bucket
+ * @param buf NFS_BLKS_SZ(1)字节
+ * @return int
+ */
+static int nfs_dir_read_bucket(struct nfs_inode* inode, int bucket, uint8_t* buf) {
+    int dat = nfs_extent_bmap(inode, bucket);
+    if (dat < 0 || nfs_driver_read(NFS_DATA_OFS(dat), buf, NFS_BLKS_SZ(1)) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    return nfs_dir_check_bucket((struct nfs_dir_bucket_d*)buf);
+}
+/**
+ * @brief 由磁盘目录项生成内存dentry
+ *
+ * @param inode 父目录inode
+ * @param dentry_d
+ * @return struct nfs_dentry*
+ */
+static struct nfs_dentry* nfs_dir_new_dentry(struct nfs_inode* inode,
+                                             struct nfs_dentry_d* dentry_d) {
+    struct nfs_dentry* sub_dentry = new_dentry(inode, NFS_DENTRY_D_NAME(dentry_d),
+                                               (NFS_FILE_TYPE)dentry_d->ftype);
+    sub_dentry->parent = inode->dentry;
+    sub_dentry->ino    = dentry_d->ino;
+    sub_dentry->dat    = dentry_d->dat;
+    return sub_dentry;
+}
+/**
+ * @brief 只读入fname所在的桶块查找目录项，找到则挂到目录下
+ *
+ * @param inode 尚未完整读入的目录inode
+ * @param fname
+ * @param dentry 返回找到的目录项，未找到为NULL
+ * @return int 桶块读不出或校验失败时返回-NFS_ERROR_IO
+ */
+static int nfs_dir_probe(struct nfs_inode* inode, const char* fname, struct nfs_dentry** dentry) {
+    uint8_t* buf    = (uint8_t*)malloc(NFS_BLKS_SZ(1));
+    struct nfs_dir_bucket_d* bucket_d = (struct nfs_dir_bucket_d*)buf;
+    struct nfs_dentry_d*     dentry_d;
+    int bucket = nfs_name_hash(fname) & (inode->dir_buckets - 1);
+    int len    = strlen(fname);
+    int ret    = NFS_ERROR_NONE;
+    int probes, i;
+
+    *dentry = NULL;
+    for (probes = 0; probes < inode->dir_buckets && *dentry == NULL; probes++) {
+        if (nfs_dir_read_bucket(inode, bucket, buf) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;                      /* 不能当作不存在 */
+            break;
+        }
+        dentry_d = (struct nfs_dentry_d*)(bucket_d + 1);
+        for (i = 0; i < (int)bucket_d->cnt; i++) {
+            if (dentry_d->name_len == len && memcmp(NFS_DENTRY_D_NAME(dentry_d), fname, len) == 0) {
+                *dentry = nfs_dir_new_dentry(inode, dentry_d);
+                nfs_dir_attach(inode, *dentry);
+                break;
+            }
+            dentry_d = NFS_DENTRY_D_NEXT(dentry_d);
+        }
+        if (!(bucket_d->flags & NFS_DIR_BUCKET_SPILL)) {
+            break;                                    /* 没有目录项溢出到后续桶 */
+        }
+        bucket = (bucket + 1) & (inode->dir_buckets - 1);
+    }
+    free(buf);
+    return ret;
+}
+/**
+ * @brief 在目录中查找名为fname的目录项
+ *
+ * 先查内存哈希表；目录未完整读入时再读磁盘上对应的桶块
+ *
+ * @param inode 目录inode
+ * @param fname
+ * @param dentry 返回找到的目录项，未找到为NULL
+ * @return int 读磁盘目录项失败时返回-NFS_ERROR_IO
+ */
+int nfs_dir_lookup(struct nfs_inode* inode, const char* fname, struct nfs_dentry** dentry) {
+    *dentry = nfs_dir_find(inode, fname);
+    if (*dentry == NULL && !inode->is_loaded) {
+        return nfs_dir_probe(inode, fname, dentry);
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 只查内存哈希表，不修改目录，调用者只持有目录的读锁时使用
+ *
+ * @param inode 目录inode
+ * @param fname
+ * @param dentry 返回找到的目录项，未找到为NULL
+ * @return boolean 结果是否可信：哈希表未建立，或未找到而目录未完整读入时为FALSE
+ */
+boolean nfs_dir_peek(struct nfs_inode* inode, const char* fname, struct nfs_dentry** dentry) {
+    *dentry = NULL;
+    if (inode->dhash == NULL) {
+        return FALSE;
+    }
+    *dentry = nfs_dir_find(inode, fname);
+    return *dentry != NULL || inode->is_loaded;
+}
+/**
+ * @brief 比较无锁读到的文件名，dentry可能正被rename改名
+ *
+ * name_len和fname可能分属改名前后，只用name_len过滤，逐字节比较到任一方的'\0'为止
+ *
+ * @param dentry
+ * @param fname
+ * @param len strlen(fname)
+ * @return boolean
+ */
+static boolean nfs_dir_fname_eq(struct nfs_dentry* dentry, const char* fname, int len) {
+    return NFS_RCU_DEREF(dentry->name_len) == len &&
+           strcmp(NFS_RCU_DEREF(dentry->fname), fname) == 0;
+}
+/**
+ * @brief 不持目录锁查找目录项，调用者在RCU读侧临界区内
+ *
+ * 读之前和之后比较dir_seq，期间目录哈希表被修改时结果不可信；哈希链可能在扩容时被改写，
+ * 沿链每走一步都检查一次
+ *
+ * @param inode 目录inode，内存在临界区内有效
+ * @param fname
+ * @param dentry 返回找到的目录项，未找到为NULL
+ * @return boolean 结果是否可信，FALSE时改走加锁的查找
+ */
+boolean nfs_dir_find_rcu(struct nfs_inode* inode, const char* fname, struct nfs_dentry** dentry) {
+    struct nfs_dentry** dhash;
+    struct nfs_dentry*  dentry_cursor;
+    uint32_t hash = nfs_name_hash(fname);
+    unsigned seq  = nfs_seq_read_begin(&inode->dir_seq);
+    int len = strlen(fname);
+    int size;
+
+    *dentry = NULL;
+    dhash   = NFS_RCU_DEREF(inode->dhash);
+    size    = NFS_RCU_DEREF(inode->dhash_size);
+    if (dhash == NULL || nfs_seq_read_retry(&inode->dir_seq, seq)) {
+        return FALSE;                                 /* 哈希表未建立或正在重建 */
+    }
+    dentry_cursor = NFS_RCU_DEREF(dhash[hash & (size - 1)]);
+    while (dentry_cursor) {
+        if (nfs_seq_read_retry(&inode->dir_seq, seq)) {
+            return FALSE;
+        }
+        if (NFS_RCU_DEREF(dentry_cursor->hash) == hash && nfs_dir_fname_eq(dentry_cursor, fname, len)) {
+            *dentry = dentry_cursor;
+            return TRUE;
+        }
+        dentry_cursor = NFS_RCU_DEREF(dentry_cursor->hnext);
+    }
+    return NFS_RCU_DEREF(inode->is_loaded) && !nfs_seq_read_retry(&inode->dir_seq, seq);
+}
+/**
+ * @brief 完整读入目录的所有目录项，跳过已经探查读入的项
+ *
+ * 先校验所有桶块，有损坏时不读入任何目录项
+ *
+ * @param inode 目录inode
+ * @return int
+ */
+int nfs_dir_load(struct nfs_inode* inode) {
+    uint8_t* buf;
+    struct nfs_dir_bucket_d* bucket_d;
+    struct nfs_dentry_d*     dentry_d;
+    int bucket, i;
+    int bytes = 0;
+
+    if (inode->is_loaded) {
+        return NFS_ERROR_NONE;
+    }
+    buf       = (uint8_t*)malloc(NFS_BLKS_SZ(inode->dir_buckets));
+    if (nfs_extent_read(inode, buf, NFS_BLKS_SZ(inode->dir_buckets)) != NFS_ERROR_NONE) {
+        free(buf);
+        return -NFS_ERROR_IO;
+    }
+    for (bucket = 0; bucket < inode->dir_buckets; bucket++) {
+        bucket_d = (struct nfs_dir_bucket_d*)(buf + NFS_BLKS_SZ(bucket));
+        if (nfs_dir_check_bucket(bucket_d) != NFS_ERROR_NONE) {
+            free(buf);
+            return -NFS_ERROR_IO;
+        }
+        dentry_d = (struct nfs_dentry_d*)(bucket_d + 1);
+        for (i = 0; i < (int)bucket_d->cnt; i++) {
+            bytes   += dentry_d->name_len + 1;
+            dentry_d = NFS_DENTRY_D_NEXT(dentry_d);
+        }
+    }
+    nfs_slab_reserve(&nfs_super.dentry_slab, inode->dir_cnt); /* 整个目录的dentry连续分配 */
+    if (bytes > 0 && (inode->names == NULL || inode->names->used + bytes > inode->names->cap)) {
+        nfs_dir_name_grow(inode, bytes);              /* 文件名也连续存放 */
+    }
+    for (bucket = 0; bucket < inode->dir_buckets; bucket++) {
+        bucket_d = (struct nfs_dir_bucket_d*)(buf + NFS_BLKS_SZ(bucket));
+        dentry_d = (struct nfs_dentry_d*)(bucket_d + 1);
+        for (i = 0; i < (int)bucket_d->cnt; i++) {
+            if (inode->dentrys == NULL || nfs_dir_find(inode, NFS_DENTRY_D_NAME(dentry_d)) == NULL) {
+                nfs_dir_attach(inode, nfs_dir_new_dentry(inode, dentry_d));
+            }
+            dentry_d = NFS_DENTRY_D_NEXT(dentry_d);
+        }
+    }
+    free(buf);
+    NFS_RCU_ASSIGN(inode->is_loaded, TRUE);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 目录项记录共bytes字节时的桶数：2的幂，记录总字节数不超过容量的3/4
+ *
+ * @param bytes
+ * @return int 空目录为0
+ */
+static int nfs_dir_buckets(int bytes) {
+    int cap     = NFS_DIR_BUCKET_CAP();
+    int buckets = 1;
+
+    if (bytes == 0) {
+        return 0;
+    }
+    while (buckets * cap * 3 < bytes * 4) {
+        buckets <<= 1;
+    }
+    return buckets;
+}
+/**
+ * @brief 为即将加入的长为name_len的目录项预留写回时所需的桶块
+ *
+ * 目录的块只增不减（删除目录时释放），预留之后目录被写回也不会丢失这部分空间
+ *
+ * @param inode 目录inode，调用者持有其写锁
+ * @param name_len
+ * @return int 空闲块不足时返回-NFS_ERROR_NOSPACE
+ */
+int nfs_dir_reserve(struct nfs_inode* inode, int name_len) {
+    if (nfs_dir_load(inode) != NFS_ERROR_NONE) {     /* dir_bytes须包含所有目录项 */
+        return -NFS_ERROR_IO;
+    }
+    return nfs_reserve_blks(inode, nfs_dir_buckets(inode->dir_bytes + NFS_DENTRY_D_SZ(name_len)));
+}
+/**
+ * @brief 将目录项按哈希写成桶块
+ *
+ * 目录项是变长记录，桶数见nfs_dir_buckets；桶放不下时顺延到下一个桶并在原桶打溢出标记。
+ * 每个桶块带校验和。桶块由nfs_dir_reserve预留，桶数减少时多余的块留给以后的目录项
+ *
+ * @param inode 已完整读入的目录inode
+ * @return int
+ */
+int nfs_dir_sync(struct nfs_inode* inode) {
+    struct nfs_dentry*       dentry_cursor;
+    struct nfs_dir_bucket_d* bucket_d;
+    struct nfs_dentry_d*     dentry_d;
+    uint8_t* buf;
+    int cap     = NFS_DIR_BUCKET_CAP();
+    int buckets = nfs_dir_buckets(inode->dir_bytes);
+    int bucket, rec_sz;
+
+    if (buckets == 0) {                               /* 空目录不写桶块，同nfs_mkfs写入的根目录 */
+        inode->dir_buckets = 0;
+        return NFS_ERROR_NONE;
+    }
+    if (nfs_map_data(inode, buckets) != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] no space for dentrys\n", __func__);
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->dir_buckets = buckets;
+
+    buf = (uint8_t*)calloc(1, NFS_BLKS_SZ(buckets));
+    for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother) {
+        rec_sz   = NFS_DENTRY_D_SZ(dentry_cursor->name_len);
+        bucket   = dentry_cursor->hash & (buckets - 1);
+        bucket_d = (struct nfs_dir_bucket_d*)(buf + NFS_BLKS_SZ(bucket));
+        while ((int)bucket_d->used + rec_sz > cap) {  /* 线性探测下一个桶 */
+            bucket_d->flags |= NFS_DIR_BUCKET_SPILL;
+            bucket   = (bucket + 1) & (buckets - 1);
+            bucket_d = (struct nfs_dir_bucket_d*)(buf + NFS_BLKS_SZ(bucket));
+        }
+        dentry_d = (struct nfs_dentry_d*)((uint8_t*)(bucket_d + 1) + bucket_d->used);
+        dentry_d->ino      = dentry_cursor->ino;
+        dentry_d->dat      = dentry_cursor->dat;
+        dentry_d->ftype    = dentry_cursor->ftype;
+        dentry_d->name_len = dentry_cursor->name_len;
+        memcpy(NFS_DENTRY_D_NAME(dentry_d), dentry_cursor->fname, dentry_cursor->name_len);
+        bucket_d->cnt++;
+        bucket_d->used += rec_sz;
+    }
+    for (bucket = 0; bucket < buckets; bucket++) {
+        bucket_d = (struct nfs_dir_bucket_d*)(buf + NFS_BLKS_SZ(bucket));
+        bucket_d->csum = nfs_dir_bucket_csum(bucket_d);
+    }
+    if (nfs_extent_sync(inode, buf, NFS_BLKS_SZ(buckets)) != NFS_ERROR_NONE) {
+        free(buf);
+        return -NFS_ERROR_IO;
+    }
+    free(buf);
+    return NFS_ERROR_NONE;
+}
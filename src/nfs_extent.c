@@ -0,0 +1,277 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/**
+ * @brief 获取inode的第idx个extent，前NFS_INLINE_EXTENTS个存于inode内，其余存于溢出块
+ *
+ * @param inode
+ * @param idx [0...ext_cnt)
+ * @return struct nfs_extent*
+ */
+struct nfs_extent* nfs_extent_get(struct nfs_inode* inode, int idx) {
+    if (idx < NFS_INLINE_EXTENTS) {
+        return &inode->extents[idx];
+    }
+    return &inode->ext_overflow[idx - NFS_INLINE_EXTENTS];
+}
+/**
+ * @brief 逻辑块号 -> 数据块号
+ *
+ * @param inode
+ * @param lblk 文件内逻辑块号
+ * @return int 数据块号，未映射返回-1
+ */
+int nfs_extent_bmap(struct nfs_inode* inode, int lblk) {
+    struct nfs_extent* extent;
+    int i;
+    for (i = 0; i < inode->ext_cnt; i++) {
+        extent = nfs_extent_get(inode, i);
+        if (lblk < extent->len) {
+            return extent->start + lblk;
+        }
+        lblk -= extent->len;
+    }
+    return -1;
+}
+/**
+ * @brief 在文件末尾追加连续的数据块，与最后一个extent相邻且在同一块组时直接延长
+ *
+ * @param inode
+ * @param dat 起始数据块号
+ * @param cnt 块数，位于同一块组
+ * @return int
+ */
+int nfs_extent_append(struct nfs_inode* inode, int dat, int cnt) {
+    struct nfs_extent* extent = NULL;
+    int got;
+
+    if (inode->ext_cnt > 0) {
+        extent = nfs_extent_get(inode, inode->ext_cnt - 1);
+        if (extent->start + extent->len == dat &&   /* 相邻两组的数据区在磁盘上不连续 */
+            NFS_DATA_GROUP(extent->start) == NFS_DATA_GROUP(dat)) {
+            extent->len    += cnt;
+            inode->blk_cnt += cnt;
+            return NFS_ERROR_NONE;
+        }
+    }
+
+    if (inode->ext_cnt >= NFS_INLINE_EXTENTS + NFS_EXTENTS_PER_BLK()) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (inode->ext_cnt >= NFS_INLINE_EXTENTS && inode->ext_overflow == NULL) {
+                                                      /* 内联extent用尽，在新块之后分配溢出块 */
+        inode->ext_blk = nfs_alloc_data_run(dat + cnt, 1, &got, inode->rsv_meta);
+        if (inode->ext_blk < 0) {
+            return -NFS_ERROR_NOSPACE;
+        }
+        if (inode->rsv_meta) {                        /* 用掉了nfs_reserve_meta预留的块 */
+            nfs_release_data(1);
+            inode->rsv_meta = FALSE;
+        }
+        inode->ext_overflow = (struct nfs_extent*)calloc(NFS_EXTENTS_PER_BLK(),
+                                                         sizeof(struct nfs_extent));
+    }
+    extent = nfs_extent_get(inode, inode->ext_cnt);
+    extent->start = dat;
+    extent->len   = cnt;
+    inode->ext_cnt++;
+    inode->blk_cnt += cnt;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 扩展inode映射的数据块，优先分配紧随最后一个extent的块以保持连续
+ *
+ * 每次请求所缺的全部块数，由空闲extent索引给出尽量长的连续段
+ *
+ * @param inode
+ * @param blks 需要映射的总块数
+ * @param is_reserved 所缺的块是否已预留
+ * @return int
+ */
+int nfs_extent_grow(struct nfs_inode* inode, int blks, boolean is_reserved) {
+    struct nfs_extent* extent;
+    int goal = NFS_GROUP_FIRST_DATA(NFS_INO_GROUP(inode->ino)); /* 首块放在inode所在组 */
+    int dat, cnt;
+
+    while (inode->blk_cnt < blks) {
+        if (inode->ext_cnt > 0) {
+            extent = nfs_extent_get(inode, inode->ext_cnt - 1);
+            goal   = extent->start + extent->len;
+        }
+        dat = nfs_alloc_data_run(goal, blks - inode->blk_cnt, &cnt, is_reserved);
+        if (dat < 0) {
+            return -NFS_ERROR_NOSPACE;
+        }
+        if (nfs_extent_append(inode, dat, cnt) != NFS_ERROR_NONE) {
+            nfs_free_data_run(dat, cnt);
+            return -NFS_ERROR_NOSPACE;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放inode映射中超出blks的数据块
+ *
+ * @param inode
+ * @param blks 保留的块数
+ */
+void nfs_extent_shrink(struct nfs_inode* inode, int blks) {
+    struct nfs_extent* extent;
+    int cnt;
+
+    while (inode->blk_cnt > blks) {
+        extent = nfs_extent_get(inode, inode->ext_cnt - 1);
+        cnt    = extent->len < inode->blk_cnt - blks ? extent->len : inode->blk_cnt - blks;
+        extent->len    -= cnt;
+        inode->blk_cnt -= cnt;
+        nfs_free_data_run(extent->start + extent->len, cnt);
+        if (extent->len == 0) {
+            inode->ext_cnt--;
+        }
+    }
+    if (inode->ext_cnt <= NFS_INLINE_EXTENTS && inode->ext_overflow != NULL) {
+        nfs_free_data_blk(inode->ext_blk);            /* 不再需要溢出块 */
+        free(inode->ext_overflow);
+        inode->ext_overflow = NULL;
+        inode->ext_blk      = -1;
+    }
+}
+/**
+ * @brief 按extent将buf写入数据块，每个extent一次大IO
+ *
+ * @param inode
+ * @param buf
+ * @param size 写入的字节数，不超过已映射的块
+ * @return int
+ */
+int nfs_extent_sync(struct nfs_inode* inode, uint8_t* buf, int size) {
+    struct nfs_extent* extent;
+    int i, len;
+
+    for (i = 0; i < inode->ext_cnt && size > 0; i++) {
+        extent = nfs_extent_get(inode, i);
+        len    = NFS_BLKS_SZ(extent->len) < size ? NFS_BLKS_SZ(extent->len) : size;
+        if (nfs_driver_write(NFS_DATA_OFS(extent->start), buf, len) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] io error\n", __func__);
+            return -NFS_ERROR_IO;
+        }
+        buf  += len;
+        size -= len;
+    }
+    if (inode->ext_overflow != NULL) {
+        if (nfs_driver_write(NFS_DATA_OFS(inode->ext_blk), (uint8_t *)inode->ext_overflow,
+                             NFS_BLKS_SZ(1)) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] io error\n", __func__);
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 读入溢出extent块
+ *
+ * @param inode ext_cnt、ext_blk已从磁盘inode中恢复
+ * @return int
+ */
+int nfs_extent_load(struct nfs_inode* inode) {
+    if (inode->ext_cnt <= NFS_INLINE_EXTENTS) {
+        return NFS_ERROR_NONE;
+    }
+    inode->ext_overflow = (struct nfs_extent*)malloc(NFS_BLKS_SZ(1));
+    if (nfs_driver_read(NFS_DATA_OFS(inode->ext_blk), (uint8_t *)inode->ext_overflow,
+                        NFS_BLKS_SZ(1)) != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] io error\n", __func__);
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 按extent从数据块读出size字节到buf
+ *
+ * @param inode
+ * @param buf
+ * @param size
+ * @return int
+ */
+int nfs_extent_read(struct nfs_inode* inode, uint8_t* buf, int size) {
+    struct nfs_extent* extent;
+    int i, len;
+
+    for (i = 0; i < inode->ext_cnt && size > 0; i++) {
+        extent = nfs_extent_get(inode, i);
+        len    = NFS_BLKS_SZ(extent->len) < size ? NFS_BLKS_SZ(extent->len) : size;
+        if (nfs_driver_read(NFS_DATA_OFS(extent->start), buf, len) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] io error\n", __func__);
+            return -NFS_ERROR_IO;
+        }
+        buf  += len;
+        size -= len;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 从数据块读出文件中[offset, offset + size)的内容，不需要读入整个文件
+ *
+ * 启用块缓存时经由缓存读取；未映射的部分填0
+ *
+ * @param inode
+ * @param buf
+ * @param size
+ * @param offset 文件内偏移
+ * @return int
+ */
+int nfs_extent_pread(struct nfs_inode* inode, uint8_t* buf, int size, int offset) {
+    struct nfs_extent* extent;
+    int i, ext_sz, from, len;
+    int ext_ofs = 0;                                  /* 当前extent在文件中的起始偏移 */
+
+    for (i = 0; i < inode->ext_cnt && size > 0; i++) {
+        extent = nfs_extent_get(inode, i);
+        ext_sz = NFS_BLKS_SZ(extent->len);
+        if (offset < ext_ofs + ext_sz) {
+            from = offset - ext_ofs;
+            len  = ext_sz - from < size ? ext_sz - from : size;
+            if (nfs_driver_read(NFS_DATA_OFS(extent->start) + from, buf, len) != NFS_ERROR_NONE) {
+                NFS_DBG("[%s] io error\n", __func__);
+                return -NFS_ERROR_IO;
+            }
+            buf    += len;
+            offset += len;
+            size   -= len;
+        }
+        ext_ofs += ext_sz;
+    }
+    if (size > 0) {
+        memset(buf, 0, size);
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 对逻辑块[lblk, lblk + cnt)发起异步预读，每段物理连续的块一次请求
+ *
+ * @param inode
+ * @param lblk
+ * @param cnt
+ * @return int 发起预读的IO单元数
+ */
+int nfs_extent_readahead(struct nfs_inode* inode, int lblk, int cnt) {
+    struct nfs_extent* extent;
+    int i, from, n;
+    int ext_lblk = 0;                                 /* 当前extent的起始逻辑块号 */
+    int submitted = 0;
+
+    for (i = 0; i < inode->ext_cnt && cnt > 0; i++) {
+        extent = nfs_extent_get(inode, i);
+        if (lblk < ext_lblk + extent->len) {
+            from = lblk - ext_lblk;
+            n    = extent->len - from < cnt ? extent->len - from : cnt;
+            submitted += nfs_cache_readahead(NFS_DATA_OFS(extent->start + from) / NFS_IO_SZ(),
+                                             NFS_BLKS_SZ(n) / NFS_IO_SZ());
+            lblk += n;
+            cnt  -= n;
+        }
+        ext_lblk += extent->len;
+    }
+    return submitted;
+}
@@ -0,0 +1,395 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/**
+ * @brief 按设备大小计算布局
+ *
+ * 设备从第1块起划分为若干块组，每组为 | Inode Map | Data Map | Inode Table | Data |，
+ * 组0之前是超级块。每组的位图各占一块，因此一组最多NFS_BITS_PER_BLK()块；
+ * 设备不足一组时只有一组。最后一组不满时，数据区不比元数据大就舍去
+ *
+ * @param super_d 输出
+ * @param bytes_per_inode 每多少字节分配一个inode，不小于一块
+ * @param blks_per_group 每组块数，0表示取上限
+ * @return int
+ */
+static int nfs_group_layout(struct nfs_super_d* super_d, int bytes_per_inode, int blks_per_group) {
+    long total_blks = NFS_DISK_SZ() / NFS_BLKS_SZ(1) - 1;      /* 除去超级块 */
+    int  group_blks, ipg, itable_blks, meta_blks, dpg, last_data;
+    long group_cnt;
+
+    if (bytes_per_inode < NFS_BLKS_SZ(1)) {
+        return -NFS_ERROR_INVAL;
+    }
+    if (blks_per_group <= 0 || blks_per_group > NFS_BITS_PER_BLK()) {
+        blks_per_group = NFS_BITS_PER_BLK();
+    }
+    group_blks  = total_blks < blks_per_group ? (int)total_blks : blks_per_group;
+    ipg         = (int)((long)group_blks * NFS_BLKS_SZ(1) / bytes_per_inode);
+    ipg         = ipg < NFS_INODES_PER_BLK() ? NFS_INODES_PER_BLK()
+                                             : NFS_ROUND_UP(ipg, NFS_INODES_PER_BLK());
+    itable_blks = ipg / NFS_INODES_PER_BLK();
+    meta_blks   = 2 + itable_blks;                    /* 两个位图块和inode表 */
+    if (group_blks <= meta_blks) {
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    if (total_blks <= blks_per_group) {               /* 单组，数据块号不需要按字节对齐 */
+        blks_per_group = group_blks;
+        group_cnt = 1;
+        last_data = group_blks - meta_blks;
+        dpg       = NFS_ROUND_UP(last_data, UINT8_BITS);
+    }
+    else {                                            /* 每组的数据位按字节对齐拼接到内存位图 */
+        dpg       = blks_per_group - meta_blks;
+        dpg       = NFS_ROUND_DOWN(dpg, UINT8_BITS);
+        group_cnt = total_blks / blks_per_group;
+        last_data = dpg;
+        if (group_cnt > INT32_MAX / blks_per_group) { /* ino、数据块号为int */
+            group_cnt = INT32_MAX / blks_per_group;
+        }
+        else if (total_blks % blks_per_group - meta_blks >= meta_blks) {
+            last_data = (int)(total_blks % blks_per_group) - meta_blks;
+            last_data = last_data < dpg ? last_data : dpg;
+            group_cnt++;
+        }
+    }
+
+    memset(super_d, 0, sizeof(struct nfs_super_d));
+    super_d->magic_num        = NFS_MAGIC_NUM;
+    super_d->layout_version   = NFS_LAYOUT_VERSION;
+    super_d->blk_sz           = NFS_BLKS_SZ(1);
+    super_d->sz_disk          = NFS_DISK_SZ();
+    super_d->bytes_per_inode  = bytes_per_inode;
+    super_d->group_cnt        = (int)group_cnt;
+    super_d->blks_per_group   = blks_per_group;
+    super_d->inodes_per_group = ipg;
+    super_d->data_per_group   = dpg;
+    super_d->itable_blks      = itable_blks;
+    super_d->map_inode_blks   = 1;
+    super_d->map_data_blks    = 1;
+    super_d->max_ino          = (int)group_cnt * ipg;
+    super_d->max_data         = (int)(group_cnt - 1) * dpg + last_data;
+    super_d->group_sz         = NFS_BLKS_SZ((long)blks_per_group);
+    super_d->map_inode_offset = NFS_SUPER_OFS + NFS_BLKS_SZ(1);
+    super_d->map_data_offset  = super_d->map_inode_offset + NFS_BLKS_SZ(super_d->map_inode_blks);
+    super_d->inode_offset     = super_d->map_data_offset + NFS_BLKS_SZ(super_d->map_data_blks);
+    super_d->data_offset      = super_d->inode_offset + NFS_BLKS_SZ((long)itable_blks);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 格式化已打开的设备：清空各组位图，写入根目录inode，最后写超级块
+ *
+ * 根目录没有目录项，不占数据块。超级块最后写入，中途失败不会留下可挂载的镜像
+ *
+ * @param bytes_per_inode
+ * @param blks_per_group 0表示取上限
+ * @return int
+ */
+int nfs_mkfs(int bytes_per_inode, int blks_per_group) {
+    struct nfs_super_d super_d;
+    struct nfs_inode_d* root_d;
+    uint8_t* buf;
+    int map_sz, group;
+    int ret;
+
+    ret = nfs_group_layout(&super_d, bytes_per_inode, blks_per_group);
+    if (ret != NFS_ERROR_NONE) {
+        return ret;
+    }
+    NFS_DBG("[%s] %d groups of %d blocks, %d inodes, %d data blocks\n", __func__,
+            super_d.group_cnt, super_d.blks_per_group, super_d.max_ino, super_d.max_data);
+
+    map_sz = NFS_BLKS_SZ(super_d.map_inode_blks + super_d.map_data_blks);
+    buf    = (uint8_t*)calloc(1, map_sz);
+    for (group = 0; group < super_d.group_cnt && ret == NFS_ERROR_NONE; group++) {
+        if (group == 0) {                             /* 根目录占用ino 0 */
+            NFS_BITMAP_SET(buf, NFS_ROOT_INO);
+        }
+        ret = nfs_driver_write(super_d.map_inode_offset + (long)group * super_d.group_sz,
+                               buf, map_sz);          /* 两个位图相邻，一次写出 */
+        memset(buf, 0, map_sz);
+    }
+    free(buf);
+    if (ret != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+
+    buf    = (uint8_t*)calloc(1, NFS_BLKS_SZ(1));
+    root_d = (struct nfs_inode_d*)buf;
+    root_d->ino     = NFS_ROOT_INO;
+    root_d->ftype   = NFS_DIR;
+    root_d->ext_blk = -1;
+    ret = nfs_driver_write(super_d.inode_offset, buf, NFS_BLKS_SZ(1));
+    if (ret == NFS_ERROR_NONE) {
+        memset(buf, 0, NFS_BLKS_SZ(1));
+        memcpy(buf, &super_d, sizeof(struct nfs_super_d));
+        ret = nfs_driver_write(NFS_SUPER_OFS, buf, NFS_BLKS_SZ(1));
+    }
+    free(buf);
+    return ret == NFS_ERROR_NONE ? NFS_ERROR_NONE : -NFS_ERROR_IO;
+}
+/**
+ * @brief 组中数据块号的上界（不含），最后一组的数据块可能不满
+ *
+ * @param group
+ * @return int
+ */
+static int nfs_group_data_end(int group) {
+    int end = NFS_GROUP_FIRST_DATA(group + 1);
+    return end < nfs_super.max_data ? end : nfs_super.max_data;
+}
+/**
+ * @brief 由位图统计组的空闲inode和数据块数，mount时调用
+ *
+ * @param group
+ */
+static void nfs_group_count(int group) {
+    struct nfs_group* grp = &nfs_super.groups[group];
+    int first_ino = NFS_GROUP_FIRST_INO(group);
+    int first_dat = NFS_GROUP_FIRST_DATA(group);
+    int data_cnt  = nfs_group_data_end(group) - first_dat;
+
+    grp->free_inodes = nfs_super.inodes_per_group - 
+                       nfs_bitmap_count(nfs_super.map_inode + first_ino / UINT8_BITS,
+                                        nfs_super.inodes_per_group);
+    grp->free_data   = data_cnt - nfs_bitmap_count(nfs_super.map_data + first_dat / UINT8_BITS,
+                                                   data_cnt);
+    grp->ino_hint    = first_ino;
+}
+/**
+ * @brief 按超级块建立内存中的布局，读入各组位图
+ *
+ * 各组位图拼接为一张内存位图，组g的inode占[g * inodes_per_group, (g + 1) * inodes_per_group)，
+ * 数据块同理
+ *
+ * @param super_d
+ * @return int
+ */
+int nfs_group_init(const struct nfs_super_d* super_d) {
+    uint8_t* buf;
+    int imap_sz, dmap_sz, group;
+    long map_sz;
+    int ret = NFS_ERROR_NONE;
+
+    if (super_d->blk_sz != NFS_BLKS_SZ(1) || super_d->sz_disk > NFS_DISK_SZ() ||
+        super_d->group_cnt <= 0 || super_d->inodes_per_group % UINT8_BITS != 0 ||
+        super_d->data_per_group % UINT8_BITS != 0) {
+        NFS_DBG("[%s] layout does not match the device\n", __func__);
+        return -NFS_ERROR_INVAL;
+    }
+    nfs_super.map_inode_blks   = super_d->map_inode_blks;
+    nfs_super.map_data_blks    = super_d->map_data_blks;
+    nfs_super.map_inode_offset = super_d->map_inode_offset;
+    nfs_super.map_data_offset  = super_d->map_data_offset;
+    nfs_super.inode_offset     = super_d->inode_offset;
+    nfs_super.data_offset      = super_d->data_offset;
+    nfs_super.group_cnt        = super_d->group_cnt;
+    nfs_super.group_sz         = super_d->group_sz;
+    nfs_super.inodes_per_group = super_d->inodes_per_group;
+    nfs_super.data_per_group   = super_d->data_per_group;
+    nfs_super.max_ino          = super_d->max_ino;
+    nfs_super.max_data         = super_d->max_data;
+
+    imap_sz = nfs_super.inodes_per_group / UINT8_BITS;
+    dmap_sz = nfs_super.data_per_group / UINT8_BITS;
+    map_sz  = (long)imap_sz * nfs_super.group_cnt;   /* 按64位字查找，补齐到8字节 */
+    nfs_super.map_inode = (uint8_t *)calloc(1, NFS_ROUND_UP(map_sz, (long)sizeof(uint64_t)));
+    map_sz  = (long)dmap_sz * nfs_super.group_cnt;
+    nfs_super.map_data  = (uint8_t *)calloc(1, NFS_ROUND_UP(map_sz, (long)sizeof(uint64_t)));
+    nfs_super.groups    = (struct nfs_group *)calloc(nfs_super.group_cnt, sizeof(struct nfs_group));
+
+    buf = (uint8_t*)malloc(NFS_BLKS_SZ(nfs_super.map_inode_blks + nfs_super.map_data_blks));
+    for (group = 0; group < nfs_super.group_cnt && ret == NFS_ERROR_NONE; group++) {
+        ret = nfs_driver_read(NFS_IMAP_OFS(group), buf,
+                              NFS_BLKS_SZ(nfs_super.map_inode_blks + nfs_super.map_data_blks));
+        memcpy(nfs_super.map_inode + (long)group * imap_sz, buf, imap_sz);
+        memcpy(nfs_super.map_data + (long)group * dmap_sz,
+               buf + NFS_DMAP_OFS(group) - NFS_IMAP_OFS(group), dmap_sz);
+    }
+    free(buf);
+    if (ret != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    for (group = 0; group < nfs_super.group_cnt; group++) {
+        nfs_group_count(group);
+    }
+    nfs_space_init();
+    nfs_super.dir_rotor = 0;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 为顶层目录选组：空闲inode不少于平均值的组中空闲数据块最多的，
+ * 从上一个顶层目录的下一组开始比较，条件相同时依次轮换
+ *
+ * @return int 没有空闲inode返回-1
+ */
+static int nfs_group_find_dir() {
+    long free_inodes = 0;
+    int  best = -1;
+    int  i, group;
+    struct nfs_group* grp;
+
+    for (group = 0; group < nfs_super.group_cnt; group++) {
+        free_inodes += nfs_super.groups[group].free_inodes;
+    }
+    for (i = 1; i <= nfs_super.group_cnt; i++) {
+        group = (nfs_super.dir_rotor + i) % nfs_super.group_cnt;
+        grp   = &nfs_super.groups[group];
+        if (grp->free_inodes == 0 ||
+            (long)grp->free_inodes * nfs_super.group_cnt < free_inodes) {
+            continue;
+        }
+        if (best < 0 || grp->free_data > nfs_super.groups[best].free_data) {
+            best = group;
+        }
+    }
+    if (best >= 0) {
+        nfs_super.dir_rotor = best;
+    }
+    return best;
+}
+/**
+ * @brief 分配一个inode：顶层目录分散到各组，其余放在父目录所在的组，满了依次找后面的组
+ *
+ * 调用者持有alloc_lock
+ *
+ * @param parent_ino 父目录的ino，根目录以外都有
+ * @param is_dir
+ * @return int ino，无空闲返回-1
+ */
+int nfs_group_alloc_inode(int parent_ino, boolean is_dir) {
+    struct nfs_group* grp;
+    int start = parent_ino >= 0 ? NFS_INO_GROUP(parent_ino) : 0;
+    int i, group, ino;
+
+    if (is_dir && parent_ino == NFS_ROOT_INO) {
+        group = nfs_group_find_dir();
+        if (group >= 0) {
+            start = group;
+        }
+    }
+    for (i = 0; i < nfs_super.group_cnt; i++) {
+        group = (start + i) % nfs_super.group_cnt;
+        grp   = &nfs_super.groups[group];
+        if (grp->free_inodes == 0) {
+            continue;
+        }
+        ino = nfs_bitmap_alloc(nfs_super.map_inode, NFS_GROUP_FIRST_INO(group + 1),
+                               grp->ino_hint, &grp->ino_hint);
+        if (ino >= 0) {
+            grp->free_inodes--;
+            grp->is_imap_dirty = TRUE;
+            return ino;
+        }
+    }
+    return -1;
+}
+/**
+ * @brief 释放一个inode，调用者持有alloc_lock
+ *
+ * @param ino
+ */
+void nfs_group_free_inode(int ino) {
+    struct nfs_group* grp = &nfs_super.groups[NFS_INO_GROUP(ino)];
+
+    nfs_bitmap_free(nfs_super.map_inode, ino, &grp->ino_hint);
+    grp->free_inodes++;
+    grp->is_imap_dirty = TRUE;
+}
+/**
+ * @brief 分配至多want个连续数据块并占用位图，由空闲extent索引选择位置
+ *
+ * 调用者持有alloc_lock
+ *
+ * @param goal 期望的起始块号
+ * @param want
+ * @param got 实际分配的块数，位于同一组
+ * @return int 起始数据块号，无空间返回-1
+ */
+int nfs_group_alloc_data(int goal, int want, int* got) {
+    struct nfs_group* grp;
+    int dat, i;
+
+    dat = nfs_space_alloc(goal, want, got);
+    if (dat < 0) {
+        return -1;
+    }
+    for (i = dat; i < dat + *got; i++) {
+        NFS_BITMAP_SET(nfs_super.map_data, i);
+    }
+    grp = &nfs_super.groups[NFS_DATA_GROUP(dat)];
+    grp->free_data    -= *got;
+    grp->is_dmap_dirty = TRUE;
+    return dat;
+}
+/**
+ * @brief 释放[dat, dat + cnt)，调用者持有alloc_lock
+ *
+ * @param dat
+ * @param cnt 不跨块组
+ */
+void nfs_group_free_data(int dat, int cnt) {
+    struct nfs_group* grp = &nfs_super.groups[NFS_DATA_GROUP(dat)];
+    int i;
+
+    for (i = dat; i < dat + cnt; i++) {
+        NFS_BITMAP_CLEAR(nfs_super.map_data, i);
+    }
+    nfs_space_free(dat, cnt);
+    grp->free_data    += cnt;
+    grp->is_dmap_dirty = TRUE;
+}
+/**
+ * @brief 写回有修改的组位图，每块整块写出
+ *
+ * 调用者持有alloc_lock
+ *
+ * @return int
+ */
+int nfs_group_sync() {
+    struct nfs_group* group;
+    uint8_t* buf;
+    int imap_sz = nfs_super.inodes_per_group / UINT8_BITS;
+    int dmap_sz = nfs_super.data_per_group / UINT8_BITS;
+    int g;
+
+    buf = (uint8_t*)calloc(1, NFS_BLKS_SZ(1));
+    for (g = 0; g < nfs_super.group_cnt; g++) {
+        group = &nfs_super.groups[g];
+        if (group->is_imap_dirty) {
+            memset(buf, 0, NFS_BLKS_SZ(1));
+            memcpy(buf, nfs_super.map_inode + (long)g * imap_sz, imap_sz);
+            if (nfs_driver_write(NFS_IMAP_OFS(g), buf, NFS_BLKS_SZ(1)) != NFS_ERROR_NONE) {
+                free(buf);
+                return -NFS_ERROR_IO;
+            }
+            group->is_imap_dirty = FALSE;
+        }
+        if (group->is_dmap_dirty) {
+            memset(buf, 0, NFS_BLKS_SZ(1));
+            memcpy(buf, nfs_super.map_data + (long)g * dmap_sz, dmap_sz);
+            if (nfs_driver_write(NFS_DMAP_OFS(g), buf, NFS_BLKS_SZ(1)) != NFS_ERROR_NONE) {
+                free(buf);
+                return -NFS_ERROR_IO;
+            }
+            group->is_dmap_dirty = FALSE;
+        }
+    }
+    free(buf);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放内存位图和块组，umount时调用
+ *
+ */
+void nfs_group_destroy() {
+    nfs_space_destroy();
+    free(nfs_super.map_inode);
+    free(nfs_super.map_data);
+    free(nfs_super.groups);
+    nfs_super.map_inode = NULL;
+    nfs_super.map_data  = NULL;
+    nfs_super.groups    = NULL;
+}
@@ -0,0 +1,242 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/******************************************************************************
+* SECTION: Global Static Var
+*******************************************************************************/
+static struct nfs_ioreq*     nfs_batch;               /* 本轮写回排队的写请求 */
+static int                   nfs_batch_cnt;
+static int                   nfs_batch_cap;
+static boolean               nfs_batch_active = FALSE;
+static pthread_t             nfs_batch_owner;         /* 只有写回线程的写排队 */
+static pthread_mutex_t       nfs_batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct nfs_iov_stats  nfs_iov_stats;
+/**
+ * @brief 记录一次向量传输，同步和异步提交都经由这里计数
+ *
+ * @param iovcnt
+ * @param bytes
+ */
+void nfs_iov_account(int iovcnt, long bytes) {
+    NFS_STAT_ADD(nfs_iov_stats.reqs, iovcnt);
+    NFS_STAT_ADD(nfs_iov_stats.runs, 1);
+    NFS_STAT_ADD(nfs_iov_stats.bytes, bytes);
+}
+/**
+ * @brief 分散读一段连续区间
+ *
+ * @param offset 区间起始偏移，按IO单元对齐
+ * @param iov 每段长度按IO单元对齐
+ * @param iovcnt 不超过NFS_IOV_MAX
+ * @return int
+ */
+int nfs_dev_readv(long offset, const struct iovec* iov, int iovcnt) {
+    int i;
+    long bytes = 0;
+
+    for (i = 0; i < iovcnt; i++) {
+        bytes += iov[i].iov_len;
+    }
+    nfs_iov_account(iovcnt, bytes);
+    return nfs_backend_rwv(NFS_AIO_READ, offset, iov, iovcnt);
+}
+/**
+ * @brief 聚集写一段连续区间
+ *
+ * @param offset 区间起始偏移，按IO单元对齐
+ * @param iov 每段长度按IO单元对齐
+ * @param iovcnt 不超过NFS_IOV_MAX
+ * @return int
+ */
+int nfs_dev_writev(long offset, const struct iovec* iov, int iovcnt) {
+    int i;
+    long bytes = 0;
+
+    for (i = 0; i < iovcnt; i++) {
+        bytes += iov[i].iov_len;
+    }
+    nfs_iov_account(iovcnt, bytes);
+    return nfs_backend_rwv(NFS_AIO_WRITE, offset, iov, iovcnt);
+}
+
+static int nfs_ioreq_cmp(const void* a, const void* b) {
+    const struct nfs_ioreq* req_a = (const struct nfs_ioreq*)a;
+    const struct nfs_ioreq* req_b = (const struct nfs_ioreq*)b;
+    return (req_a->offset > req_b->offset) - (req_a->offset < req_b->offset);
+}
+/**
+ * @brief 一段写完成后释放它的缓冲区，在异步IO工作线程中调用
+ *
+ * @param req
+ */
+static void nfs_iobatch_done(struct nfs_aio_req* req) {
+    int i;
+    for (i = 0; i < req->iovcnt; i++) {
+        free(req->iov[i].iov_base);
+    }
+}
+/**
+ * @brief 按偏移排序排队的写请求，相邻的合并为一次writev，各段异步并发写出
+ *
+ * 批次中的请求互不重叠（见nfs_iobatch_add），排序和并发都不改变写入结果。
+ * 调用者持有nfs_batch_lock
+ *
+ * @return int
+ */
+static int nfs_iobatch_submit() {
+    struct nfs_aio_group group;
+    struct nfs_aio_req*  reqs;
+    struct iovec*        iov;
+    int ret, i, nreqs = 0;
+    long end;
+
+    if (nfs_batch_cnt == 0) {
+        return NFS_ERROR_NONE;
+    }
+    qsort(nfs_batch, nfs_batch_cnt, sizeof(struct nfs_ioreq), nfs_ioreq_cmp);
+    reqs = (struct nfs_aio_req*)calloc(nfs_batch_cnt, sizeof(struct nfs_aio_req));
+    iov  = (struct iovec*)malloc(nfs_batch_cnt * sizeof(struct iovec));
+    nfs_aio_group_init(&group);
+    i = 0;
+    while (i < nfs_batch_cnt) {
+        reqs[nreqs].op     = NFS_AIO_WRITE;
+        reqs[nreqs].offset = nfs_batch[i].offset;
+        reqs[nreqs].iov    = &iov[i];
+        reqs[nreqs].done   = nfs_iobatch_done;
+        end = nfs_batch[i].offset;
+        while (i < nfs_batch_cnt && nfs_batch[i].offset == end && 
+               reqs[nreqs].iovcnt < NFS_IOV_MAX) {
+            iov[i].iov_base = nfs_batch[i].buf;
+            iov[i].iov_len  = nfs_batch[i].size;
+            end += nfs_batch[i].size;
+            reqs[nreqs].iovcnt++;
+            i++;
+        }
+        nfs_aio_submit(&group, &reqs[nreqs]);
+        nreqs++;
+    }
+    ret = nfs_aio_wait(&group);
+    nfs_aio_group_destroy(&group);
+    free(reqs);
+    free(iov);
+    nfs_batch_cnt = 0;
+    return ret == NFS_ERROR_NONE ? NFS_ERROR_NONE : -NFS_ERROR_IO;
+}
+/**
+ * @brief 开始一轮批量写，之后本线程未经块缓存的nfs_driver_write只排队不落盘
+ *
+ * 同一时刻只有一个线程（nfs_writeback）批量写
+ *
+ */
+void nfs_iobatch_begin() {
+    pthread_mutex_lock(&nfs_batch_lock);
+    nfs_batch_owner  = pthread_self();
+    nfs_batch_active = TRUE;
+    pthread_mutex_unlock(&nfs_batch_lock);
+}
+/**
+ * @brief 当前线程的写是否排队
+ *
+ * @return boolean
+ */
+boolean nfs_iobatch_active() {
+    boolean is_active;
+
+    pthread_mutex_lock(&nfs_batch_lock);
+    is_active = nfs_batch_active && pthread_equal(nfs_batch_owner, pthread_self());
+    pthread_mutex_unlock(&nfs_batch_lock);
+    return is_active;
+}
+/**
+ * @brief 见nfs_iobatch_barrier，调用者持有nfs_batch_lock
+ *
+ * @param offset
+ * @param size
+ * @return int
+ */
+static int nfs_iobatch_barrier_locked(long offset, int size) {
+    int i;
+
+    for (i = 0; i < nfs_batch_cnt; i++) {
+        if (nfs_batch[i].offset < offset + size &&
+            offset < nfs_batch[i].offset + nfs_batch[i].size) {
+            return nfs_iobatch_submit();
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 排队一个写请求，buf的所有权交给批次
+ *
+ * @param offset 按IO单元对齐
+ * @param buf malloc得到的缓冲区，提交后释放
+ * @param size 按IO单元对齐
+ * @return int
+ */
+int nfs_iobatch_add(long offset, uint8_t* buf, int size) {
+    int ret;
+
+    pthread_mutex_lock(&nfs_batch_lock);
+    ret = nfs_iobatch_barrier_locked(offset, size);   /* 同一区域的后写须覆盖先写 */
+    if (nfs_batch_cnt == nfs_batch_cap) {
+        nfs_batch_cap = nfs_batch_cap ? nfs_batch_cap * 2 : 64;
+        nfs_batch     = (struct nfs_ioreq*)realloc(nfs_batch,
+                                                   nfs_batch_cap * sizeof(struct nfs_ioreq));
+    }
+    nfs_batch[nfs_batch_cnt].offset = offset;
+    nfs_batch[nfs_batch_cnt].buf    = buf;
+    nfs_batch[nfs_batch_cnt].size   = size;
+    nfs_batch_cnt++;
+    pthread_mutex_unlock(&nfs_batch_lock);
+    return ret;
+}
+/**
+ * @brief 与[offset, offset + size)重叠的请求尚在排队时，先提交整个批次
+ *
+ * 任何线程读设备或覆盖写之前调用，保证看到的是最新内容
+ *
+ * @param offset
+ * @param size
+ * @return int
+ */
+int nfs_iobatch_barrier(long offset, int size) {
+    int ret;
+
+    pthread_mutex_lock(&nfs_batch_lock);
+    ret = nfs_iobatch_barrier_locked(offset, size);
+    pthread_mutex_unlock(&nfs_batch_lock);
+    return ret;
+}
+/**
+ * @brief 结束批量写并提交所有排队的请求
+ *
+ * @return int
+ */
+int nfs_iobatch_end() {
+    int ret;
+
+    pthread_mutex_lock(&nfs_batch_lock);
+    nfs_batch_active = FALSE;
+    ret = nfs_iobatch_submit();
+    pthread_mutex_unlock(&nfs_batch_lock);
+    return ret;
+}
+/**
+ * @brief 释放批次，umount时调用
+ *
+ */
+void nfs_iov_destroy() {
+    free(nfs_batch);
+    nfs_batch     = NULL;
+    nfs_batch_cnt = 0;
+    nfs_batch_cap = 0;
+}
+/**
+ * @brief 获取向量IO统计
+ *
+ * @param stats
+ */
+void nfs_iov_get_stats(struct nfs_iov_stats* stats) {
+    *stats = nfs_iov_stats;
+}
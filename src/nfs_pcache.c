@@ -0,0 +1,206 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/******************************************************************************
+* SECTION: Global Static Var
+*******************************************************************************/
+static struct nfs_pcache     nfs_pcache;
+static pthread_mutex_t       nfs_pcache_lock = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * @brief 将缓存项移到LRU头部
+ *
+ * @param ent
+ */
+static void nfs_pcache_lru_push(struct nfs_pcache_ent* ent) {
+    ent->lru_prev = NULL;
+    ent->lru_next = nfs_pcache.lru_head;
+    if (nfs_pcache.lru_head) {
+        nfs_pcache.lru_head->lru_prev = ent;
+    }
+    nfs_pcache.lru_head = ent;
+    if (nfs_pcache.lru_tail == NULL) {
+        nfs_pcache.lru_tail = ent;
+    }
+}
+
+static void nfs_pcache_lru_unlink(struct nfs_pcache_ent* ent) {
+    if (ent->lru_prev) {
+        ent->lru_prev->lru_next = ent->lru_next;
+    }
+    else {
+        nfs_pcache.lru_head = ent->lru_next;
+    }
+    if (ent->lru_next) {
+        ent->lru_next->lru_prev = ent->lru_prev;
+    }
+    else {
+        nfs_pcache.lru_tail = ent->lru_prev;
+    }
+}
+/**
+ * @brief 从哈希链和LRU中删除缓存项并释放
+ *
+ * @param ent
+ */
+static void nfs_pcache_remove(struct nfs_pcache_ent* ent) {
+    struct nfs_pcache_ent** pprev = &nfs_pcache.buckets[ent->hash & (NFS_PCACHE_BUCKETS - 1)];
+    while (*pprev != ent) {
+        pprev = &(*pprev)->hnext;
+    }
+    *pprev = ent->hnext;
+    nfs_pcache_lru_unlink(ent);
+    nfs_pcache.cnt--;
+    free(ent->path);
+    free(ent);
+}
+/**
+ * @brief 初始化路径缓存，mount时调用
+ *
+ */
+void nfs_pcache_init() {
+    memset(&nfs_pcache, 0, sizeof(struct nfs_pcache));
+}
+/**
+ * @brief 查找路径缓存，命中时与nfs_lookup一样引用返回的inode
+ *
+ * 删除或移动前先使缓存项失效，因此仍在缓存中的dentry可以安全地引用
+ *
+ * @param path
+ * @param dentry 命中时返回nfs_lookup的结果（负项为最后一个存在的dentry）
+ * @param is_find 命中时返回路径是否存在
+ * @return boolean 是否命中
+ */
+boolean nfs_pcache_get(const char* path, struct nfs_dentry** dentry, boolean* is_find) {
+    uint32_t hash = nfs_name_hash(path);
+    struct nfs_pcache_ent* ent;
+
+    pthread_mutex_lock(&nfs_pcache_lock);
+    ent = nfs_pcache.buckets[hash & (NFS_PCACHE_BUCKETS - 1)];
+    while (ent) {
+        if (ent->hash == hash && strcmp(ent->path, path) == 0) {
+            if (nfs_pcache.lru_head != ent) {
+                nfs_pcache_lru_unlink(ent);
+                nfs_pcache_lru_push(ent);
+            }
+            *dentry  = ent->dentry;
+            *is_find = ent->is_find;
+            nfs_get_inode(ent->dentry->inode);
+            if (ent->is_find) {
+                nfs_pcache.stats.hits++;
+            }
+            else {
+                nfs_pcache.stats.neg_hits++;
+            }
+            pthread_mutex_unlock(&nfs_pcache_lock);
+            return TRUE;
+        }
+        ent = ent->hnext;
+    }
+    nfs_pcache.stats.misses++;
+    pthread_mutex_unlock(&nfs_pcache_lock);
+    return FALSE;
+}
+/**
+ * @brief 缓存一次nfs_lookup的结果，满时淘汰最久未用的项
+ *
+ * 多个线程在同一父目录读锁下可能同时未命中同一路径，已有缓存项时更新它而不重复插入
+ *
+ * @param path
+ * @param dentry
+ * @param is_find FALSE为负项
+ */
+void nfs_pcache_put(const char* path, struct nfs_dentry* dentry, boolean is_find) {
+    uint32_t hash = nfs_name_hash(path);
+    struct nfs_pcache_ent* ent;
+    int bucket = hash & (NFS_PCACHE_BUCKETS - 1);
+
+    pthread_mutex_lock(&nfs_pcache_lock);
+    for (ent = nfs_pcache.buckets[bucket]; ent; ent = ent->hnext) {
+        if (ent->hash == hash && strcmp(ent->path, path) == 0) {
+            ent->dentry  = dentry;
+            ent->is_find = is_find;
+            if (nfs_pcache.lru_head != ent) {
+                nfs_pcache_lru_unlink(ent);
+                nfs_pcache_lru_push(ent);
+            }
+            pthread_mutex_unlock(&nfs_pcache_lock);
+            return;
+        }
+    }
+    if (nfs_pcache.cnt >= NFS_PCACHE_MAX) {
+        nfs_pcache_remove(nfs_pcache.lru_tail);
+    }
+    ent = (struct nfs_pcache_ent*)malloc(sizeof(struct nfs_pcache_ent));
+    ent->path    = strdup(path);
+    ent->hash    = hash;
+    ent->dentry  = dentry;
+    ent->is_find = is_find;
+    ent->hnext   = nfs_pcache.buckets[bucket];
+    nfs_pcache.buckets[bucket] = ent;
+    nfs_pcache_lru_push(ent);
+    nfs_pcache.cnt++;
+    pthread_mutex_unlock(&nfs_pcache_lock);
+}
+/**
+ * @brief 使path（subtree为TRUE时连同其下所有路径）的缓存项失效，命名空间变化后调用
+ *
+ * 负项只缓存父目录存在的路径，因此新建文件或目录、删除普通文件只需删除path本身；
+ * 删除或移动目录时其下的正项、负项都已过期，需要扫描
+ *
+ * @param path
+ * @param subtree
+ */
+void nfs_pcache_invalidate(const char* path, boolean subtree) {
+    struct nfs_pcache_ent* ent;
+    struct nfs_pcache_ent* next;
+    uint32_t hash = nfs_name_hash(path);
+    int len = strlen(path);
+
+    pthread_mutex_lock(&nfs_pcache_lock);
+    if (nfs_pcache.cnt == 0) {
+        pthread_mutex_unlock(&nfs_pcache_lock);
+        return;
+    }
+    if (!subtree) {
+        for (ent = nfs_pcache.buckets[hash & (NFS_PCACHE_BUCKETS - 1)]; ent; ent = ent->hnext) {
+            if (ent->hash == hash && strcmp(ent->path, path) == 0) {
+                nfs_pcache_remove(ent);
+                nfs_pcache.stats.invalidations++;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&nfs_pcache_lock);
+        return;
+    }
+    for (ent = nfs_pcache.lru_head; ent != NULL; ent = next) {
+        next = ent->lru_next;
+        if (strncmp(ent->path, path, len) == 0 &&
+            (ent->path[len] == '\0' || ent->path[len] == '/')) {
+            nfs_pcache_remove(ent);
+            nfs_pcache.stats.invalidations++;
+        }
+    }
+    pthread_mutex_unlock(&nfs_pcache_lock);
+}
+/**
+ * @brief 清空路径缓存，umount时调用；统计保留到下次初始化
+ *
+ */
+void nfs_pcache_destroy() {
+    pthread_mutex_lock(&nfs_pcache_lock);
+    while (nfs_pcache.lru_head) {
+        nfs_pcache_remove(nfs_pcache.lru_head);
+    }
+    pthread_mutex_unlock(&nfs_pcache_lock);
+}
+/**
+ * @brief 获取路径缓存统计
+ *
+ * @param stats
+ */
+void nfs_pcache_get_stats(struct nfs_pcache_stats* stats) {
+    pthread_mutex_lock(&nfs_pcache_lock);
+    *stats = nfs_pcache.stats;
+    pthread_mutex_unlock(&nfs_pcache_lock);
+}
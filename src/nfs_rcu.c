@@ -0,0 +1,267 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/******************************************************************************
+* SECTION: Global Static Var
+*******************************************************************************/
+static uint64_t               nfs_rcu_epoch = 1;      /* 全局纪元，每延迟释放一个对象加1 */
+static struct nfs_rcu_reader* nfs_rcu_readers;        /* 所有登记过的线程，只增不减 */
+static pthread_mutex_t        nfs_rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct nfs_rcu_node*   nfs_rcu_pending;        /* 等待读者退出的对象 */
+static int                    nfs_rcu_pending_cnt;
+static long                   nfs_rcu_deferred;
+static long                   nfs_rcu_freed;
+static __thread struct nfs_rcu_reader* nfs_rcu_self;
+static pthread_key_t          nfs_rcu_key;
+static pthread_once_t         nfs_rcu_once = PTHREAD_ONCE_INIT;
+/**
+ * @brief 线程退出时归还读者记录，之后登记的线程可以复用
+ *
+ * @param arg
+ */
+static void nfs_rcu_thread_exit(void* arg) {
+    struct nfs_rcu_reader* reader = (struct nfs_rcu_reader*)arg;
+    __atomic_store_n(&reader->in_use, FALSE, __ATOMIC_RELEASE);
+}
+
+static void nfs_rcu_key_init() {
+    pthread_key_create(&nfs_rcu_key, nfs_rcu_thread_exit);
+}
+/**
+ * @brief 为当前线程取得一个读者记录
+ *
+ * @return struct nfs_rcu_reader*
+ */
+static struct nfs_rcu_reader* nfs_rcu_register() {
+    struct nfs_rcu_reader* reader;
+    boolean expected;
+
+    pthread_once(&nfs_rcu_once, nfs_rcu_key_init);
+    pthread_mutex_lock(&nfs_rcu_lock);
+    for (reader = nfs_rcu_readers; reader != NULL; reader = reader->next) {
+        expected = FALSE;
+        if (__atomic_compare_exchange_n(&reader->in_use, &expected, TRUE, FALSE,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (reader == NULL) {
+        reader = (struct nfs_rcu_reader*)calloc(1, sizeof(struct nfs_rcu_reader));
+        reader->in_use = TRUE;
+        reader->next   = nfs_rcu_readers;
+        __atomic_store_n(&nfs_rcu_readers, reader, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&nfs_rcu_lock);
+    pthread_setspecific(nfs_rcu_key, reader);
+    nfs_rcu_self = reader;
+    return reader;
+}
+/**
+ * @brief 进入读侧临界区，期间读到的dentry、inode和目录哈希表不会被释放
+ *
+ * 可以嵌套；临界区内不能等待其他线程退出临界区
+ *
+ */
+void nfs_rcu_read_lock() {
+    struct nfs_rcu_reader* reader = nfs_rcu_self;
+
+    if (reader == NULL) {
+        reader = nfs_rcu_register();
+    }
+    if (reader->nesting++ == 0) {
+        __atomic_store_n(&reader->epoch, __atomic_load_n(&nfs_rcu_epoch, __ATOMIC_SEQ_CST),
+                         __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);      /* 之后的读不早于登记纪元 */
+    }
+}
+
+void nfs_rcu_read_unlock() {
+    struct nfs_rcu_reader* reader = nfs_rcu_self;
+
+    if (--reader->nesting == 0) {
+        __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+    }
+}
+/**
+ * @brief 释放一个延迟释放的对象及其记录
+ *
+ * @param node
+ */
+static void nfs_rcu_release(struct nfs_rcu_node* node) {
+    if (node->slab != NULL) {
+        nfs_slab_free(node->slab, node->ptr);
+    }
+    else {
+        free(node->ptr);
+    }
+    free(node);
+}
+/**
+ * @brief 释放纪元早于所有读者的对象
+ *
+ * 对象在纪元e摘下并延迟释放后全局纪元变为e + 1；纪元大于e的读者是在摘下之后进入的，
+ * 读不到它
+ *
+ */
+static void nfs_rcu_reclaim() {
+    struct nfs_rcu_reader* reader;
+    struct nfs_rcu_node*   node;
+    struct nfs_rcu_node*   to_free = NULL;
+    struct nfs_rcu_node**  pprev;
+    uint64_t min_epoch = UINT64_MAX;
+    uint64_t epoch;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (reader = __atomic_load_n(&nfs_rcu_readers, __ATOMIC_ACQUIRE); reader != NULL;
+         reader = reader->next) {
+        epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < min_epoch) {
+            min_epoch = epoch;
+        }
+    }
+    pthread_mutex_lock(&nfs_rcu_lock);
+    pprev = &nfs_rcu_pending;
+    while (*pprev) {
+        node = *pprev;
+        if (node->epoch < min_epoch) {
+            *pprev     = node->next;
+            node->next = to_free;
+            to_free    = node;
+            nfs_rcu_pending_cnt--;
+            nfs_rcu_freed++;
+        }
+        else {
+            pprev = &node->next;
+        }
+    }
+    pthread_mutex_unlock(&nfs_rcu_lock);
+
+    while (to_free) {
+        node    = to_free;
+        to_free = node->next;
+        nfs_rcu_release(node);
+    }
+}
+/**
+ * @brief 延迟释放已摘下的slab对象，直到进入读侧临界区的读者都已退出
+ *
+ * @param slab 对象所属的slab，NULL表示由malloc分配
+ * @param ptr 已不能从目录树中访问到
+ */
+void nfs_rcu_free_to(struct nfs_slab* slab, void* ptr) {
+    struct nfs_rcu_node* node;
+    boolean is_full;
+
+    if (ptr == NULL) {
+        return;
+    }
+    node       = (struct nfs_rcu_node*)malloc(sizeof(struct nfs_rcu_node));
+    node->ptr  = ptr;
+    node->slab = slab;
+    pthread_mutex_lock(&nfs_rcu_lock);
+    node->epoch     = __atomic_fetch_add(&nfs_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+    node->next      = nfs_rcu_pending;
+    nfs_rcu_pending = node;
+    nfs_rcu_deferred++;
+    is_full = ++nfs_rcu_pending_cnt >= NFS_RCU_BATCH;
+    pthread_mutex_unlock(&nfs_rcu_lock);
+    if (is_full) {
+        nfs_rcu_reclaim();
+    }
+}
+/**
+ * @brief 延迟释放由malloc分配的对象
+ *
+ * @param ptr
+ */
+void nfs_rcu_free(void* ptr) {
+    nfs_rcu_free_to(NULL, ptr);
+}
+/**
+ * @brief 释放所有延迟释放的对象，umount时在销毁slab之前调用，此时已没有读者
+ *
+ */
+void nfs_rcu_destroy() {
+    struct nfs_rcu_node* node;
+
+    pthread_mutex_lock(&nfs_rcu_lock);
+    while (nfs_rcu_pending) {
+        node            = nfs_rcu_pending;
+        nfs_rcu_pending = node->next;
+        nfs_rcu_release(node);
+        nfs_rcu_freed++;
+    }
+    nfs_rcu_pending_cnt = 0;
+    pthread_mutex_unlock(&nfs_rcu_lock);
+}
+/**
+ * @brief 记录一次无锁查找的结果，计数在各线程的读者记录中，不争用同一缓存行
+ *
+ * @param is_fallback 是否改走加锁的查找
+ */
+void nfs_rcu_account(boolean is_fallback) {
+    struct nfs_rcu_reader* reader = nfs_rcu_self;
+
+    if (reader == NULL) {
+        reader = nfs_rcu_register();
+    }
+    if (is_fallback) {
+        __atomic_store_n(&reader->fallbacks, reader->fallbacks + 1, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_store_n(&reader->walks, reader->walks + 1, __ATOMIC_RELAXED);
+    }
+}
+/**
+ * @brief 获取无锁查找和延迟释放的统计
+ *
+ * @param stats
+ */
+void nfs_rcu_get_stats(struct nfs_rcu_stats* stats) {
+    struct nfs_rcu_reader* reader;
+
+    memset(stats, 0, sizeof(struct nfs_rcu_stats));
+    for (reader = __atomic_load_n(&nfs_rcu_readers, __ATOMIC_ACQUIRE); reader != NULL;
+         reader = reader->next) {
+        stats->walks     += __atomic_load_n(&reader->walks, __ATOMIC_RELAXED);
+        stats->fallbacks += __atomic_load_n(&reader->fallbacks, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_lock(&nfs_rcu_lock);
+    stats->deferred = nfs_rcu_deferred;
+    stats->freed    = nfs_rcu_freed;
+    pthread_mutex_unlock(&nfs_rcu_lock);
+}
+/**
+ * @brief 开始修改顺序计数保护的数据，调用者已持有对应的锁，计数变为奇数
+ *
+ * @param seq
+ */
+void nfs_seq_write_begin(unsigned* seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void nfs_seq_write_end(unsigned* seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+/**
+ * @brief 无锁读开始时读取顺序计数
+ *
+ * @param seq
+ * @return unsigned 奇数表示正在修改，读者应放弃
+ */
+unsigned nfs_seq_read_begin(const unsigned* seq) {
+    return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+/**
+ * @brief 无锁读之后检查期间是否有修改
+ *
+ * @param seq
+ * @param start nfs_seq_read_begin的返回值
+ * @return boolean TRUE表示读到的内容可能不一致，需要重试或改走加锁的路径
+ */
+boolean nfs_seq_read_retry(const unsigned* seq, unsigned start) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (start & 1) || __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
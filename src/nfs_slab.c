@@ -0,0 +1,133 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/**
+ * @brief 分配一个能放下cnt个对象的块，对象按地址顺序放到空闲链表头部
+ *
+ * 调用者持有slab->lock
+ *
+ * @param slab
+ * @param cnt
+ */
+static void nfs_slab_grow(struct nfs_slab* slab, int cnt) {
+    struct nfs_slab_chunk* chunk;
+    uint8_t* obj;
+    int i;
+
+    chunk = (struct nfs_slab_chunk*)malloc(sizeof(struct nfs_slab_chunk) +
+                                           (size_t)cnt * slab->obj_size);
+    chunk->cnt   = cnt;
+    chunk->next  = slab->chunks;
+    slab->chunks = chunk;
+    obj = (uint8_t*)(chunk + 1) + (size_t)(cnt - 1) * slab->obj_size;
+    for (i = 0; i < cnt; i++) {                       /* 倒序压入，先分配到低地址 */
+        *(void**)obj    = slab->free_list;
+        slab->free_list = obj;
+        obj -= slab->obj_size;
+    }
+    slab->free_cnt       += cnt;
+    slab->stats.objs     += cnt;
+    slab->stats.chunks++;
+    slab->stats.bytes    += sizeof(struct nfs_slab_chunk) + (size_t)cnt * slab->obj_size;
+}
+/**
+ * @brief 初始化一类对象的slab，mount时调用
+ *
+ * @param slab
+ * @param name 统计输出用
+ * @param obj_size
+ */
+void nfs_slab_init(struct nfs_slab* slab, const char* name, int obj_size) {
+    memset(slab, 0, sizeof(struct nfs_slab));
+    pthread_mutex_init(&slab->lock, NULL);
+    slab->name      = name;
+    slab->obj_size  = NFS_ROUND_UP(obj_size, NFS_SLAB_ALIGN);
+    slab->per_chunk = (NFS_SLAB_CHUNK_SZ - (int)sizeof(struct nfs_slab_chunk)) / slab->obj_size;
+    if (slab->per_chunk < 1) {
+        slab->per_chunk = 1;
+    }
+}
+/**
+ * @brief 分配一个清零的对象，空闲链表为空时整块分配
+ *
+ * @param slab
+ * @return void*
+ */
+void* nfs_slab_alloc(struct nfs_slab* slab) {
+    void* obj;
+
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free_list == NULL) {
+        nfs_slab_grow(slab, slab->per_chunk);
+    }
+    obj             = slab->free_list;
+    slab->free_list = *(void**)obj;
+    slab->free_cnt--;
+    slab->stats.active++;
+    pthread_mutex_unlock(&slab->lock);
+    memset(obj, 0, slab->obj_size);
+    return obj;
+}
+/**
+ * @brief 预留cnt个对象，不足的部分一次分配成连续的一块
+ *
+ * 一次生成大量对象（如读入整个目录）前调用，随后的nfs_slab_alloc按地址顺序取出
+ *
+ * @param slab
+ * @param cnt
+ */
+void nfs_slab_reserve(struct nfs_slab* slab, int cnt) {
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free_cnt < cnt) {
+        nfs_slab_grow(slab, cnt - slab->free_cnt);
+    }
+    pthread_mutex_unlock(&slab->lock);
+}
+/**
+ * @brief 归还对象，内存留在slab中供下次分配
+ *
+ * @param slab
+ * @param obj 可以为NULL
+ */
+void nfs_slab_free(struct nfs_slab* slab, void* obj) {
+    if (obj == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&slab->lock);
+    *(void**)obj    = slab->free_list;
+    slab->free_list = obj;
+    slab->free_cnt++;
+    slab->stats.active--;
+    pthread_mutex_unlock(&slab->lock);
+}
+/**
+ * @brief 整块释放slab的所有内存，umount时调用，之后其中的对象都不能再访问
+ *
+ * @param slab
+ */
+void nfs_slab_destroy(struct nfs_slab* slab) {
+    struct nfs_slab_chunk* chunk;
+
+    pthread_mutex_lock(&slab->lock);
+    while (slab->chunks) {
+        chunk        = slab->chunks;
+        slab->chunks = chunk->next;
+        free(chunk);
+    }
+    slab->free_list = NULL;
+    slab->free_cnt  = 0;
+    memset(&slab->stats, 0, sizeof(struct nfs_slab_stats));
+    pthread_mutex_unlock(&slab->lock);
+}
+/**
+ * @brief 获取slab的对象数和字节数
+ *
+ * @param slab
+ * @param stats
+ */
+void nfs_slab_get_stats(struct nfs_slab* slab, struct nfs_slab_stats* stats) {
+    pthread_mutex_lock(&slab->lock);
+    *stats = slab->stats;
+    pthread_mutex_unlock(&slab->lock);
+}
@@ -0,0 +1,487 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/******************************************************************************
+* SECTION: Global Static Var
+*******************************************************************************/
+static struct nfs_rb_node* nfs_space_by_start;        /* 空闲extent按起始块号排序 */
+static struct nfs_rb_node* nfs_space_by_len;          /* 空闲extent按长度排序，最佳适配用 */
+static struct nfs_slab     nfs_space_slab;
+static int                 nfs_space_extents;
+static int                 nfs_space_free_blks;
+/******************************************************************************
+* SECTION: 红黑树
+*******************************************************************************/
+/**
+ * @brief 以x为轴旋转，dir为0时左旋，x的右孩子成为其父节点
+ *
+ * @param root
+ * @param x
+ * @param dir
+ */
+static void nfs_rb_rotate(struct nfs_rb_node** root, struct nfs_rb_node* x, int dir) {
+    struct nfs_rb_node* y = x->child[1 - dir];
+
+    x->child[1 - dir] = y->child[dir];
+    if (y->child[dir] != NULL) {
+        y->child[dir]->parent = x;
+    }
+    y->parent = x->parent;
+    if (x->parent == NULL) {
+        *root = y;
+    }
+    else {
+        x->parent->child[x == x->parent->child[1]] = y;
+    }
+    y->child[dir] = x;
+    x->parent     = y;
+}
+
+static boolean nfs_rb_is_red(struct nfs_rb_node* node) {
+    return node != NULL && node->is_red;
+}
+/**
+ * @brief 把node挂到parent的dir侧后重新着色，parent为NULL时node成为根
+ *
+ * @param root
+ * @param node
+ * @param parent 查找插入位置时停下的节点
+ * @param dir
+ */
+static void nfs_rb_insert(struct nfs_rb_node** root, struct nfs_rb_node* node,
+                          struct nfs_rb_node* parent, int dir) {
+    struct nfs_rb_node* gparent;
+    struct nfs_rb_node* uncle;
+    int side;
+
+    node->parent   = parent;
+    node->child[0] = NULL;
+    node->child[1] = NULL;
+    node->is_red   = TRUE;
+    if (parent == NULL) {
+        *root = node;
+    }
+    else {
+        parent->child[dir] = node;
+    }
+    while ((parent = node->parent) != NULL && parent->is_red) {
+        gparent = parent->parent;                     /* 根为黑，红色节点必有父节点 */
+        side    = parent == gparent->child[1];
+        uncle   = gparent->child[1 - side];
+        if (nfs_rb_is_red(uncle)) {
+            parent->is_red  = FALSE;
+            uncle->is_red   = FALSE;
+            gparent->is_red = TRUE;
+            node = gparent;
+            continue;
+        }
+        if (node == parent->child[1 - side]) {        /* 先转成与parent同侧 */
+            nfs_rb_rotate(root, parent, side);
+            node   = parent;
+            parent = node->parent;
+        }
+        parent->is_red  = FALSE;
+        gparent->is_red = TRUE;
+        nfs_rb_rotate(root, gparent, 1 - side);
+    }
+    (*root)->is_red = FALSE;
+}
+/**
+ * @brief 摘下一个黑色节点后，从其位置child（可能为NULL）向上恢复黑高
+ *
+ * @param root
+ * @param node
+ * @param parent node的父节点
+ */
+static void nfs_rb_erase_fixup(struct nfs_rb_node** root, struct nfs_rb_node* node,
+                               struct nfs_rb_node* parent) {
+    struct nfs_rb_node* sib;
+    int side;
+
+    while (node != *root && !nfs_rb_is_red(node)) {
+        side = node != parent->child[0];              /* 兄弟必不为NULL */
+        sib  = parent->child[1 - side];
+        if (sib->is_red) {
+            sib->is_red    = FALSE;
+            parent->is_red = TRUE;
+            nfs_rb_rotate(root, parent, side);
+            sib = parent->child[1 - side];
+        }
+        if (!nfs_rb_is_red(sib->child[0]) && !nfs_rb_is_red(sib->child[1])) {
+            sib->is_red = TRUE;
+            node   = parent;
+            parent = node->parent;
+            continue;
+        }
+        if (!nfs_rb_is_red(sib->child[1 - side])) {
+            sib->child[side]->is_red = FALSE;
+            sib->is_red = TRUE;
+            nfs_rb_rotate(root, sib, 1 - side);
+            sib = parent->child[1 - side];
+        }
+        sib->is_red    = parent->is_red;
+        parent->is_red = FALSE;
+        sib->child[1 - side]->is_red = FALSE;
+        nfs_rb_rotate(root, parent, side);
+        node = *root;
+    }
+    if (node != NULL) {
+        node->is_red = FALSE;
+    }
+}
+/**
+ * @brief 在old的父节点中用node替换old
+ *
+ * @param root
+ * @param old
+ * @param node 可以为NULL
+ */
+static void nfs_rb_replace(struct nfs_rb_node** root, struct nfs_rb_node* old,
+                           struct nfs_rb_node* node) {
+    if (old->parent == NULL) {
+        *root = node;
+    }
+    else {
+        old->parent->child[old == old->parent->child[1]] = node;
+    }
+}
+/**
+ * @brief 从树中摘下node，有两个孩子时由其后继顶替位置
+ *
+ * @param root
+ * @param node
+ */
+static void nfs_rb_erase(struct nfs_rb_node** root, struct nfs_rb_node* node) {
+    struct nfs_rb_node* child;
+    struct nfs_rb_node* parent;
+    struct nfs_rb_node* succ;
+    boolean is_red;
+
+    if (node->child[0] != NULL && node->child[1] != NULL) {
+        succ = node->child[1];
+        while (succ->child[0] != NULL) {
+            succ = succ->child[0];
+        }
+        child  = succ->child[1];                      /* 实际摘下的是succ原来的位置 */
+        parent = succ->parent;
+        is_red = succ->is_red;
+        if (parent == node) {
+            parent = succ;
+        }
+        else {
+            if (child != NULL) {
+                child->parent = parent;
+            }
+            parent->child[0] = child;
+            succ->child[1]   = node->child[1];
+            node->child[1]->parent = succ;
+        }
+        succ->child[0] = node->child[0];
+        node->child[0]->parent = succ;
+        succ->parent = node->parent;
+        succ->is_red = node->is_red;
+        nfs_rb_replace(root, node, succ);
+    }
+    else {
+        child  = node->child[0] != NULL ? node->child[0] : node->child[1];
+        parent = node->parent;
+        is_red = node->is_red;
+        if (child != NULL) {
+            child->parent = parent;
+        }
+        nfs_rb_replace(root, node, child);
+    }
+    if (!is_red) {
+        nfs_rb_erase_fixup(root, child, parent);
+    }
+}
+/******************************************************************************
+* SECTION: 空闲extent索引
+*******************************************************************************/
+#define NFS_EXT_OF_START(node)  NFS_RB_ENTRY(node, struct nfs_free_extent, by_start)
+#define NFS_EXT_OF_LEN(node)    NFS_RB_ENTRY(node, struct nfs_free_extent, by_len)
+
+static void nfs_space_insert_len(struct nfs_free_extent* ext) {
+    struct nfs_rb_node*     parent = NULL;
+    struct nfs_rb_node*     cur    = nfs_space_by_len;
+    struct nfs_free_extent* other;
+    int dir = 0;
+
+    while (cur != NULL) {
+        parent = cur;
+        other  = NFS_EXT_OF_LEN(cur);
+        dir    = ext->len > other->len || (ext->len == other->len && ext->start > other->start);
+        cur    = cur->child[dir];
+    }
+    nfs_rb_insert(&nfs_space_by_len, &ext->by_len, parent, dir);
+}
+
+static void nfs_space_insert_start(struct nfs_free_extent* ext) {
+    struct nfs_rb_node* parent = NULL;
+    struct nfs_rb_node* cur    = nfs_space_by_start;
+    int dir = 0;
+
+    while (cur != NULL) {
+        parent = cur;
+        dir    = ext->start > NFS_EXT_OF_START(cur)->start;
+        cur    = cur->child[dir];
+    }
+    nfs_rb_insert(&nfs_space_by_start, &ext->by_start, parent, dir);
+}
+/**
+ * @brief 新建一段空闲extent并加入两棵树
+ *
+ * @param start
+ * @param len
+ */
+static void nfs_space_add(int start, int len) {
+    struct nfs_free_extent* ext;
+
+    ext = (struct nfs_free_extent*)nfs_slab_alloc(&nfs_space_slab);
+    ext->start = start;
+    ext->len   = len;
+    nfs_space_insert_start(ext);
+    nfs_space_insert_len(ext);
+    nfs_space_extents++;
+}
+
+static void nfs_space_remove(struct nfs_free_extent* ext) {
+    nfs_rb_erase(&nfs_space_by_start, &ext->by_start);
+    nfs_rb_erase(&nfs_space_by_len, &ext->by_len);
+    nfs_slab_free(&nfs_space_slab, ext);
+    nfs_space_extents--;
+}
+/**
+ * @brief 修改extent的范围，不改变它与相邻extent的先后，只需在长度树中重新排序
+ *
+ * @param ext
+ * @param start
+ * @param len 为0时删除
+ */
+static void nfs_space_resize(struct nfs_free_extent* ext, int start, int len) {
+    if (len == 0) {
+        nfs_space_remove(ext);
+        return;
+    }
+    nfs_rb_erase(&nfs_space_by_len, &ext->by_len);
+    ext->start = start;
+    ext->len   = len;
+    nfs_space_insert_len(ext);
+}
+/**
+ * @brief 起始块号不大于dat的最后一个extent
+ *
+ * @param dat
+ * @return struct nfs_free_extent* 没有返回NULL
+ */
+static struct nfs_free_extent* nfs_space_floor(int dat) {
+    struct nfs_rb_node* cur  = nfs_space_by_start;
+    struct nfs_rb_node* best = NULL;
+
+    while (cur != NULL) {
+        if (NFS_EXT_OF_START(cur)->start <= dat) {
+            best = cur;
+            cur  = cur->child[1];
+        }
+        else {
+            cur = cur->child[0];
+        }
+    }
+    return best ? NFS_EXT_OF_START(best) : NULL;
+}
+/**
+ * @brief 起始块号大于dat的第一个extent
+ *
+ * @param dat
+ * @return struct nfs_free_extent* 没有返回NULL
+ */
+static struct nfs_free_extent* nfs_space_next(int dat) {
+    struct nfs_rb_node* cur  = nfs_space_by_start;
+    struct nfs_rb_node* best = NULL;
+
+    while (cur != NULL) {
+        if (NFS_EXT_OF_START(cur)->start > dat) {
+            best = cur;
+            cur  = cur->child[0];
+        }
+        else {
+            cur = cur->child[1];
+        }
+    }
+    return best ? NFS_EXT_OF_START(best) : NULL;
+}
+/**
+ * @brief 长度不小于len的extent中最短的，等长时取起始块号最小的
+ *
+ * @param len
+ * @return struct nfs_free_extent* 没有返回NULL
+ */
+static struct nfs_free_extent* nfs_space_best_fit(int len) {
+    struct nfs_rb_node* cur  = nfs_space_by_len;
+    struct nfs_rb_node* best = NULL;
+
+    while (cur != NULL) {
+        if (NFS_EXT_OF_LEN(cur)->len >= len) {
+            best = cur;
+            cur  = cur->child[0];
+        }
+        else {
+            cur = cur->child[1];
+        }
+    }
+    return best ? NFS_EXT_OF_LEN(best) : NULL;
+}
+
+static struct nfs_free_extent* nfs_space_largest() {
+    struct nfs_rb_node* cur = nfs_space_by_len;
+
+    if (cur == NULL) {
+        return NULL;
+    }
+    while (cur->child[1] != NULL) {
+        cur = cur->child[1];
+    }
+    return NFS_EXT_OF_LEN(cur);
+}
+/**
+ * @brief 由数据位图建立空闲extent索引，位图已读入，mount时调用
+ *
+ * 每组的空闲块各自成段，相邻两组的数据区在磁盘上不连续
+ *
+ */
+void nfs_space_init() {
+    int group, end, bit, run_end;
+
+    nfs_slab_init(&nfs_space_slab, "free extent", sizeof(struct nfs_free_extent));
+    nfs_space_by_start  = NULL;
+    nfs_space_by_len    = NULL;
+    nfs_space_extents   = 0;
+    nfs_space_free_blks = 0;
+    for (group = 0; group < nfs_super.group_cnt; group++) {
+        end = NFS_GROUP_FIRST_DATA(group + 1) < nfs_super.max_data ?
+              NFS_GROUP_FIRST_DATA(group + 1) : nfs_super.max_data;
+        bit = nfs_bitmap_find_zero(nfs_super.map_data, end, NFS_GROUP_FIRST_DATA(group));
+        while (bit >= 0) {
+            run_end = nfs_bitmap_find_one(nfs_super.map_data, end, bit);
+            nfs_space_add(bit, run_end - bit);
+            nfs_space_free_blks += run_end - bit;
+            bit = nfs_bitmap_find_zero(nfs_super.map_data, end, run_end);
+        }
+    }
+    NFS_DBG("[%s] %d free blocks in %d extents\n", __func__, nfs_space_free_blks,
+            nfs_space_extents);
+}
+/**
+ * @brief 分配至多want个连续数据块，不修改位图，调用者持有alloc_lock
+ *
+ * 依次尝试：从goal起（goal空闲时），goal所在组中goal之后的第一段，全局最佳适配，
+ * 最长的一段（不足want块）
+ *
+ * @param goal 期望的起始块号，-1表示不限
+ * @param want
+ * @param got 实际分配的块数
+ * @return int 起始数据块号，无空间返回-1
+ */
+int nfs_space_alloc(int goal, int want, int* got) {
+    struct nfs_free_extent* ext = NULL;
+    int start, end, len;
+
+    if (goal >= 0 && goal < nfs_super.max_data) {
+        ext = nfs_space_floor(goal);
+        if (ext != NULL && goal < ext->start + ext->len) {
+            end = ext->start + ext->len;
+            len = end - goal < want ? end - goal : want;
+            if (goal + len < end) {                   /* goal之后还有剩余，拆出新的一段 */
+                nfs_space_add(goal + len, end - goal - len);
+            }
+            nfs_space_resize(ext, ext->start, goal - ext->start);
+            nfs_space_free_blks -= len;
+            *got = len;
+            return goal;
+        }
+        ext = nfs_space_next(goal);
+        if (ext != NULL && (NFS_DATA_GROUP(ext->start) != NFS_DATA_GROUP(goal) || ext->len < want)) {
+            ext = NULL;
+        }
+    }
+    if (ext == NULL) {
+        ext = nfs_space_best_fit(want);
+    }
+    if (ext == NULL) {
+        ext = nfs_space_largest();
+    }
+    if (ext == NULL) {
+        return -1;
+    }
+    start = ext->start;
+    len   = ext->len < want ? ext->len : want;
+    nfs_space_resize(ext, start + len, ext->len - len);
+    nfs_space_free_blks -= len;
+    *got = len;
+    return start;
+}
+/**
+ * @brief 归还[start, start + len)，与同组中相邻的空闲段合并，调用者持有alloc_lock
+ *
+ * @param start
+ * @param len 不跨块组
+ */
+void nfs_space_free(int start, int len) {
+    struct nfs_free_extent* prev = nfs_space_floor(start);
+    struct nfs_free_extent* next = nfs_space_next(start);
+    int group = NFS_DATA_GROUP(start);
+
+    nfs_space_free_blks += len;
+
+    if (prev != NULL && (prev->start + prev->len != start || NFS_DATA_GROUP(prev->start) != group)) {
+        prev = NULL;
+    }
+    if (next != NULL && (start + len != next->start || NFS_DATA_GROUP(next->start) != group)) {
+        next = NULL;
+    }
+    if (prev != NULL && next != NULL) {
+        len += next->len;
+        nfs_space_remove(next);
+        nfs_space_resize(prev, prev->start, prev->len + len);
+    }
+    else if (prev != NULL) {
+        nfs_space_resize(prev, prev->start, prev->len + len);
+    }
+    else if (next != NULL) {
+        nfs_space_resize(next, start, next->len + len);
+    }
+    else {
+        nfs_space_add(start, len);
+    }
+}
+/**
+ * @brief 释放索引，umount时调用
+ *
+ */
+void nfs_space_destroy() {
+    nfs_slab_destroy(&nfs_space_slab);
+    nfs_space_by_start = NULL;
+    nfs_space_by_len   = NULL;
+    nfs_space_extents  = 0;
+}
+/**
+ * @brief 空闲数据块数，调用者持有alloc_lock
+ *
+ * @return int
+ */
+int nfs_space_free_cnt() {
+    return nfs_space_free_blks;
+}
+/**
+ * @brief 获取空闲extent的统计，调用者持有alloc_lock
+ *
+ * @param stats
+ */
+void nfs_space_get_stats(struct nfs_space_stats* stats) {
+    struct nfs_free_extent* largest = nfs_space_largest();
+
+    stats->extents   = nfs_space_extents;
+    stats->free_blks = nfs_space_free_blks;
+    stats->max_len   = largest ? largest->len : 0;
+}
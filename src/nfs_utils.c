@@ -38,149 +38,319 @@ int nfs_calc_lvl(const char * path) {
     return lvl;
 }
 /**
- * @brief 驱动读
+ * @brief 取出路径中的下一级文件名，代替strtok，不必复制整条路径
+ * 
+ * @param path 
+ * @param fname 输出，NFS_MAX_FILE_NAME字节
+ * @return const char* fname之后的位置，没有下一级或文件名过长返回NULL
+ */
+const char* nfs_next_fname(const char* path, char* fname) {
+    int len;
+    while (*path == '/') {
+        path++;
+    }
+    len = strcspn(path, "/");
+    if (len == 0 || len >= NFS_MAX_FILE_NAME) {
+        return NULL;
+    }
+    memcpy(fname, path, len);
+    fname[len] = '\0';
+    return path + len;
+}
+/**
+ * @brief 计算CRC32（IEEE 802.3多项式，与zlib一致），按半字节查表
+ * 
+ * @param buf 
+ * @param size 
+ * @return uint32_t 
+ */
+uint32_t nfs_crc32(const uint8_t* buf, int size) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    uint32_t crc = 0xFFFFFFFF;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        crc ^= buf[i];
+        crc  = (crc >> 4) ^ table[crc & 0xF];
+        crc  = (crc >> 4) ^ table[crc & 0xF];
+    }
+    return ~crc;
+}
+/**
+ * @brief 设备读，offset和size须按IO单元对齐
+ * 
+ * @param offset 
+ * @param out_content 
+ * @param size 
+ * @return int 
+ */
+int nfs_dev_read(long offset, uint8_t *out_content, int size) {
+    return nfs_super.backend->read(offset, out_content, size);
+}
+/**
+ * @brief 设备写，offset和size须按IO单元对齐
+ * 
+ * @param offset 
+ * @param in_content 
+ * @param size 
+ * @return int 
+ */
+int nfs_dev_write(long offset, uint8_t *in_content, int size) {
+    return nfs_super.backend->write(offset, in_content, size);
+}
+/**
+ * @brief 驱动读，启用块缓存时经由缓存读取
  * 
  * @param offset 
  * @param out_content 
  * @param size 
  * @return int 
  */
-int nfs_driver_read(int offset, uint8_t *out_content, int size) {
-    int      offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
+int nfs_driver_read(long offset, uint8_t *out_content, int size) {
+    long     offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = NFS_ROUND_UP((size + bias), NFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(nfs_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(nfs_DRIVER(), cur, nfs_IO_SZ());
-        ddriver_read(NFS_DRIVER(), (char*)cur, NFS_IO_SZ());
-        cur          += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();   
+    int      blkno          = offset_aligned / NFS_IO_SZ();
+    int      copy_sz;
+    uint8_t* temp_content;
+    struct nfs_cache_blk* blk;
+
+    if (nfs_cache_enabled()) {
+        nfs_cache_lock();
+        if (size_aligned > NFS_IO_SZ()) {             /* 未缓存的连续块一次读入 */
+            nfs_cache_prefetch(blkno, size_aligned / NFS_IO_SZ());
+        }
+        while (size != 0)
+        {
+            blk = nfs_cache_get(blkno);
+            if (blk == NULL) {
+                nfs_cache_unlock();
+                return -NFS_ERROR_IO;
+            }
+            copy_sz = NFS_IO_SZ() - bias < size ? NFS_IO_SZ() - bias : size;
+            nfs_cache_unlock();                       /* 块已钉住，复制时不持缓存锁 */
+            memcpy(out_content, blk->data + bias, copy_sz);
+            nfs_cache_lock();
+            nfs_cache_put(blk);
+            out_content += copy_sz;
+            size        -= copy_sz;
+            bias         = 0;
+            blkno++;
+        }
+        nfs_cache_unlock();
+        return NFS_ERROR_NONE;
+    }
+
+    if (nfs_iobatch_barrier(offset_aligned, size_aligned) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    if (bias == 0 && size == size_aligned) {          /* 整单元读直接读入调用者的缓冲区 */
+        return nfs_dev_read(offset_aligned, out_content, size);
+    }
+    temp_content = (uint8_t*)malloc(size_aligned);
+    if (nfs_dev_read(offset_aligned, temp_content, size_aligned) != NFS_ERROR_NONE) {
+        free(temp_content);
+        return -NFS_ERROR_IO;
     }
     memcpy(out_content, temp_content + bias, size);
     free(temp_content);
     return NFS_ERROR_NONE;
 }
 /**
- * @brief 驱动写
+ * @brief 驱动写，启用块缓存时只修改缓存块并标脏
+ * 
+ * 完整覆盖的IO单元不预读；只有首尾未写满的单元需要先读出（read-modify-write）
  * 
  * @param offset 
  * @param in_content 
  * @param size 
  * @return int 
  */
-int nfs_driver_write(int offset, uint8_t *in_content, int size) {
-    int      offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
+int nfs_driver_write(long offset, uint8_t *in_content, int size) {
+    long     offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = NFS_ROUND_UP((size + bias), NFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    nfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
-    
-    // lseek(nfs_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(nfs_DRIVER(), cur, nfs_IO_SZ());
-        ddriver_write(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur          += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();   
+    int      blkno          = offset_aligned / NFS_IO_SZ();
+    int      tail           = size_aligned - NFS_IO_SZ();
+    int      copy_sz;
+    int      pre_read       = 0;
+    uint8_t* temp_content;
+    struct nfs_cache_blk* blk;
+
+    if (nfs_cache_enabled()) {
+        nfs_cache_lock();
+        while (size != 0)
+        {
+            copy_sz = NFS_IO_SZ() - bias < size ? NFS_IO_SZ() - bias : size;
+            if (copy_sz == NFS_IO_SZ()) {
+                blk = nfs_cache_overwrite(blkno);
+            }
+            else {
+                blk = nfs_cache_modify(blkno);
+            }
+            if (blk == NULL) {
+                nfs_cache_unlock();
+                return -NFS_ERROR_IO;
+            }
+            nfs_cache_unlock();                       /* 块已钉住，复制时不持缓存锁 */
+            memcpy(blk->data + bias, in_content, copy_sz);
+            nfs_cache_lock();
+            nfs_cache_mark_dirty(blk);
+            nfs_cache_put(blk);
+            in_content += copy_sz;
+            size       -= copy_sz;
+            bias        = 0;
+            blkno++;
+        }
+        nfs_cache_unlock();
+        return NFS_ERROR_NONE;
+    }
+
+    if (nfs_iobatch_barrier(offset_aligned, size_aligned) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    if (bias == 0 && size == size_aligned) {          /* 整单元写，直接写调用者的缓冲区 */
+        NFS_STAT_ADD(nfs_super.rmw_saved, size);
+        if (nfs_iobatch_active()) {
+            temp_content = (uint8_t*)malloc(size);
+            memcpy(temp_content, in_content, size);
+            return nfs_iobatch_add(offset_aligned, temp_content, size);
+        }
+        return nfs_dev_write(offset_aligned, in_content, size);
     }
 
+    temp_content = (uint8_t*)malloc(size_aligned);
+    if (bias != 0) {                                  /* 只预读首尾两个单元 */
+        if (nfs_dev_read(offset_aligned, temp_content, NFS_IO_SZ()) != NFS_ERROR_NONE) {
+            free(temp_content);
+            return -NFS_ERROR_IO;
+        }
+        pre_read += NFS_IO_SZ();
+    }
+    if ((bias + size) % NFS_IO_SZ() != 0 && !(tail == 0 && bias != 0)) {
+        if (nfs_dev_read(offset_aligned + tail, temp_content + tail, 
+                         NFS_IO_SZ()) != NFS_ERROR_NONE) {
+            free(temp_content);
+            return -NFS_ERROR_IO;
+        }
+        pre_read += NFS_IO_SZ();
+    }
+    NFS_STAT_ADD(nfs_super.rmw_reads, pre_read);
+    NFS_STAT_ADD(nfs_super.rmw_saved, size_aligned - pre_read);
+    memcpy(temp_content + bias, in_content, size);
+    if (nfs_iobatch_active()) {                       /* 写回过程中只排队，结束时合并提交 */
+        return nfs_iobatch_add(offset_aligned, temp_content, size_aligned);
+    }
+    if (nfs_dev_write(offset_aligned, temp_content, size_aligned) != NFS_ERROR_NONE) {
+        free(temp_content);
+        return -NFS_ERROR_IO;
+    }
     free(temp_content);
     return NFS_ERROR_NONE;
 }
+/**
+ * @brief 从dentry slab中分配一个dentry，文件名存入父目录的文件名区
+ * 
+ * @param parent 父目录inode，调用者持有其写锁；NULL表示根目录，直接引用fname
+ * @param fname 
+ * @param ftype 
+ * @return struct nfs_dentry* 
+ */
+struct nfs_dentry* new_dentry(struct nfs_inode* parent, const char * fname, NFS_FILE_TYPE ftype) {
+    struct nfs_dentry * dentry = (struct nfs_dentry *)nfs_slab_alloc(&nfs_super.dentry_slab);
+    dentry->fname    = parent ? nfs_dir_name_alloc(parent, fname) : fname;
+    dentry->name_len = strlen(fname);
+    dentry->ftype    = ftype;
+    dentry->ino      = -1;
+    dentry->dat      = -1;
+    return dentry;
+}
 /**
  * @brief 为一个inode分配dentry，采用头插法
  * 
- * @param inode 
+ * 调用者已用nfs_dir_reserve为它预留了写回时的桶块，目录也已随之完整读入
+ * 
+ * @param inode 目录inode，调用者持有其写锁
  * @param dentry 
- * @return int 
+ * @return int 目录读不出时返回-NFS_ERROR_IO，不做修改
  */
 int nfs_alloc_dentry(struct nfs_inode* inode, struct nfs_dentry* dentry) {
-    if (inode->dentrys == NULL) {
-        inode->dentrys = dentry;
-    }
-    else {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+    if (nfs_dir_load(inode) != NFS_ERROR_NONE) {     /* 修改前须完整读入目录，否则无法写回 */
+        return -NFS_ERROR_IO;
     }
+    nfs_dir_attach(inode, dentry);
     inode->dir_cnt++;
+    inode->dir_version++;
+    nfs_mark_dirty(inode, NFS_INODE_DIRTY_META | NFS_INODE_DIRTY_DENTRY);
     return inode->dir_cnt;
 }
 /**
- * @brief 将dentry从inode的dentrys中取出
+ * @brief 将dentry从目录的内存结构中摘下，不要求目录已完整读入
  * 
- * @param inode 
+ * @param inode 目录inode，调用者持有其写锁
  * @param dentry 
  * @return int 
  */
-int nfs_drop_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry) {
-    boolean is_find = FALSE;
-    struct nfs_dentry* dentry_cursor;
-    dentry_cursor = inode->dentrys;
-    
-    if (dentry_cursor == dentry) {
-        inode->dentrys = dentry->brother;
-        is_find = TRUE;
-    }
-    else {
-        while (dentry_cursor)
-        {
-            if (dentry_cursor->brother == dentry) {
-                dentry_cursor->brother = dentry->brother;
-                is_find = TRUE;
-                break;
-            }
-            dentry_cursor = dentry_cursor->brother;
-        }
-    }
-    if (!is_find) {
+static int nfs_detach_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry) {
+    if (dentry->pprev == NULL) {
         return -NFS_ERROR_NOTFOUND;
     }
+    *dentry->pprev = dentry->brother;                 /* 经由pprev摘下，不必遍历兄弟链表 */
+    if (dentry->brother != NULL) {
+        dentry->brother->pprev = dentry->pprev;
+    }
+    dentry->pprev = NULL;                             /* brother保留，调用者可继续遍历 */
+    nfs_dir_detach(inode, dentry);
     inode->dir_cnt--;
+    inode->dir_version++;
     return inode->dir_cnt;
 }
 /**
- * @brief 分配一个inode，占用位图
+ * @brief 将dentry从inode的dentrys中取出
+ * 
+ * @param inode 目录inode，调用者持有其写锁
+ * @param dentry 
+ * @return int 目录读不出时返回-NFS_ERROR_IO，不做修改
+ */
+int nfs_drop_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry) {
+    int ret;
+
+    if (nfs_dir_load(inode) != NFS_ERROR_NONE) {     /* 修改前须完整读入目录，否则无法写回 */
+        return -NFS_ERROR_IO;
+    }
+    ret = nfs_detach_dentry(inode, dentry);
+    if (ret >= 0) {
+        nfs_mark_dirty(inode, NFS_INODE_DIRTY_META | NFS_INODE_DIRTY_DENTRY);
+    }
+    return ret;
+}
+/**
+ * @brief 分配一个inode，占用位图；数据块在首次写回时才分配
  * 
- * @param dentry 该dentry指向分配的inode
+ * @param dentry 该dentry指向分配的inode，parent须已设置，调用者持有父目录的写锁
  * @return nfs_inode
  */
 struct nfs_inode* nfs_alloc_inode(struct nfs_dentry * dentry) {
     struct nfs_inode* inode;
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find_free_entry = FALSE;
+    int parent_ino = dentry->parent ? dentry->parent->inode->ino : -1;
+    int ino_cursor;
 
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_inode_blks); 
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((nfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                nfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry) {
-            break;
-        }
+    NFS_ALLOC_LOCK();
+    ino_cursor = nfs_group_alloc_inode(parent_ino, dentry->ftype == NFS_DIR);
+    if (ino_cursor >= 0) {
+        nfs_super.is_map_dirty = TRUE;
     }
-    
-
-    if (!is_find_free_entry || ino_cursor == nfs_super.max_ino)
+    NFS_ALLOC_UNLOCK();
+    if (ino_cursor < 0)
         return NULL;
         // return -nfs_ERROR_NOSPACE;
 
-    inode = (struct nfs_inode*)malloc(sizeof(struct nfs_inode));
+    inode = (struct nfs_inode*)nfs_slab_alloc(&nfs_super.inode_slab);
+    pthread_rwlock_init(&inode->lock, NULL);
+    NFS_INODE_WRLOCK(inode);                          /* 加入脏链表和数据LRU后即对其他线程可见 */
     inode->ino  = ino_cursor; 
     inode->size = 0;
                                                       /* dentry指向inode */
@@ -191,122 +361,387 @@ struct nfs_inode* nfs_alloc_inode(struct nfs_dentry * dentry) {
     
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
+    inode->ext_blk = -1;
+    inode->is_loaded = TRUE;                          /* 新建目录没有磁盘目录项 */
     
-    if (NFS_IS_REG(inode)) {
-        inode->data = (uint8_t *)malloc(NFS_BLKS_SZ(NFS_DATA_PER_FILE));
-        nfs_alloc_datamap(inode);
+    if (NFS_IS_REG(inode)) {                          /* 新文件无需从磁盘读入 */
+        nfs_data_attach(inode, (uint8_t *)calloc(1, 1), 1);
     }
+    nfs_mark_dirty(inode, NFS_INODE_DIRTY_ALL);       /* 新inode须整体写回 */
+    NFS_INODE_UNLOCK(inode);
 
     return inode;
 }
+/**
+ * @brief 分配至多want个连续的数据块，优先从goal开始
+ * 
+ * 未预留的分配不能占用各文件已预留的块
+ * 
+ * @param goal 期望的起始数据块号
+ * @param want
+ * @param got 实际分配的块数
+ * @param is_reserved 是否为此前nfs_reserve_data预留的块，由调用者随后归还预留
+ * @return int 起始数据块号，无空间返回-1
+ */
+int nfs_alloc_data_run(int goal, int want, int* got, boolean is_reserved) {
+    int avail;
+    int dat = -1;
 
-void nfs_alloc_datamap(struct nfs_inode* inode) {
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int dat_cursor  = 0;
-    boolean is_done = FALSE;
+    NFS_ALLOC_LOCK();
+    avail = nfs_space_free_cnt() - nfs_super.rsv_data;
+    if (!is_reserved && want > avail) {
+        want = avail;
+    }
+    if (want > 0) {
+        dat = nfs_group_alloc_data(goal, want, got);
+    }
+    if (dat >= 0) {
+        nfs_super.is_map_dirty = TRUE;
+    }
+    NFS_ALLOC_UNLOCK();
+    return dat;
+}
+/**
+ * @brief 释放连续的数据块
+ * 
+ * @param dat 
+ * @param cnt 由同一次nfs_alloc_data_run分配或位于同一extent中
+ */
+void nfs_free_data_run(int dat, int cnt) {
+    if (dat < 0 || dat + cnt > nfs_super.max_data || cnt <= 0) {
+        return;
+    }
+    NFS_ALLOC_LOCK();
+    nfs_group_free_data(dat, cnt);
+    nfs_super.is_map_dirty = TRUE;
+    NFS_ALLOC_UNLOCK();
+}
 
-    
-        for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_data_blks); byte_cursor++) {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
+void nfs_free_data_blk(int dat) {
+    nfs_free_data_run(dat, 1);
+}
+/**
+ * @brief 预留cnt个数据块，只计数，不占用位图
+ * 
+ * @param cnt 
+ * @return int 空闲块不足时返回-NFS_ERROR_NOSPACE
+ */
+int nfs_reserve_data(int cnt) {
+    int ret = NFS_ERROR_NONE;
+
+    NFS_ALLOC_LOCK();
+    if (nfs_space_free_cnt() - nfs_super.rsv_data < cnt) {
+        ret = -NFS_ERROR_NOSPACE;
+    }
+    else {
+        nfs_super.rsv_data += cnt;
+    }
+    NFS_ALLOC_UNLOCK();
+    return ret;
+}
 
-                if((nfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                    nfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
+void nfs_release_data(int cnt) {
+    NFS_ALLOC_LOCK();
+    nfs_super.rsv_data -= cnt;
+    NFS_ALLOC_UNLOCK();
+}
+/**
+ * @brief 预留的块最坏情况下各成一个extent，可能用尽内联extent时为溢出块再预留一块，
+ * 不再需要时归还；溢出块由nfs_extent_append取用
+ * 
+ * @param inode 调用者持有其写锁
+ * @return int 
+ */
+static int nfs_reserve_meta(struct nfs_inode* inode) {
+    boolean is_needed = inode->ext_overflow == NULL &&
+                        inode->ext_cnt + inode->rsv_blks > NFS_INLINE_EXTENTS;
 
-                    inode->dat = dat_cursor;
-                    is_done = TRUE;           
-                    break;
-                }
-                dat_cursor++;
-            }
-            if (is_done) {
-                break;
-            }
+    if (is_needed && !inode->rsv_meta) {
+        if (nfs_reserve_data(1) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_NOSPACE;
         }
+        inode->rsv_meta = TRUE;
+    }
+    else if (!is_needed && inode->rsv_meta) {
+        nfs_release_data(1);
+        inode->rsv_meta = FALSE;
+    }
+    return NFS_ERROR_NONE;
 }
-void nfs_alloc_datamap2(struct nfs_dentry* dentry) {
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int dat_cursor  = 0;
-    boolean is_done = FALSE;
+/**
+ * @brief 预留块使inode已映射和已预留的块合计不少于blks，连同可能需要的溢出块
+ * 
+ * 写回时需要的块都在这里预留，写回不会因空间不足而失败
+ * 
+ * @param inode 调用者持有其写锁
+ * @param blks 
+ * @return int 空闲块不足时返回-NFS_ERROR_NOSPACE，预留不变
+ */
+int nfs_reserve_blks(struct nfs_inode* inode, int blks) {
+    int more = blks - inode->blk_cnt - inode->rsv_blks;
 
-    
-        for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_data_blks); byte_cursor++) {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
+    if (more <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    if (nfs_reserve_data(more) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->rsv_blks += more;
+    if (nfs_reserve_meta(inode) != NFS_ERROR_NONE) {
+        nfs_release_data(more);
+        inode->rsv_blks -= more;
+        return -NFS_ERROR_NOSPACE;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 保证普通文件的内存缓冲区能容纳size字节，新增的块只预留，写回时才分配
+ * 
+ * 没有数据块的文件不超过NFS_INODE_INLINE_SZ时不预留
+ * @param inode 数据须已读入，调用者持有其写锁
+ * @param size 
+ * @return int 
+ */
+int nfs_resize_data(struct nfs_inode* inode, int size) {
+    int old_blks = inode->blk_cnt + inode->rsv_blks;
+    int blks     = NFS_ROUND_UP(size, NFS_BLKS_SZ(1)) / NFS_BLKS_SZ(1);
+    int old_sz   = NFS_BLKS_SZ(old_blks) > inode->size ? NFS_BLKS_SZ(old_blks) : inode->size;
+    int new_sz;
 
-                if((nfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                    nfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
+    if (old_blks == 0 && size <= NFS_INODE_INLINE_SZ) {
+        blks = 0;                                     /* 写回时内联在inode记录中，无需预留 */
+    }
+    new_sz = NFS_BLKS_SZ(blks) > size ? NFS_BLKS_SZ(blks) : size;
+    if (new_sz <= old_sz) {
+        return NFS_ERROR_NONE;
+    }
+    if (nfs_reserve_blks(inode, blks) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (new_sz > inode->data_cap) {
+        inode->data = (uint8_t *)realloc(inode->data, new_sz);
+        nfs_data_resize(inode, new_sz);
+    }
+    memset(inode->data + old_sz, 0, new_sz - old_sz); /* 内联的内容不足一块，保留在缓冲区开头 */
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 把普通文件缩减到blks块，先归还尚未分配的预留块，再释放已映射的块
+ * 
+ * @param inode 调用者持有其写锁
+ * @param blks 
+ */
+void nfs_shrink_data(struct nfs_inode* inode, int blks) {
+    int drop = inode->blk_cnt + inode->rsv_blks - blks;
 
-                    dentry->dat = dat_cursor;
-                    is_done = TRUE;           
-                    break;
-                }
-                dat_cursor++;
-            }
-            if (is_done) {
-                break;
-            }
-        }
+    if (drop > inode->rsv_blks) {
+        drop = inode->rsv_blks;
+    }
+    if (drop > 0) {
+        nfs_release_data(drop);
+        inode->rsv_blks -= drop;
+    }
+    nfs_extent_shrink(inode, blks);
+    nfs_reserve_meta(inode);                          /* 只会归还 */
 }
+/**
+ * @brief 写回前用预留的块映射到blks块，一次请求全部所缺的块，文件尽量连续
+ * 
+ * @param inode 调用者持有其写锁
+ * @param blks 不超过已映射和已预留的块数之和
+ * @return int 
+ */
+int nfs_map_data(struct nfs_inode* inode, int blks) {
+    int old_blks = inode->blk_cnt;
+    int ret;
 
+    if (blks <= old_blks) {
+        return NFS_ERROR_NONE;
+    }
+    if (blks > old_blks + inode->rsv_blks) {
+        return -NFS_ERROR_NOSPACE;                    /* 未预留 */
+    }
+    ret = nfs_extent_grow(inode, blks, TRUE);
+    nfs_release_data(inode->blk_cnt - old_blks);      /* 失败时已分配的部分同样不再预留 */
+    inode->rsv_blks -= inode->blk_cnt - old_blks;
+    nfs_reserve_meta(inode);
+    return ret;
+}
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 写回较长的软链接目标，放在软链接的首个数据块，该块在创建时预留
  * 
  * @param inode 
  * @return int 
  */
+static int nfs_sync_symlink(struct nfs_inode * inode) {
+    uint8_t* buf;
+    int ret;
+
+    if (nfs_map_data(inode, 1) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    buf = (uint8_t*)calloc(1, NFS_BLKS_SZ(1));
+    memcpy(buf, inode->target_path, inode->size);
+    ret = nfs_extent_sync(inode, buf, NFS_BLKS_SZ(1));
+    free(buf);
+    return ret;
+}
+/**
+ * @brief 按脏标记写回一个inode，不向下递归，写回后移出脏链表
+ * 
+ * 目录写回哈希桶块，普通文件写回数据块，最后写inode本身。inode记录与同一块中的
+ * 其他记录共享IO单元，持itable_lock读-改-写；启用块缓存时只修改缓存块，
+ * 同一块中的多个inode随缓存刷写一起写出
+ * 
+ * @param inode 调用者持有其写锁
+ * @return int 
+ */
 int nfs_sync_inode(struct nfs_inode * inode) {
-    struct nfs_inode_d  inode_d;
-    struct nfs_dentry*  dentry_cursor;
-    struct nfs_dentry_d dentry_d;
+    struct nfs_inode_d inode_d;
     int ino             = inode->ino;
+    int ret;
+
+    if (inode->flags == 0) {
+        return NFS_ERROR_NONE;
+    }
+    if (NFS_IS_DIR(inode) && inode->is_loaded &&      /* 目录项按哈希桶写回，桶数随dir_cnt变化 */
+        (inode->flags & NFS_INODE_DIRTY_DENTRY)) {
+        if (nfs_dir_sync(inode) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    else if (NFS_IS_REG(inode) && (inode->flags & NFS_INODE_DIRTY_DATA) && inode->data &&
+             inode->size <= NFS_INODE_INLINE_SZ) {   /* 小文件内联，原有的数据块随之释放 */
+        nfs_shrink_data(inode, 0);
+    }
+    else if (NFS_IS_REG(inode) && (inode->flags & NFS_INODE_DIRTY_DATA) && inode->data) {
+        if (nfs_map_data(inode, inode->blk_cnt + inode->rsv_blks) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_NOSPACE;
+        }
+        if (nfs_extent_sync(inode, inode->data, 
+                            NFS_BLKS_SZ(inode->blk_cnt)) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    else if (NFS_IS_SYM_LINK(inode) && (inode->flags & NFS_INODE_DIRTY_DATA) &&
+             inode->size >= NFS_INODE_INLINE_SZ) {
+        if (nfs_sync_symlink(inode) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+
+    memset(&inode_d, 0, sizeof(struct nfs_inode_d));
     inode_d.ino         = ino;
     inode_d.size        = inode->size;
-    memcpy(inode_d.target_path, inode->target_path, NFS_MAX_FILE_NAME);
     inode_d.ftype       = inode->dentry->ftype;
     inode_d.dir_cnt     = inode->dir_cnt;
-    inode_d.dat = inode->dat;
-    
-    int offset;
-    
-    if (nfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                     sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
+    inode_d.blk_cnt     = inode->blk_cnt;
+    inode_d.ext_cnt     = inode->ext_cnt;
+    inode_d.ext_blk     = inode->ext_blk;
+    inode_d.dir_buckets = inode->dir_buckets;
+    memcpy(inode_d.extents, inode->extents, sizeof(inode_d.extents));
+    if (NFS_IS_SYM_LINK(inode) && inode->size < NFS_INODE_INLINE_SZ) {
+        memcpy(inode_d.inline_data, inode->target_path, inode->size);
+    }
+    else if (NFS_IS_REG(inode) && NFS_IS_INLINE(inode)) {
+        if (nfs_data_load(inode) != NFS_ERROR_NONE) { /* 只改元数据时数据可能已被丢弃 */
+            return -NFS_ERROR_IO;
+        }
+        memcpy(inode_d.inline_data, inode->data, inode->size);
+    }
+
+    pthread_mutex_lock(&nfs_super.itable_lock);
+    ret = nfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d, sizeof(struct nfs_inode_d));
+    pthread_mutex_unlock(&nfs_super.itable_lock);
+    if (ret != NFS_ERROR_NONE) {
         NFS_DBG("[%s] io error\n", __func__);
         return -NFS_ERROR_IO;
     }
-                                                      /* Cycle 1: 写 INODE */
-                                                      /* Cycle 2: 写 数据 */
-    if (NFS_IS_DIR(inode)) {                          
+    nfs_clear_dirty(inode);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 位图有修改时，写回有修改的组的inode、数据位图
+ * 
+ * 持有alloc_lock写出，写出的位图是一致的。超级块只在nfs_mkfs时写入
+ * 
+ * @return int 
+ */
+int nfs_sync_super() {
+    int ret = NFS_ERROR_NONE;
+
+    NFS_ALLOC_LOCK();
+    if (nfs_super.is_map_dirty) {
+        ret = nfs_group_sync();
+        if (ret == NFS_ERROR_NONE) {
+            nfs_super.is_map_dirty = FALSE;
+        }
+    }
+    NFS_ALLOC_UNLOCK();
+    return ret;
+}
+/**
+ * @brief 释放不再被引用的inode：目录先递归删除其下所有项，再释放位图、数据块和内存
+ * 
+ * 不访问inode->dentry，调用者已将其断开
+ * 
+ * @param inode 
+ * @param is_dir 
+ * @return int 目录项或子inode读入失败时返回-NFS_ERROR_IO，其余部分照常释放
+ */
+static int nfs_free_inode(struct nfs_inode* inode, boolean is_dir) {
+    struct nfs_dentry*  dentry_cursor;
+    struct nfs_dentry*  dentry_to_free;
+    struct nfs_inode*   inode_cursor;
+    int ret = NFS_ERROR_NONE;
+    int err;
+
+    NFS_INODE_WRLOCK(inode);                          /* 与nfs_data_evict互斥 */
+    if (is_dir) {
+        if (nfs_dir_load(inode) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;                      /* 只能释放已探查读入的项 */
+        }
         dentry_cursor = inode->dentrys;
-        offset = NFS_DATA_OFS(inode->dat);
-        while (dentry_cursor != NULL)
-        {
-            memcpy(dentry_d.fname, dentry_cursor->fname, NFS_MAX_FILE_NAME);
-            dentry_d.ftype = dentry_cursor->ftype;
-            dentry_d.ino = dentry_cursor->ino;
-            dentry_d.dat = dentry_cursor->dat;
-            if (nfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                                sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE) {
-                NFS_DBG("[%s] io error\n", __func__);
-                return -NFS_ERROR_IO;                     
+                                                      /* 递归向下drop */
+        while (dentry_cursor)
+        {   
+            inode_cursor = dentry_cursor->inode;
+            if (inode_cursor == NULL) {               /* 未读入的子inode也要释放位图 */
+                inode_cursor = nfs_read_inode(dentry_cursor, dentry_cursor->ino);
+                NFS_RCU_ASSIGN(dentry_cursor->inode, inode_cursor);
             }
-            
-            if (dentry_cursor->inode != NULL) {
-                nfs_sync_inode(dentry_cursor->inode);
+            if (inode_cursor == NULL) {
+                ret = -NFS_ERROR_IO;                  /* 读不出的子树无法回收 */
             }
-
+            else {
+                err = nfs_drop_inode(inode_cursor);
+                if (err < 0) {
+                    ret = err;
+                }
+            }
+            nfs_detach_dentry(inode, dentry_cursor);   /* 目录随后释放，无需写回 */
+            dentry_to_free = dentry_cursor;
             dentry_cursor = dentry_cursor->brother;
-            offset += sizeof(struct nfs_dentry_d);
-        }
-    }
-    else if (NFS_IS_REG(inode)) {
-        if (nfs_driver_write(NFS_DATA_OFS(inode->dat), inode->data, 
-                            NFS_BLKS_SZ(NFS_DATA_PER_FILE)) != NFS_ERROR_NONE) {
-            NFS_DBG("[%s] io error\n", __func__);
-            return -NFS_ERROR_IO;
+            nfs_free_dentry(dentry_to_free);
         }
     }
-    return NFS_ERROR_NONE;
+
+                                                      /* 调整inodemap */
+    NFS_ALLOC_LOCK();
+    nfs_group_free_inode(inode->ino);
+    nfs_super.is_map_dirty = TRUE;
+    NFS_ALLOC_UNLOCK();
+                                                      /* 调整datamap */
+    nfs_shrink_data(inode, 0);
+
+    nfs_clear_dirty(inode);                           /* 已删除的inode无需写回 */
+    nfs_data_release(inode);
+    nfs_rcu_free(inode->dhash);                       /* 无锁查找可能仍在读，延迟释放 */
+    nfs_dir_name_release(inode, TRUE);
+    NFS_INODE_UNLOCK(inode);
+    pthread_rwlock_destroy(&inode->lock);
+    nfs_rcu_free_to(&nfs_super.inode_slab, inode);
+    return ret;
 }
 /**
  * @brief 删除内存中的一个inode， 暂时不释放
@@ -337,76 +772,153 @@ int nfs_sync_inode(struct nfs_inode * inode) {
  * @return int 
  */
 int nfs_drop_inode(struct nfs_inode * inode) {
-    struct nfs_dentry*  dentry_cursor;
-    struct nfs_dentry*  dentry_to_free;
-    struct nfs_inode*   inode_cursor;
-
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    int dat_cursor  = 0;
-    boolean is_find = FALSE;
-    boolean is_done = FALSE;
+    boolean is_dir;
+    int refcnt = 0;
 
     if (inode == nfs_super.root_dentry->inode) {
         return NFS_ERROR_INVAL;
     }
-
-    if (NFS_IS_DIR(inode)) {
-        dentry_cursor = inode->dentrys;
-                                                      /* 递归向下drop */
-        while (dentry_cursor)
-        {   
-            inode_cursor = dentry_cursor->inode;
-            nfs_drop_inode(inode_cursor);
-            nfs_drop_dentry(inode, dentry_cursor);
-            dentry_to_free = dentry_cursor;
-            dentry_cursor = dentry_cursor->brother;
-            free(dentry_to_free);
-        }
+    pthread_mutex_lock(&nfs_super.ref_lock);
+    __atomic_store_n(&inode->is_orphan, TRUE, __ATOMIC_SEQ_CST); /* 之后不能再取得它的引用 */
+    if (!__atomic_compare_exchange_n(&inode->refcnt, &refcnt, NFS_INODE_DEAD, FALSE,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_unlock(&nfs_super.ref_lock);    /* 仍被引用，推迟到nfs_put_inode释放 */
+        return NFS_ERROR_NONE;
     }
-    else if (NFS_IS_REG(inode) || NFS_IS_SYM_LINK(inode)) {
-        for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_inode_blks); 
-            byte_cursor++)                            /* 调整inodemap */
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if (ino_cursor == inode->ino) {
-                     nfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                     is_find = TRUE;
-                     break;
-                }
-                ino_cursor++;
-            }
-            if (is_find == TRUE) {
-                break;
-            }
-        }
+    is_dir = NFS_IS_DIR(inode);
+    NFS_RCU_ASSIGN(inode->dentry->inode, NULL);
+    pthread_mutex_unlock(&nfs_super.ref_lock);
 
+    return nfs_free_inode(inode, is_dir);
+}
+/**
+ * @brief 释放已从父目录摘下的dentry；其inode仍被引用时由inode保留，最后一个引用释放时释放
+ * 
+ * @param dentry 
+ */
+void nfs_free_dentry(struct nfs_dentry * dentry) {
+    boolean is_kept;
 
-        
-        for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_data_blks); byte_cursor++){
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if (dat_cursor == inode->dat) {
-                    nfs_super.map_data[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                    
-                    is_done = TRUE;
-                    break;
+    pthread_mutex_lock(&nfs_super.ref_lock);
+    is_kept = dentry->inode != NULL && dentry->inode->is_orphan;
+    if (is_kept) {
+        dentry->inode->is_dentry_kept = TRUE;         /* 由nfs_put_inode释放 */
+    }
+    pthread_mutex_unlock(&nfs_super.ref_lock);
+    if (!is_kept) {
+        nfs_rcu_free_to(&nfs_super.dentry_slab, dentry); /* 无锁查找可能仍在读 */
+    }
+}
+/**
+ * @brief 增加inode引用：open/opendir、nfs_lookup的返回值和写回过程中持有
+ * 
+ * 调用者保证inode不会被并发释放：已持有引用、持有父目录的锁或ref_lock下确认未删除
+ * 
+ * @param inode 
+ */
+void nfs_get_inode(struct nfs_inode * inode) {
+    __atomic_fetch_add(&inode->refcnt, 1, __ATOMIC_SEQ_CST);
+}
+/**
+ * @brief 尝试引用无锁查找到的inode，它可能正被删除
+ * 
+ * 调用者在RCU读侧临界区内，inode的内存有效
+ * 
+ * @param inode 
+ * @return boolean 已删除时返回FALSE
+ */
+static boolean nfs_tryget_inode(struct nfs_inode * inode) {
+    int refcnt = __atomic_load_n(&inode->refcnt, __ATOMIC_SEQ_CST);
 
-                }
-                dat_cursor++;
-                
-            }
-            if (is_done == TRUE) {
-                break;
-            }
+    do {
+        if (refcnt == NFS_INODE_DEAD) {
+            return FALSE;
         }
+    } while (!__atomic_compare_exchange_n(&inode->refcnt, &refcnt, refcnt + 1, FALSE,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    if (__atomic_load_n(&inode->is_orphan, __ATOMIC_SEQ_CST)) {
+        nfs_put_inode(inode);                         /* 由这次put负责释放 */
+        return FALSE;
     }
+    return TRUE;
+}
+/**
+ * @brief 减少inode引用；已删除的inode在最后一个引用释放时释放
+ * 
+ * 引用降为0之后inode可能被并发的nfs_drop_inode释放，在RCU读侧临界区内访问它
+ * 
+ * @param inode 
+ */
+void nfs_put_inode(struct nfs_inode * inode) {
+    struct nfs_dentry* dentry;
+    boolean is_dir, is_detached;
+    int refcnt = 0;
 
+    nfs_rcu_read_lock();
+    if (__atomic_sub_fetch(&inode->refcnt, 1, __ATOMIC_SEQ_CST) > 0 ||
+        !__atomic_load_n(&inode->is_orphan, __ATOMIC_SEQ_CST)) {
+        nfs_rcu_read_unlock();
+        return;
+    }
+    pthread_mutex_lock(&nfs_super.ref_lock);
+    if (!__atomic_compare_exchange_n(&inode->refcnt, &refcnt, NFS_INODE_DEAD, FALSE,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_unlock(&nfs_super.ref_lock);    /* 又被引用，或已由nfs_drop_inode释放 */
+        nfs_rcu_read_unlock();
+        return;
+    }
+    dentry        = inode->dentry;
+    is_dir        = NFS_IS_DIR(inode);
+    is_detached   = inode->is_dentry_kept;            /* 否则dentry由随后的nfs_free_dentry释放 */
+    NFS_RCU_ASSIGN(dentry->inode, NULL);
+    pthread_mutex_unlock(&nfs_super.ref_lock);
+    nfs_rcu_read_unlock();
 
-    if (inode->data)
-        free(inode->data);
-    free(inode);
-    
+    nfs_free_inode(inode, is_dir);
+    if (is_detached) {
+        nfs_rcu_free_to(&nfs_super.dentry_slab, dentry);
+    }
+}
+/**
+ * @brief 读出磁盘inode记录
+ * 
+ * @param ino 
+ * @param inode_d 
+ * @return int 
+ */
+static int nfs_read_inode_d(int ino, struct nfs_inode_d* inode_d) {
+    uint8_t* buf;
+    int ret;
+                                                      /* 经由块缓存读入整个inode块，相邻inode随后命中 */
+    if (nfs_cache_enabled()) {
+        buf = (uint8_t*)malloc(NFS_BLKS_SZ(1));
+        ret = nfs_driver_read(NFS_INO_BLK_OFS(ino), buf, NFS_BLKS_SZ(1));
+        memcpy(inode_d, buf + NFS_INO_OFS(ino) - NFS_INO_BLK_OFS(ino), sizeof(struct nfs_inode_d));
+        free(buf);
+    }
+    else {
+        ret = nfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)inode_d, sizeof(struct nfs_inode_d));
+    }
+    if (ret != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] io error\n", __func__);
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 从inode记录中重新读出内联的文件内容，内存中的副本已被丢弃时使用
+ * 
+ * @param inode NFS_IS_INLINE，调用者持有其锁
+ * @param buf 至少NFS_INODE_INLINE_SZ字节
+ * @return int 
+ */
+int nfs_read_inline(struct nfs_inode* inode, uint8_t* buf) {
+    struct nfs_inode_d inode_d;
+
+    if (nfs_read_inode_d(inode->ino, &inode_d) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    memcpy(buf, inode_d.inline_data, NFS_INODE_INLINE_SZ);
     return NFS_ERROR_NONE;
 }
 /**
@@ -417,50 +929,58 @@ int nfs_drop_inode(struct nfs_inode * inode) {
  * @return struct nfs_inode* 
  */
 struct nfs_inode* nfs_read_inode(struct nfs_dentry * dentry, int ino) {
-    struct nfs_inode* inode = (struct nfs_inode*)malloc(sizeof(struct nfs_inode));
+    struct nfs_inode* inode;
     struct nfs_inode_d inode_d;
-    struct nfs_dentry* sub_dentry;
-    struct nfs_dentry_d dentry_d;
-    int    dir_cnt = 0, i;
-    if (nfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                        sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
-        NFS_DBG("[%s] io error\n", __func__);
+    uint8_t* buf;
+
+    if (nfs_read_inode_d(ino, &inode_d) != NFS_ERROR_NONE) {
         return NULL;                    
     }
+    inode = (struct nfs_inode*)nfs_slab_alloc(&nfs_super.inode_slab);
+    pthread_rwlock_init(&inode->lock, NULL);
     inode->dir_cnt = 0;
     inode->ino = inode_d.ino;
     inode->size = inode_d.size;
-    memcpy(inode->target_path, inode_d.target_path, NFS_MAX_FILE_NAME);
     inode->dentry = dentry;
     inode->dentrys = NULL;
-    inode->dat = inode_d.dat;
-
-    if (NFS_IS_DIR(inode)) {
-        dir_cnt = inode_d.dir_cnt;
-        for (i = 0; i < dir_cnt; i++)
-        {
-            if (nfs_driver_read(NFS_DATA_OFS(inode->dat) + i * sizeof(struct nfs_dentry_d), 
-                                (uint8_t *)&dentry_d, 
-                                sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE) {
-                NFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
-            }
-            sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);    
-            nfs_alloc_datamap2(sub_dentry);
-            sub_dentry->parent = inode->dentry;
-            sub_dentry->ino    = dentry_d.ino; 
-            nfs_alloc_dentry(inode, sub_dentry);
-        }
+    inode->blk_cnt = inode_d.blk_cnt;
+    inode->ext_cnt = inode_d.ext_cnt;
+    inode->ext_blk = inode_d.ext_blk;
+    memcpy(inode->extents, inode_d.extents, sizeof(inode_d.extents));
+    if (nfs_extent_load(inode) != NFS_ERROR_NONE) {
+        free(inode->ext_overflow);
+        pthread_rwlock_destroy(&inode->lock);
+        nfs_slab_free(&nfs_super.inode_slab, inode);
+        return NULL;
+    }
+    if (inode_d.ftype == NFS_SYM_LINK && inode->size >= NFS_MAX_FILE_NAME) {
+        inode->size = 0;                              /* 记录损坏 */
     }
-    else if (NFS_IS_REG(inode)) {
-        inode->data = (uint8_t *)malloc(NFS_BLKS_SZ(NFS_DATA_PER_FILE));
-        nfs_alloc_datamap(inode);
-        if (nfs_driver_read(NFS_DATA_OFS(inode->dat), (uint8_t *)inode->data, 
-                            NFS_BLKS_SZ(NFS_DATA_PER_FILE)) != NFS_ERROR_NONE) {
-            NFS_DBG("[%s] io error\n", __func__);
-            return NULL;                    
+    if (inode_d.ftype == NFS_SYM_LINK && inode->size < NFS_INODE_INLINE_SZ) {
+        memcpy(inode->target_path, inode_d.inline_data, inode->size);
+    }
+    else if (inode_d.ftype == NFS_SYM_LINK) {         /* 较长的目标在首个数据块 */
+        buf = (uint8_t*)malloc(NFS_BLKS_SZ(1));
+        if (nfs_extent_read(inode, buf, NFS_BLKS_SZ(1)) == NFS_ERROR_NONE) {
+            memcpy(inode->target_path, buf, inode->size);
         }
+        free(buf);
+    }
+
+    if (NFS_IS_DIR(inode)) {                          /* 目录项按需读入，见nfs_dir_lookup */
+        inode->dir_cnt     = inode_d.dir_cnt;
+        inode->dir_buckets = inode_d.dir_buckets;
+        inode->is_loaded   = (inode->dir_cnt == 0);
+    }
+    if (inode_d.ftype == NFS_REG_FILE && inode->blk_cnt == 0 && inode->size > NFS_INODE_INLINE_SZ) {
+        inode->size = 0;                              /* 记录损坏：没有数据块也放不进inode */
     }
+    if (inode_d.ftype == NFS_REG_FILE && NFS_IS_INLINE(inode)) {
+        buf = (uint8_t*)calloc(1, inode->size + 1);   /* 内联的内容随inode读入，不再读数据块 */
+        memcpy(buf, inode_d.inline_data, inode->size);
+        nfs_data_attach(inode, buf, inode->size + 1);
+    }
+    /* 其余普通文件数据在首次read/write时读入，见nfs_data_load */
     return inode;
 }
 /**
@@ -468,11 +988,15 @@ struct nfs_inode* nfs_read_inode(struct nfs_dentry * dentry, int ino) {
  * 
  * @param inode 
  * @param dir [0...]
- * @return struct nfs_dentry* 
+ * @return struct nfs_dentry* 目录读不出时返回NULL
  */
 struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir) {
-    struct nfs_dentry* dentry_cursor = inode->dentrys;
+    struct nfs_dentry* dentry_cursor;
     int    cnt = 0;
+    if (nfs_dir_load(inode) != NFS_ERROR_NONE) {
+        return NULL;
+    }
+    dentry_cursor = inode->dentrys;
     while (dentry_cursor)
     {
         if (dir == cnt) {
@@ -483,6 +1007,95 @@ struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir) {
     }
     return NULL;
 }
+/**
+ * @brief 在目录中查找fname，找到时保证子项的inode已读入
+ * 
+ * 先持读锁只查内存；需要读磁盘目录项或子inode时改持写锁重新查找
+ * 
+ * @param inode 目录inode
+ * @param fname 
+ * @param dentry 返回找到的目录项，未找到为NULL
+ * @return int 目录项或子inode读不出时返回-NFS_ERROR_IO，dentry->inode仍为NULL，下次查找重新读入；
+ *         返回时仍持有inode的读锁或写锁
+ */
+static int nfs_lookup_child(struct nfs_inode* inode, const char* fname, struct nfs_dentry** dentry) {
+    NFS_INODE_RDLOCK(inode);
+    if (nfs_dir_peek(inode, fname, dentry) && (*dentry == NULL || (*dentry)->inode != NULL)) {
+        return NFS_ERROR_NONE;
+    }
+    NFS_INODE_UNLOCK(inode);
+
+    NFS_INODE_WRLOCK(inode);
+    if (nfs_dir_lookup(inode, fname, dentry) != NFS_ERROR_NONE) { /* 未读入的目录只读对应的桶块 */
+        return -NFS_ERROR_IO;
+    }
+    if (*dentry != NULL && (*dentry)->inode == NULL) { /* Cache机制 */
+        NFS_RCU_ASSIGN((*dentry)->inode, nfs_read_inode(*dentry, (*dentry)->ino));
+    }
+    if (*dentry != NULL && (*dentry)->inode == NULL) {
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 无锁路径查找：在RCU读侧临界区内逐级查目录哈希表，不取任何锁
+ * 
+ * 途经的dentry、inode和哈希表在临界区内不会被释放；目录哈希表的修改由dir_seq发现，
+ * rename和rmdir由rename_seq发现。只引用最后返回的inode，引用之后再检查rename_seq
+ * 
+ * @param path 
+ * @param is_find 
+ * @return struct nfs_dentry* 目录未读入、inode未读入或与修改并发时返回NULL，改走加锁的查找
+ */
+static struct nfs_dentry* nfs_lookup_rcu(const char * path, boolean* is_find) {
+    struct nfs_dentry* dentry_cursor = nfs_super.root_dentry;
+    struct nfs_dentry* dentry_ret = NULL;
+    struct nfs_dentry* sub_dentry;
+    struct nfs_inode*  inode = NULL;
+    unsigned rename_seq = nfs_seq_read_begin(&nfs_super.rename_seq);
+    int   total_lvl = nfs_calc_lvl(path);
+    int   lvl = 0;
+    char  fname[NFS_MAX_FILE_NAME];
+    const char* cursor = path;
+
+    if (rename_seq & 1) {                             /* 正在rename或rmdir */
+        return NULL;
+    }
+    nfs_rcu_read_lock();
+    while ((cursor = nfs_next_fname(cursor, fname)) != NULL)
+    {
+        lvl++;
+        inode = NFS_RCU_DEREF(dentry_cursor->inode);
+        if (inode == NULL || !nfs_dir_find_rcu(inode, fname, &sub_dentry)) {
+            break;
+        }
+        if (sub_dentry == NULL) {                     /* 负项：返回父目录 */
+            dentry_ret = dentry_cursor;
+        }
+        else if (lvl == total_lvl || sub_dentry->ftype != NFS_DIR) {
+            *is_find   = (lvl == total_lvl);
+            dentry_ret = sub_dentry;
+            inode      = NFS_RCU_DEREF(sub_dentry->inode);
+        }
+        if (dentry_ret != NULL) {
+            break;
+        }
+        dentry_cursor = sub_dentry;
+    }
+    if (dentry_ret != NULL && (inode == NULL || !nfs_tryget_inode(inode))) {
+        dentry_ret = NULL;                            /* 子inode未读入或已删除 */
+    }
+    else if (dentry_ret != NULL && nfs_seq_read_retry(&nfs_super.rename_seq, rename_seq)) {
+        nfs_put_inode(inode);
+        dentry_ret = NULL;
+    }
+    nfs_rcu_read_unlock();
+    if (dentry_ret == NULL) {
+        *is_find = FALSE;
+    }
+    nfs_rcu_account(dentry_ret == NULL);
+    return dentry_ret;
+}
 /**
  * @brief 
  * path: /qwe/ad  total_lvl = 2,
@@ -495,229 +1108,319 @@ struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir) {
  *      1) find /'s inode       lvl = 1
  *      2) find qwe's dentry
  * 
+ * 调用者持有rename_lock（读或写），逐级只持有当前目录的锁；返回的dentry的inode
+ * 已被引用，用完后须nfs_put_inode
+ * 
  * @param path 
- * @return struct nfs_inode* 
+ * @return struct nfs_inode* 途经的目录项或inode读不出时返回NULL
  */
-struct nfs_dentry* nfs_lookup(const char * path, boolean* is_find, boolean* is_root) {
+static struct nfs_dentry* nfs_lookup_locked(const char * path, boolean* is_find) {
     struct nfs_dentry* dentry_cursor = nfs_super.root_dentry;
     struct nfs_dentry* dentry_ret = NULL;
+    struct nfs_dentry* sub_dentry;
     struct nfs_inode*  inode; 
     int   total_lvl = nfs_calc_lvl(path);
     int   lvl = 0;
-    boolean is_hit;
-    char* fname = NULL;
-    const char* path_cpy = (const char*)malloc(sizeof(path));
-    *is_root = FALSE;
-    strcpy(path_cpy, path);
+    char  fname[NFS_MAX_FILE_NAME];
+    const char* cursor = path;
 
-    if (total_lvl == 0) {                           /* 根目录 */
-        *is_find = TRUE;
-        *is_root = TRUE;
-        dentry_ret = nfs_super.root_dentry;
+    if (nfs_pcache_get(path, &dentry_ret, is_find)) { /* 路径缓存命中，不必逐级查找 */
+        return dentry_ret;
     }
-    fname = strtok(path_cpy, "/");       
-    while (fname)
+
+    while ((cursor = nfs_next_fname(cursor, fname)) != NULL)
     {   
         lvl++;
-        if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            nfs_read_inode(dentry_cursor, dentry_cursor->ino);
+        inode      = dentry_cursor->inode;            /* 途经的目录只能在rename_lock写锁下删除 */
+        if (nfs_lookup_child(inode, fname, &sub_dentry) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] read %s failed\n", __func__, fname);
+            NFS_INODE_UNLOCK(inode);
+            return NULL;
         }
 
-        inode = dentry_cursor->inode;
-
-        if (NFS_IS_REG(inode) && lvl < total_lvl) {
+        if (sub_dentry == NULL) {
+            NFS_DBG("[%s] not found %s\n", __func__, fname);
+            dentry_ret = dentry_cursor;
+        }
+        else if (lvl == total_lvl) {
+            *is_find   = TRUE;
+            dentry_ret = sub_dentry;
+        }
+        else if (!NFS_IS_DIR(sub_dentry->inode)) {
             NFS_DBG("[%s] not a dir\n", __func__);
-            dentry_ret = inode->dentry;
-            break;
+            dentry_ret = sub_dentry;
         }
-        if (NFS_IS_DIR(inode)) {
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)
-            {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
-            
-            if (!is_hit) {
-                *is_find = FALSE;
-                NFS_DBG("[%s] not found %s\n", __func__, fname);
-                dentry_ret = inode->dentry;
-                break;
-            }
 
-            if (is_hit && lvl == total_lvl) {
-                *is_find = TRUE;
-                dentry_ret = dentry_cursor;
-                break;
+        if (dentry_ret != NULL) {                     /* 持有父目录的锁时引用，不会与删除交错 */
+            nfs_get_inode(dentry_ret->inode);
+            if (*is_find || lvl == total_lvl) {       /* 负项只缓存父目录存在的路径 */
+                nfs_pcache_put(path, dentry_ret, *is_find);
             }
+            NFS_INODE_UNLOCK(inode);
+            break;
         }
-        fname = strtok(NULL, "/"); 
+        NFS_INODE_UNLOCK(inode);
+        dentry_cursor = sub_dentry;
     }
-
-    if (dentry_ret->inode == NULL) {
-        dentry_ret->inode = nfs_read_inode(dentry_ret, dentry_ret->ino);
+    if (dentry_ret == NULL) {                         /* 文件名过长等，路径不合法 */
+        nfs_get_inode(nfs_super.root_dentry->inode);
+        return nfs_super.root_dentry;
     }
-    
     return dentry_ret;
 }
+/**
+ * @brief 查找路径，先无锁查找，失败时逐级加锁查找
+ * 
+ * 调用者持有rename_lock（读或写）；返回的dentry的inode已被引用，用完后须nfs_put_inode
+ * 
+ * @param path 
+ * @param is_find 
+ * @param is_root 
+ * @return struct nfs_dentry* 途经的目录项或inode读不出时返回NULL，调用者返回-NFS_ERROR_IO
+ */
+struct nfs_dentry* nfs_lookup(const char * path, boolean* is_find, boolean* is_root) {
+    struct nfs_dentry* dentry;
+
+    *is_root = FALSE;
+    *is_find = FALSE;
+    if (nfs_calc_lvl(path) == 0) {                    /* 根目录 */
+        *is_find = TRUE;
+        *is_root = TRUE;
+        nfs_get_inode(nfs_super.root_dentry->inode);
+        return nfs_super.root_dentry;
+    }
+    dentry = nfs_lookup_rcu(path, is_find);
+    if (dentry == NULL) {
+        dentry = nfs_lookup_locked(path, is_find);
+    }
+    return dentry;
+}
+/**
+ * @brief 不持rename_lock的查找，只读的操作（getattr、open等）使用
+ * 
+ * 无锁查找成功时不碰任何共享的锁；失败时持rename_lock读锁逐级查找
+ * 
+ * @param path 
+ * @param is_find 
+ * @param is_root 
+ * @return struct nfs_dentry* 同nfs_lookup
+ */
+struct nfs_dentry* nfs_lookup_nolock(const char * path, boolean* is_find, boolean* is_root) {
+    struct nfs_dentry* dentry;
+
+    *is_root = FALSE;
+    *is_find = FALSE;
+    if (nfs_calc_lvl(path) == 0) {
+        return nfs_lookup(path, is_find, is_root);
+    }
+    dentry = nfs_lookup_rcu(path, is_find);
+    if (dentry == NULL) {
+        NFS_RENAME_RDLOCK();
+        dentry = nfs_lookup_locked(path, is_find);
+        NFS_RENAME_UNLOCK();
+    }
+    return dentry;
+}
 /**
  * @brief 挂载nfs, Layout 如下
  * 
  * Layout
- * | Super | Inode Map | Data |
+ * | Super | Group 0 | Group 1 | ... |
+ * Group
+ * | Inode Map | Data Map | Inode Table | Data |
  * 
- * IO_SZ = BLK_SZ
- * 
- * 每个Inode占用一个Blk
+ * 各部分的大小由nfs_mkfs按设备大小计算并记录在超级块中，设备未格式化时按默认参数格式化
  * @param options 
  * @return int 
  */
 int nfs_mount(struct custom_options options){
     int                 ret = NFS_ERROR_NONE;
-    int                 driver_fd;
     struct nfs_super_d  nfs_super_d; 
     struct nfs_dentry*  root_dentry;
     struct nfs_inode*   root_inode;
 
-    int                 inode_num;
-    int                 data_num;
-    int                 map_inode_blks;
-    int                 map_data_blks;
-    
-    int                 super_blks;
-    boolean             is_init = FALSE;
-
     nfs_super.is_mounted = FALSE;
 
-    // driver_fd = open(options.device, O_RDWR);
-    driver_fd = ddriver_open(options.device);
-
-    if (driver_fd < 0) {
-        return driver_fd;
+    ret = nfs_backend_open(options.device, &nfs_super.sz_disk, &nfs_super.sz_io);
+    if (ret != NFS_ERROR_NONE) {
+        return ret;
     }
-
-    nfs_super.driver_fd = driver_fd;
-    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &nfs_super.sz_disk);
-    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &nfs_super.sz_io);
     
-    root_dentry = new_dentry("/", NFS_DIR);
+    if (nfs_aio_init(options.aio_workers) != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] aio workers not started, doing io synchronously\n", __func__);
+    }
+    
+    if (nfs_cache_init(options.cache_blks) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    nfs_slab_init(&nfs_super.dentry_slab, "dentry", sizeof(struct nfs_dentry));
+    nfs_slab_init(&nfs_super.inode_slab, "inode", sizeof(struct nfs_inode));
+    root_dentry = new_dentry(NULL, "/", NFS_DIR);
 
     if (nfs_driver_read(NFS_SUPER_OFS, (uint8_t *)(&nfs_super_d), 
                         sizeof(struct nfs_super_d)) != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }   
                                                       /* 读取super */
-    if (nfs_super_d.magic_num != NFS_MAGIC_NUM) {     /* 幻数无 */
-                                                      /* 估算各部分大小 */
-        // super_blks = nfs_ROUND_UP(sizeof(struct nfs_super_d), nfs_IO_SZ()) / nfs_IO_SZ();
-        super_blks = 1; 
-
-        // inode_num  =  NFS_DISK_SZ() / ((NFS_DATA_PER_FILE + NFS_INODE_PER_FILE) * NFS_IO_SZ());
-
-        // data_num  = inode_num * NFS_DATA_PER_FILE; 
-
-        // map_inode_blks = nfs_ROUND_UP(nfs_ROUND_UP(inode_num, UINT32_BITS), nfs_IO_SZ()) / nfs_IO_SZ();
-        
-        // map_data_blks = nfs_ROUND_UP(nfs_ROUND_UP(data_num, UINT32_BITS), nfs_IO_SZ()) / nfs_IO_SZ();
-        inode_num = 514;
-        data_num = 512;
-        
-        map_inode_blks = 1;
-        map_data_blks = 1;
-                                                      /* 布局layout */
-        nfs_super.max_ino = (inode_num - super_blks - map_inode_blks); 
-
-        nfs_super_d.map_inode_offset = NFS_SUPER_OFS + NFS_BLKS_SZ(super_blks);
-        nfs_super_d.map_data_offset = NFS_SUPER_OFS + NFS_BLKS_SZ(super_blks) + NFS_BLKS_SZ(map_inode_blks);
-        
-        nfs_super_d.inode_offset = nfs_super_d.map_data_offset + NFS_BLKS_SZ(map_data_blks);
-        nfs_super_d.data_offset = nfs_super_d.inode_offset + NFS_BLKS_SZ(inode_num);
-        
-        nfs_super_d.map_inode_blks  = map_inode_blks;
-        nfs_super_d.map_data_blks  = map_data_blks;
-        
-        nfs_super_d.sz_usage    = 0;
-        NFS_DBG("inode map blocks: %d\n", map_inode_blks);
-        NFS_DBG("data map blocks: %d\n", map_data_blks);
-        is_init = TRUE;
+    if (nfs_super_d.magic_num != NFS_MAGIC_NUM) {     /* 幻数无，按默认参数格式化 */
+        ret = nfs_mkfs(NFS_DEFAULT_BYTES_PER_INODE, 0);
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+        if (nfs_driver_read(NFS_SUPER_OFS, (uint8_t *)(&nfs_super_d), 
+                            sizeof(struct nfs_super_d)) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    else if (nfs_super_d.layout_version != NFS_LAYOUT_VERSION) {
+        NFS_DBG("[%s] unsupported layout version %d\n", __func__, nfs_super_d.layout_version);
+        return -NFS_ERROR_INVAL;
     }
     nfs_super.sz_usage   = nfs_super_d.sz_usage;      /* 建立 in-memory 结构 */
-    
-    nfs_super.map_inode = (uint8_t *)malloc(NFS_BLKS_SZ(nfs_super_d.map_inode_blks));
-    nfs_super.map_data = (uint8_t *)malloc(NFS_BLKS_SZ(nfs_super_d.map_data_blks));
-    nfs_super.map_inode_blks = nfs_super_d.map_inode_blks;
-    nfs_super.map_data_blks = nfs_super_d.map_data_blks;
-    nfs_super.map_inode_offset = nfs_super_d.map_inode_offset;
-    nfs_super.map_data_offset = nfs_super_d.map_data_offset;
-    nfs_super.data_offset = nfs_super_d.data_offset;
-
-    if (nfs_driver_read(nfs_super_d.map_inode_offset, (uint8_t *)(nfs_super.map_inode), 
-                        NFS_BLKS_SZ(nfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
-        return -NFS_ERROR_IO;
+    ret = nfs_group_init(&nfs_super_d);
+    if (ret != NFS_ERROR_NONE) {
+        return ret;
     }
+    nfs_super.is_map_dirty = FALSE;
+    nfs_super.dirty_list = NULL;
+    nfs_super.dirty_cnt  = 0;
+    nfs_super.data_lru_head = NULL;
+    nfs_super.data_lru_tail = NULL;
+    nfs_super.data_bytes    = 0;
+    nfs_super.data_loads    = 0;
+    nfs_super.data_evicts   = 0;
+    nfs_super.rmw_reads     = 0;
+    nfs_super.rmw_saved     = 0;
+    nfs_pcache_init();
+    pthread_rwlock_init(&nfs_super.rename_lock, NULL);
+    pthread_mutex_init(&nfs_super.alloc_lock, NULL);
+    pthread_mutex_init(&nfs_super.itable_lock, NULL);
+    pthread_mutex_init(&nfs_super.ref_lock, NULL);
+    pthread_mutex_init(&nfs_super.dirty_lock, NULL);
+    pthread_mutex_init(&nfs_super.data_lock, NULL);
 
-    if (nfs_driver_read(nfs_super_d.map_data_offset, (uint8_t *)(nfs_super.map_data), 
-                        NFS_BLKS_SZ(nfs_super_d.map_data_blks)) != NFS_ERROR_NONE) {
+    root_inode            = nfs_read_inode(root_dentry, NFS_ROOT_INO);
+    if (root_inode == NULL) {                         /* 根目录读不出，无法挂载 */
         return -NFS_ERROR_IO;
     }
-    if (is_init) {                                    /* 分配根节点 */
-        root_inode = nfs_alloc_inode(root_dentry);
-        nfs_sync_inode(root_inode);
-    }
-    
-    root_inode            = nfs_read_inode(root_dentry, NFS_ROOT_INO);
     root_dentry->inode    = root_inode;
     nfs_super.root_dentry = root_dentry;
     nfs_super.is_mounted  = TRUE;
 
+    if (nfs_flusher_start() != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] flusher thread not started\n", __func__);
+    }
     // nfs_dump_map();
     // nfs_dump_data_map();
     return ret;
 }
+/**
+ * @brief umount时释放目录树中各inode另行分配的内存，inode和dentry本身随slab整块释放
+ * 
+ * @param inode 
+ */
+static void nfs_release_tree(struct nfs_inode* inode) {
+    struct nfs_dentry* dentry_cursor;
+
+    for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother) {
+        if (dentry_cursor->inode != NULL) {
+            nfs_release_tree(dentry_cursor->inode);
+        }
+    }
+    nfs_data_release(inode);
+    free(inode->dhash);
+    nfs_dir_name_release(inode, FALSE);
+    free(inode->ext_overflow);
+    pthread_rwlock_destroy(&inode->lock);
+}
+/**
+ * @brief 输出各模块的统计，--debug时在umount的最后调用
+ * 
+ */
+static void nfs_report_stats() {
+    struct nfs_cache_stats  cache;
+    struct nfs_pcache_stats pcache;
+    struct nfs_rcu_stats    rcu;
+    struct nfs_slab_stats   slab;
+    struct nfs_slab*        slabs[2] = { &nfs_super.dentry_slab, &nfs_super.inode_slab };
+    struct nfs_space_stats  space;
+    struct nfs_iov_stats    iov;
+    struct nfs_aio_stats    aio;
+    long lookups;
+    int i;
+
+    if (nfs_options.cache_blks > 0) {
+        nfs_cache_get_stats(&cache);
+        NFS_DBG("[%s] cache hits: %ld, misses: %ld, prefetched: %ld, evicts: %ld, writebacks: %ld\n",
+                __func__, cache.hits, cache.misses, cache.prefetched, cache.evicts, cache.writebacks);
+        NFS_DBG("[%s] readahead: %ld blocks, %ld waits\n", __func__, cache.readahead, cache.ra_waits);
+    }
+    NFS_DBG("[%s] data loads %ld, evicts %ld\n", __func__, 
+            nfs_super.data_loads, nfs_super.data_evicts);
+    NFS_DBG("[%s] rmw pre-read %ld bytes, avoided %ld bytes\n", __func__, 
+            nfs_super.rmw_reads, nfs_super.rmw_saved);
+    nfs_pcache_get_stats(&pcache);
+    lookups = pcache.hits + pcache.neg_hits + pcache.misses;
+    NFS_DBG("[%s] path lookups %ld, hits %ld, negative hits %ld, misses %ld, invalidations %ld, hit rate %.1f%%\n",
+            __func__, lookups, pcache.hits, pcache.neg_hits, pcache.misses, pcache.invalidations,
+            lookups ? 100.0 * (pcache.hits + pcache.neg_hits) / lookups : 0.0);
+    nfs_rcu_get_stats(&rcu);
+    NFS_DBG("[%s] lock-free walks %ld, fallbacks %ld, deferred frees %ld, freed %ld\n",
+            __func__, rcu.walks, rcu.fallbacks, rcu.deferred, rcu.freed);
+    for (i = 0; i < 2; i++) {
+        nfs_slab_get_stats(slabs[i], &slab);
+        NFS_DBG("[%s] %s slab: %ld objects (%ld in use) in %ld chunks, %ld bytes\n", __func__,
+                slabs[i]->name, slab.objs, slab.active, slab.chunks, slab.bytes);
+    }
+    NFS_ALLOC_LOCK();
+    nfs_space_get_stats(&space);
+    NFS_ALLOC_UNLOCK();
+    NFS_DBG("[%s] %d free blocks in %d extents, longest %d\n", __func__,
+            space.free_blks, space.extents, space.max_len);
+    nfs_iov_get_stats(&iov);
+    NFS_DBG("[%s] vectored io: %ld segments in %ld transfers, %ld bytes\n",
+            __func__, iov.reqs, iov.runs, iov.bytes);
+    nfs_aio_get_stats(&aio);
+    NFS_DBG("[%s] aio submitted %ld, completed %ld, max queue depth %d\n", __func__,
+            aio.submitted, aio.completed, aio.max_depth);
+}
 /**
  * @brief 
  * 
  * @return int 
  */
 int nfs_umount() {
-    struct nfs_super_d  nfs_super_d; 
-
     if (!nfs_super.is_mounted) {
         return NFS_ERROR_NONE;
     }
 
-    nfs_sync_inode(nfs_super.root_dentry->inode);     /* 从根节点向下刷写节点 */
-                                                    
-    nfs_super_d.magic_num           = NFS_MAGIC_NUM;
-    nfs_super_d.map_inode_blks      = nfs_super.map_inode_blks;
-    nfs_super_d.map_inode_offset    = nfs_super.map_inode_offset;
-    nfs_super_d.map_data_blks      = nfs_super.map_data_blks;
-    nfs_super_d.map_data_offset    = nfs_super.map_data_offset;
-    nfs_super_d.data_offset         = nfs_super.data_offset;
-    nfs_super_d.sz_usage            = nfs_super.sz_usage;
-
-    if (nfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&nfs_super_d, 
-                     sizeof(struct nfs_super_d)) != NFS_ERROR_NONE) {
+    nfs_flusher_stop_wait();
+    if (nfs_writeback() != NFS_ERROR_NONE) {          /* 只写回变化过的inode和位图 */
         return -NFS_ERROR_IO;
     }
 
-    if (nfs_driver_write(nfs_super_d.map_inode_offset, (uint8_t *)(nfs_super.map_inode), 
-                         NFS_BLKS_SZ(nfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
+    nfs_pcache_destroy();
+    nfs_rcu_destroy();                                /* 已没有FUSE操作在查找 */
+    nfs_iov_destroy();
+    if (nfs_cache_destroy() != NFS_ERROR_NONE) {      /* 写回所有脏块 */
         return -NFS_ERROR_IO;
     }
-    if (nfs_driver_write(nfs_super_d.map_data_offset, (uint8_t *)(nfs_super.map_data), 
-                         NFS_BLKS_SZ(nfs_super_d.map_data_blks)) != NFS_ERROR_NONE) {
+
+    nfs_aio_destroy();                                /* 已提交的请求都已完成 */
+    if (nfs_super.backend->sync() != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }
 
-    free(nfs_super.map_inode);
-    free(nfs_super.map_data);
-    ddriver_close(NFS_DRIVER());
+    if (nfs_options.debug) {
+        nfs_report_stats();
+    }
+    nfs_release_tree(nfs_super.root_dentry->inode);
+    nfs_slab_destroy(&nfs_super.dentry_slab);
+    nfs_slab_destroy(&nfs_super.inode_slab);
+    nfs_group_destroy();
+    nfs_super.backend->close();
+    nfs_super.is_mounted = FALSE;
 
     return NFS_ERROR_NONE;
 }
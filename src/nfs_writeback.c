@@ -0,0 +1,177 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+/******************************************************************************
+* SECTION: Global Static Var
+*******************************************************************************/
+static pthread_t             nfs_flusher;
+static pthread_mutex_t       nfs_flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t        nfs_flusher_cond = PTHREAD_COND_INITIALIZER;
+static boolean               nfs_flusher_running = FALSE;
+static boolean               nfs_flusher_stop    = FALSE;
+static pthread_mutex_t       nfs_writeback_lock  = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * @brief 标记inode脏，首次变脏时加入脏链表
+ *
+ * @param inode 调用者持有其写锁
+ * @param flags NFS_INODE_DIRTY_*
+ */
+void nfs_mark_dirty(struct nfs_inode* inode, flag16 flags) {
+    pthread_mutex_lock(&nfs_super.dirty_lock);
+    if (inode->flags == 0) {
+        inode->dirty_prev = NULL;
+        inode->dirty_next = nfs_super.dirty_list;
+        if (nfs_super.dirty_list) {
+            nfs_super.dirty_list->dirty_prev = inode;
+        }
+        nfs_super.dirty_list = inode;
+        nfs_super.dirty_cnt++;
+    }
+    inode->flags |= flags;
+    pthread_mutex_unlock(&nfs_super.dirty_lock);
+}
+/**
+ * @brief 清除inode的脏标记并移出脏链表，inode写回或释放时调用
+ *
+ * @param inode
+ */
+void nfs_clear_dirty(struct nfs_inode* inode) {
+    pthread_mutex_lock(&nfs_super.dirty_lock);
+    if (inode->flags == 0) {
+        pthread_mutex_unlock(&nfs_super.dirty_lock);
+        return;
+    }
+    if (inode->dirty_prev) {
+        inode->dirty_prev->dirty_next = inode->dirty_next;
+    }
+    else {
+        nfs_super.dirty_list = inode->dirty_next;
+    }
+    if (inode->dirty_next) {
+        inode->dirty_next->dirty_prev = inode->dirty_prev;
+    }
+    inode->dirty_prev = NULL;
+    inode->dirty_next = NULL;
+    inode->flags      = 0;
+    nfs_super.dirty_cnt--;
+    pthread_mutex_unlock(&nfs_super.dirty_lock);
+}
+
+static int nfs_cmp_ino(const void* a, const void* b) {
+    const struct nfs_inode* inode_a = *(const struct nfs_inode**)a;
+    const struct nfs_inode* inode_b = *(const struct nfs_inode**)b;
+    return inode_a->ino - inode_b->ino;
+}
+/**
+ * @brief 写回所有脏inode（按磁盘偏移排序）以及脏位图、超级块
+ *
+ * 相邻的块合并成一次向量写。先在脏链表锁内引用所有未删除的脏inode，
+ * 再逐个持写锁写回，不会与FUSE操作互相等待；同一时刻只有一轮写回
+ *
+ * @return int
+ */
+int nfs_writeback() {
+    struct nfs_inode** dirty = NULL;
+    struct nfs_inode*  inode;
+    int dirty_cnt = 0;
+    int ret = NFS_ERROR_NONE;
+    int i;
+
+    pthread_mutex_lock(&nfs_writeback_lock);
+    nfs_iobatch_begin();                              /* 未启用块缓存时合并本轮的写 */
+    pthread_mutex_lock(&nfs_super.dirty_lock);
+    pthread_mutex_lock(&nfs_super.ref_lock);
+    if (nfs_super.dirty_cnt > 0) {
+        dirty = (struct nfs_inode**)malloc(nfs_super.dirty_cnt * sizeof(struct nfs_inode*));
+        for (inode = nfs_super.dirty_list; inode != NULL; inode = inode->dirty_next) {
+            if (!inode->is_orphan) {                  /* 已删除的inode无需写回 */
+                nfs_get_inode(inode);                 /* 持ref_lock，不会与释放交错 */
+                dirty[dirty_cnt++] = inode;
+            }
+        }
+    }
+    pthread_mutex_unlock(&nfs_super.ref_lock);
+    pthread_mutex_unlock(&nfs_super.dirty_lock);
+
+    if (dirty_cnt > 1) {
+        qsort(dirty, dirty_cnt, sizeof(struct nfs_inode*), nfs_cmp_ino);
+    }
+    for (i = 0; i < dirty_cnt; i++) {                  /* NFS_INO_OFS随ino单调递增 */
+        NFS_INODE_WRLOCK(dirty[i]);
+        if (nfs_sync_inode(dirty[i]) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+        }
+        NFS_INODE_UNLOCK(dirty[i]);
+        nfs_put_inode(dirty[i]);
+    }
+    free(dirty);
+    if (nfs_sync_super() != NFS_ERROR_NONE) {         /* 位图未修改时直接返回 */
+        ret = -NFS_ERROR_IO;
+    }
+    if (nfs_iobatch_end() != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
+    }
+    if (nfs_cache_flush() != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
+    }
+    pthread_mutex_unlock(&nfs_writeback_lock);
+    return ret;
+}
+/**
+ * @brief 后台刷写线程，每flush_interval秒写回一次
+ *
+ * @param arg
+ * @return void*
+ */
+static void* nfs_flusher_main(void* arg) {
+    struct timespec deadline;
+
+    pthread_mutex_lock(&nfs_flusher_lock);
+    while (!nfs_flusher_stop) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += nfs_options.flush_interval;
+        pthread_cond_timedwait(&nfs_flusher_cond, &nfs_flusher_lock, &deadline);
+        if (nfs_flusher_stop) {
+            break;
+        }
+        pthread_mutex_unlock(&nfs_flusher_lock);
+
+        nfs_writeback();
+
+        pthread_mutex_lock(&nfs_flusher_lock);
+    }
+    pthread_mutex_unlock(&nfs_flusher_lock);
+    return NULL;
+}
+/**
+ * @brief 启动后台刷写线程
+ *
+ * @return int
+ */
+int nfs_flusher_start() {
+    if (nfs_options.flush_interval <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    nfs_flusher_stop = FALSE;
+    if (pthread_create(&nfs_flusher, NULL, nfs_flusher_main, NULL) != 0) {
+        return -NFS_ERROR_INVAL;
+    }
+    nfs_flusher_running = TRUE;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 停止后台刷写线程
+ *
+ */
+void nfs_flusher_stop_wait() {
+    if (!nfs_flusher_running) {
+        return;
+    }
+    pthread_mutex_lock(&nfs_flusher_lock);
+    nfs_flusher_stop = TRUE;
+    pthread_cond_signal(&nfs_flusher_cond);
+    pthread_mutex_unlock(&nfs_flusher_lock);
+    pthread_join(nfs_flusher, NULL);
+    nfs_flusher_running = FALSE;
+}
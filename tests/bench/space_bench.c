@@ -0,0 +1,326 @@
+/**
+ * @brief 空闲extent分配器（红黑树）的单元测试与微基准
+ *
+ * 先检查nfs_space_alloc的各条路径（goal、goal所在组的下一段、最佳适配、最长段）和
+ * 只在组内合并的nfs_space_free，再随机分配/释放并与数据位图核对；最后对比按位图
+ * 扫描找连续空闲块与nfs_space_alloc在不同填充率下的开销。
+ *
+ * Usage: ./nfs_space_bench [groups]
+ */
+#include "../../include/nfs.h"
+#include <time.h>
+
+#define BENCH_DPG       8192                          /* 每组数据块数，同1KB块的位图上限 */
+#define BENCH_ROUNDS    20000
+#define BENCH_CHECKS    200000
+
+#define EXPECT(cond)    do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __func__, __LINE__, #cond); \
+                                            failures++; } } while (0)
+
+struct nfs_super      nfs_super;
+struct custom_options nfs_options;
+
+static int failures;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+/**
+ * @brief 建立groups组、共max_data个数据块的空位图，之前的索引先释放
+ */
+static void space_setup(int groups, int max_data) {
+    nfs_space_destroy();
+    free(nfs_super.map_data);
+    nfs_super.group_cnt      = groups;
+    nfs_super.data_per_group = BENCH_DPG;
+    nfs_super.max_data       = max_data;
+    nfs_super.map_data       = (uint8_t*)calloc(1, (size_t)groups * BENCH_DPG / UINT8_BITS);
+}
+/**
+ * @brief 将[start, start + len)标记为已占用
+ */
+static void space_mark(int start, int len) {
+    int i;
+    for (i = start; i < start + len; i++) {
+        NFS_BITMAP_SET(nfs_super.map_data, i);
+    }
+}
+/**
+ * @brief 将[start, start + len)标记为空闲
+ */
+static void space_clear(int start, int len) {
+    int i;
+    for (i = start; i < start + len; i++) {
+        NFS_BITMAP_CLEAR(nfs_super.map_data, i);
+    }
+}
+/**
+ * @brief 由位图统计空闲块数、各组的空闲段数和最长段，与nfs_space_get_stats核对
+ */
+static void space_check(const char* when) {
+    struct nfs_space_stats stats;
+    int group, end, bit, run_end;
+    int free_blks = 0, extents = 0, max_len = 0;
+
+    for (group = 0; group < nfs_super.group_cnt; group++) {
+        end = NFS_GROUP_FIRST_DATA(group + 1) < nfs_super.max_data ?
+              NFS_GROUP_FIRST_DATA(group + 1) : nfs_super.max_data;
+        bit = nfs_bitmap_find_zero(nfs_super.map_data, end, NFS_GROUP_FIRST_DATA(group));
+        while (bit >= 0) {
+            run_end    = nfs_bitmap_find_one(nfs_super.map_data, end, bit);
+            free_blks += run_end - bit;
+            max_len    = run_end - bit > max_len ? run_end - bit : max_len;
+            extents++;
+            bit = nfs_bitmap_find_zero(nfs_super.map_data, end, run_end);
+        }
+    }
+    nfs_space_get_stats(&stats);
+    if (stats.free_blks != free_blks || stats.extents != extents || stats.max_len != max_len) {
+        printf("FAIL %s: index %d blocks / %d extents / max %d, bitmap %d / %d / %d\n", when,
+               stats.free_blks, stats.extents, stats.max_len, free_blks, extents, max_len);
+        failures++;
+    }
+}
+
+static void test_goal() {
+    int got, dat;
+
+    space_setup(1, BENCH_DPG);
+    space_mark(0, 100);
+    nfs_space_init();
+    dat = nfs_space_alloc(200, 10, &got);             /* goal空闲，从goal起分配 */
+    EXPECT(dat == 200 && got == 10);
+    dat = nfs_space_alloc(BENCH_DPG - 4, 10, &got);   /* goal所在段不足want，只给到段尾 */
+    EXPECT(dat == BENCH_DPG - 4 && got == 4);
+    space_mark(200, 10);
+    space_mark(BENCH_DPG - 4, 4);
+    space_check(__func__);
+}
+
+static void test_next_in_group() {
+    int got, dat;
+
+    space_setup(2, 2 * BENCH_DPG);
+    space_mark(0, 300);
+    space_mark(302, BENCH_DPG - 302);                 /* 组0只剩[300, 302) */
+    space_mark(BENCH_DPG + 100, 100);                 /* 组1：[+0, +100)和[+200, 组尾) */
+    nfs_space_init();
+    dat = nfs_space_alloc(100, 2, &got);              /* goal已占用，取同组下一段 */
+    EXPECT(dat == 300 && got == 2);
+    space_mark(300, 2);
+    dat = nfs_space_alloc(100, 4, &got);              /* 下一段在组1，不能当作同组的下一段 */
+    EXPECT(dat == BENCH_DPG && got == 4);             /* 由最佳适配选中：组1中较短的一段 */
+    space_mark(BENCH_DPG, 4);
+    space_check(__func__);
+}
+
+static void test_best_fit() {
+    int got, dat;
+
+    space_setup(1, BENCH_DPG);
+    space_mark(0, 100);
+    space_mark(105, 95);
+    space_mark(203, 97);
+    space_mark(307, 93);
+    space_mark(403, BENCH_DPG - 403);                 /* 空闲段：5@100、3@200、7@300、3@400 */
+    nfs_space_init();
+    dat = nfs_space_alloc(-1, 3, &got);               /* 等长时取起始块号小的 */
+    EXPECT(dat == 200 && got == 3);
+    dat = nfs_space_alloc(-1, 6, &got);
+    EXPECT(dat == 300 && got == 6);
+    dat = nfs_space_alloc(-1, 4, &got);
+    EXPECT(dat == 100 && got == 4);
+    space_mark(200, 3);
+    space_mark(300, 6);
+    space_mark(100, 4);
+    space_check(__func__);
+}
+
+static void test_largest() {
+    int got, dat;
+
+    space_setup(1, BENCH_DPG);
+    space_mark(0, 100);
+    space_mark(105, 95);
+    space_mark(209, 91);
+    space_mark(302, BENCH_DPG - 302);                 /* 空闲段：5@100、9@200、2@300 */
+    nfs_space_init();
+    dat = nfs_space_alloc(-1, 20, &got);              /* 没有足够长的段，取最长的 */
+    EXPECT(dat == 200 && got == 9);
+    space_mark(200, 9);
+    space_check(__func__);
+}
+
+static void test_merge() {
+    struct nfs_space_stats stats;
+
+    space_setup(2, 2 * BENCH_DPG);
+    space_mark(0, 2 * BENCH_DPG);
+    nfs_space_init();
+    nfs_space_free(BENCH_DPG - 2, 2);                 /* 组边界两侧相邻，但不能合并 */
+    nfs_space_free(BENCH_DPG, 2);
+    nfs_space_get_stats(&stats);
+    EXPECT(stats.extents == 2 && stats.max_len == 2);
+    nfs_space_free(10, 2);
+    nfs_space_free(14, 2);
+    nfs_space_free(12, 2);                            /* 与前后两段合并为一段 */
+    nfs_space_free(BENCH_DPG - 4, 2);                 /* 与后一段合并 */
+    nfs_space_free(BENCH_DPG + 2, 1);                 /* 与前一段合并 */
+    nfs_space_get_stats(&stats);
+    EXPECT(stats.extents == 3 && stats.max_len == 6 && stats.free_blks == 13);
+    space_clear(10, 6);
+    space_clear(BENCH_DPG - 4, 7);
+    space_check(__func__);
+}
+/**
+ * @brief 随机分配/释放，每块都与位图核对；最后一组不满
+ */
+static void test_random(int groups) {
+    int max_data = (groups - 1) * BENCH_DPG + BENCH_DPG / 2;
+    int i, k, dat, got, want, end;
+
+    space_setup(groups, max_data);
+    nfs_space_init();
+    srand(3);
+    for (i = 0; i < BENCH_CHECKS; i++) {
+        if (rand() % 2) {
+            want = 1 + rand() % 64;
+            dat  = nfs_space_alloc(rand() % (max_data + 1000) - 500, want, &got);
+            if (dat < 0) {
+                continue;
+            }
+            EXPECT(got >= 1 && got <= want && dat + got <= max_data);
+            EXPECT(NFS_DATA_GROUP(dat) == NFS_DATA_GROUP(dat + got - 1));
+            for (k = dat; k < dat + got; k++) {
+                EXPECT(!NFS_BITMAP_TEST(nfs_super.map_data, k));
+                NFS_BITMAP_SET(nfs_super.map_data, k);
+            }
+        }
+        else {
+            dat = rand() % max_data;
+            end = dat;
+            while (end < max_data && end - dat < 32 && NFS_DATA_GROUP(end) == NFS_DATA_GROUP(dat) &&
+                   NFS_BITMAP_TEST(nfs_super.map_data, end)) {
+                NFS_BITMAP_CLEAR(nfs_super.map_data, end);
+                end++;
+            }
+            if (end > dat) {
+                nfs_space_free(dat, end - dat);
+            }
+        }
+        if (i % 10000 == 0) {
+            space_check(__func__);
+        }
+    }
+    space_check(__func__);
+    for (k = 0; k < max_data; k++) {                  /* 全部释放后每组剩一段 */
+        if (NFS_BITMAP_TEST(nfs_super.map_data, k)) {
+            NFS_BITMAP_CLEAR(nfs_super.map_data, k);
+            nfs_space_free(k, 1);
+        }
+    }
+    space_check(__func__);
+}
+/**
+ * @brief 按位图找连续空闲块：从goal起第一段不短于want的，回绕一圈都没有时取最长的一段
+ */
+static int bitmap_alloc_run(uint8_t* map, int nbits, int goal, int want, int* got) {
+    int bit = goal, run_end, scanned = 0;
+    int best = -1, best_len = 0;
+
+    while (scanned < nbits) {
+        run_end = nfs_bitmap_find_zero(map, nbits, bit);
+        if (run_end < 0) {                            /* 到末尾，回绕 */
+            scanned += nbits - bit;
+            bit      = 0;
+            continue;
+        }
+        scanned += run_end - bit;
+        bit      = run_end;
+        run_end  = nfs_bitmap_find_one(map, nbits, bit);
+        if (run_end - bit >= want) {
+            best     = bit;
+            best_len = want;
+            break;
+        }
+        if (run_end - bit > best_len) {
+            best     = bit;
+            best_len = run_end - bit;
+        }
+        scanned += run_end - bit;
+        bit      = run_end == nbits ? 0 : run_end;
+    }
+    for (bit = best; best >= 0 && bit < best + best_len; bit++) {
+        NFS_BITMAP_SET(map, bit);
+    }
+    *got = best_len;
+    return best;
+}
+/**
+ * @brief 随机占用fill比例的块，再反复分配8块并释放
+ */
+static void bench(int groups, double fill) {
+    int      nbits = groups * BENCH_DPG;
+    uint8_t* map   = (uint8_t*)calloc(1, nbits / UINT8_BITS);
+    int      used  = (int)(nbits * fill);
+    int      i, k, dat, got, goal;
+    double   t0, t_bitmap, t_space;
+
+    space_setup(groups, nbits);
+    srand(1);
+    for (i = 0; i < used; i++) {
+        k = rand() % nbits;
+        NFS_BITMAP_SET(map, k);
+        NFS_BITMAP_SET(nfs_super.map_data, k);
+    }
+    nfs_space_init();
+
+    srand(2);
+    t0 = now_ns();
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        goal = rand() % nbits;
+        dat  = bitmap_alloc_run(map, nbits, goal, 8, &got);
+        for (k = dat; dat >= 0 && k < dat + got; k++) {
+            NFS_BITMAP_CLEAR(map, k);
+        }
+    }
+    t_bitmap = (now_ns() - t0) / BENCH_ROUNDS;
+
+    srand(2);
+    t0 = now_ns();
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        goal = rand() % nbits;
+        dat  = nfs_space_alloc(goal, 8, &got);
+        if (dat >= 0) {
+            nfs_space_free(dat, got);
+        }
+    }
+    t_space = (now_ns() - t0) / BENCH_ROUNDS;
+
+    printf("groups %4d  fill %5.1f%%  bitmap %10.1f ns/op  rbtree %8.1f ns/op  speedup %6.1fx\n",
+           groups, fill * 100, t_bitmap, t_space, t_bitmap / t_space);
+    free(map);
+}
+
+int main(int argc, char **argv) {
+    int    groups  = argc > 1 ? atoi(argv[1]) : 16;
+    double fills[] = {0.1, 0.5, 0.9, 0.99};
+    int    i;
+
+    groups = groups > 1 ? groups : 2;
+    test_goal();
+    test_next_in_group();
+    test_best_fit();
+    test_largest();
+    test_merge();
+    test_random(groups);
+    printf("%s\n", failures ? "space tests FAILED" : "space tests passed");
+    for (i = 0; i < (int)(sizeof(fills) / sizeof(fills[0])); i++) {
+        bench(groups, fills[i]);
+    }
+    nfs_space_destroy();
+    free(nfs_super.map_data);
+    return failures ? 1 : 0;
+}
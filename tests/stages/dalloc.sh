@@ -0,0 +1,80 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - delayed allocation"
+
+CONTENT="$HOME"/nfs-dalloc.content
+
+function remount () {
+    sleep 1
+    umount "${MNTPOINT}"
+    mount_fuse
+    if ! check_mount; then
+        fail "$_TEST_CASE: 重新挂载失败"
+        return 1
+    fi
+    return 0
+}
+
+function check_full () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    _FILE="${MNTPOINT}"/full
+
+    # 比设备大的内容在一次打开中写入, 写满时之前的块都还是延迟分配的
+    head -c "$_PARAM" /dev/urandom > "$CONTENT"
+    if dd if="$CONTENT" of="$_FILE" bs=4096 2> /dev/null; then
+        fail "$_TEST_CASE: 向${MNTPOINT}写入${_PARAM}字节应当因空间不足失败"
+        return 1
+    fi
+    SIZE=$(stat -c %s "$_FILE")
+    if (( SIZE == 0 )); then
+        fail "$_TEST_CASE: 写满${MNTPOINT}之前没有写入任何内容"
+        return 1
+    fi
+
+    if ! remount; then
+        return 1
+    fi
+    if [[ "$(stat -c %s "$_FILE")" != "$SIZE" ]]; then
+        fail "$_TEST_CASE: 重新挂载后文件$_FILE大小应为${SIZE}字节"
+        return 1
+    fi
+    if ! cmp -s -n "$SIZE" "$CONTENT" "$_FILE"; then
+        fail "$_TEST_CASE: 重新挂载后文件$_FILE内容不正确"
+        return 1
+    fi
+    return 0
+}
+
+function check_reuse () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! rm "${MNTPOINT}"/full; then
+        fail "$_TEST_CASE: 删除文件${MNTPOINT}/full失败"
+        return 1
+    fi
+    if ! head -c "$_PARAM" "$CONTENT" > "${MNTPOINT}"/reuse; then
+        fail "$_TEST_CASE: 删除文件后写入${MNTPOINT}/reuse失败"
+        return 1
+    fi
+
+    if ! remount; then
+        return 1
+    fi
+    if ! cmp -s -n "$_PARAM" "$CONTENT" "${MNTPOINT}"/reuse; then
+        fail "$_TEST_CASE: 重新挂载后文件${MNTPOINT}/reuse内容不正确"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 11.1 - fill ${MNTPOINT} while delayed blocks are pending"
+core_tester echo "5242880" check_full "$TEST_CASE"
+
+TEST_CASE="case 11.2 - reuse the space of a removed file"
+core_tester echo "1048576" check_reuse "$TEST_CASE"
+
+rm -f "${MNTPOINT}"/full "${MNTPOINT}"/reuse "$CONTENT"
@@ -0,0 +1,77 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - inline data"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat."
+INLINE_SZ=64                                           # 不超过该大小的文件内容存在inode中
+
+function remount () {
+    sleep 1
+    umount "${MNTPOINT}"
+    mount_fuse
+    if ! check_mount; then
+        fail "$_TEST_CASE: 重新挂载失败"
+        return 1
+    fi
+    return 0
+}
+
+function check_content () {
+    _FILE=$1
+    _EXPECT=$2
+    OUTPUT=$(cat "$_FILE")
+    if [[ "${OUTPUT}" != "${_EXPECT}" ]]; then
+        fail "$_TEST_CASE: 重新挂载后文件$_FILE内容不正确, 正确的内容为: $_EXPECT"
+        return 1
+    fi
+    return 0
+}
+
+function check_grow () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    _FILE="${MNTPOINT}"/inline0
+
+    # 同一次打开中先写入不超过$INLINE_SZ字节, 再写到超过$INLINE_SZ字节, 期间没有close触发的写回
+    if ! { printf "%s" "${_PARAM:0:40}" && printf "%s" "${_PARAM:40}"; } > "$_FILE"; then
+        fail "$_TEST_CASE: 写入文件$_FILE失败"
+        return 1
+    fi
+
+    if ! remount; then
+        return 1
+    fi
+    check_content "$_FILE" "$_PARAM"
+}
+
+function check_shrink () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    _FILE="${MNTPOINT}"/inline1
+
+    if ! printf "%s" "$_PARAM" > "$_FILE"; then
+        fail "$_TEST_CASE: 写入文件$_FILE失败"
+        return 1
+    fi
+    if ! truncate -s 30 "$_FILE"; then
+        fail "$_TEST_CASE: 截断文件$_FILE失败"
+        return 1
+    fi
+
+    if ! remount; then
+        return 1
+    fi
+    if [[ "$(stat -c %s "$_FILE")" != "30" ]]; then
+        fail "$_TEST_CASE: 重新挂载后文件$_FILE大小应为30字节"
+        return 1
+    fi
+    check_content "$_FILE" "${_PARAM:0:30}"
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 10.1 - write ${MNTPOINT}/inline0 past ${INLINE_SZ} bytes before the first flush"
+core_tester echo "$GOLDEN" check_grow "$TEST_CASE"
+
+TEST_CASE="case 10.2 - truncate ${MNTPOINT}/inline1 back under ${INLINE_SZ} bytes"
+core_tester echo "$GOLDEN$GOLDEN$GOLDEN$GOLDEN$GOLDEN$GOLDEN" check_shrink "$TEST_CASE"
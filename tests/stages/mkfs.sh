@@ -0,0 +1,86 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - mkfs"
+
+MKFS="$ROOT_PATH"/../build/mkfs.nfs
+IMAGE="$HOME"/nfs-mkfs.img
+CONTENT="$HOME"/nfs-mkfs.content
+
+# 超级块字段的字节偏移, 见include/types.h中的struct nfs_super_d
+SUPER_MAX_INO=8
+SUPER_GROUP_CNT=32
+SUPER_INODES_PER_GROUP=44
+
+function mount_image () {
+    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device=file:"$IMAGE" "${MNTPOINT}"
+}
+
+function super_field () {
+    od -An -t d4 -j "$1" -N 4 "$IMAGE" | tr -d ' '
+}
+
+# 参数: "mkfs选项|字段偏移|期望值"
+function check_mkfs () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    IFS='|' read -r _OPTS _FIELD _EXPECT <<< "$_PARAM"
+
+    clean_mount
+    rm -f "$IMAGE"
+    # shellcheck disable=SC2086
+    if ! "$MKFS" $_OPTS file:"$IMAGE" > /dev/null; then
+        fail "$_TEST_CASE: mkfs.nfs $_OPTS 格式化失败"
+        return 1
+    fi
+    if [[ "$(super_field "$_FIELD")" != "$_EXPECT" ]]; then
+        fail "$_TEST_CASE: mkfs.nfs $_OPTS 写入的超级块偏移$_FIELD处应为$_EXPECT, 实际为$(super_field "$_FIELD")"
+        return 1
+    fi
+
+    mount_image
+    if ! check_mount; then
+        fail "$_TEST_CASE: 无法挂载mkfs.nfs $_OPTS 格式化的镜像"
+        return 1
+    fi
+    head -c 1572864 /dev/urandom > "$CONTENT"
+    if ! mkdir "${MNTPOINT}"/dir0 || ! cp "$CONTENT" "${MNTPOINT}"/dir0/file0; then
+        fail "$_TEST_CASE: 在mkfs.nfs $_OPTS 格式化的镜像上创建文件失败"
+        return 1
+    fi
+    sleep 1
+    umount "${MNTPOINT}"
+
+    mount_image
+    if ! check_mount; then
+        fail "$_TEST_CASE: mkfs.nfs $_OPTS 格式化的镜像重新挂载失败"
+        return 1
+    fi
+    if ! cmp -s "$CONTENT" "${MNTPOINT}"/dir0/file0; then
+        fail "$_TEST_CASE: mkfs.nfs $_OPTS 格式化的镜像重新挂载后${MNTPOINT}/dir0/file0内容不正确"
+        return 1
+    fi
+    sleep 1
+    umount "${MNTPOINT}"
+    rm -f "$IMAGE" "$CONTENT"
+    return 0
+}
+
+clean_mount
+
+TEST_CASE="case 9.1 - single group (-s 4M)"
+core_tester echo "-s 4M|$SUPER_GROUP_CNT|1" check_mkfs "$TEST_CASE"
+
+TEST_CASE="case 9.2 - multiple groups (-s 32M)"
+core_tester echo "-s 32M|$SUPER_GROUP_CNT|4" check_mkfs "$TEST_CASE"
+
+TEST_CASE="case 9.3 - short tail group dropped (-g 1024 -s 4116K)"
+core_tester echo "-g 1024 -s 4116K|$SUPER_GROUP_CNT|4" check_mkfs "$TEST_CASE"
+
+TEST_CASE="case 9.4 - partial tail group kept (-g 1024 -s 4140K)"
+core_tester echo "-g 1024 -s 4140K|$SUPER_GROUP_CNT|5" check_mkfs "$TEST_CASE"
+
+TEST_CASE="case 9.5 - bytes per inode (-i 4096 -s 4M)"
+core_tester echo "-i 4096 -s 4M|$SUPER_INODES_PER_GROUP|1024" check_mkfs "$TEST_CASE"
+
+TEST_CASE="case 9.6 - blocks per group (-g 2048 -s 16M)"
+core_tester echo "-g 2048 -s 16M|$SUPER_MAX_INO|2048" check_mkfs "$TEST_CASE"
@@ -0,0 +1,77 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - concurrency"
+
+WORKERS=8
+ROUNDS=20
+
+function stress_worker () {
+    _ID=$1
+    _DIR="${MNTPOINT}"/stress"$_ID"
+    mkdir -p "$_DIR" || return 1
+    for _I in $(seq 1 "$ROUNDS"); do
+        _CONTENT="worker $_ID round $_I $GOLDEN"
+        echo "$_CONTENT" > "$_DIR"/file"$_I" || return 1
+        [[ "$(cat "$_DIR"/file"$_I")" == "$_CONTENT" ]] || return 1
+        mv "$_DIR"/file"$_I" "$_DIR"/moved"$_I" || return 1
+        ls "${MNTPOINT}" > /dev/null || return 1
+        rm "$_DIR"/moved"$_I" || return 1
+    done
+    rmdir "$_DIR"
+}
+
+function check_parallel () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    PIDS=()
+    for ID in $(seq 1 "$WORKERS"); do
+        stress_worker "$ID" &
+        PIDS+=($!)
+    done
+    for PID in "${PIDS[@]}"; do
+        if ! wait "$PID"; then
+            fail "$_TEST_CASE: 并发创建、读写、删除文件失败"
+            return 1
+        fi
+    done
+    if [[ -n "$(ls "${MNTPOINT}")" ]]; then
+        fail "$_TEST_CASE: 所有文件删除后${MNTPOINT}不为空"
+        return 1
+    fi
+    return 0
+}
+
+function check_shared () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    echo "$GOLDEN" > "${MNTPOINT}"/shared
+    PIDS=()
+    for ID in $(seq 1 "$WORKERS"); do
+        ( for _I in $(seq 1 "$ROUNDS"); do
+              [[ "$(cat "${MNTPOINT}"/shared)" == "$GOLDEN" ]] || exit 1
+          done ) &
+        PIDS+=($!)
+    done
+    for PID in "${PIDS[@]}"; do
+        if ! wait "$PID"; then
+            fail "$_TEST_CASE: 并发读文件${MNTPOINT}/shared内容不正确"
+            return 1
+        fi
+    done
+    return 0
+}
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua."
+
+clean_mount                                             # 前面的stage可能留下文件，从空设备开始
+clean_ddriver
+
+try_mount_or_fail
+
+TEST_CASE="case 8.1 - parallel create, write, read, rename and remove"
+core_tester echo "$TEST_CASE" check_parallel "$TEST_CASE"
+
+TEST_CASE="case 8.2 - parallel readers of ${MNTPOINT}/shared"
+core_tester echo "$TEST_CASE" check_shared "$TEST_CASE"
+
+rm -f "${MNTPOINT}"/shared
@@ -0,0 +1,99 @@
+#!/bin/bash
+
+TEST_CASE="case 12 - unaligned read/write"
+
+CONTENT="$HOME"/nfs-unaligned.content
+PATCH="$HOME"/nfs-unaligned.patch
+FILE_SZ=20000
+
+# 参数: "偏移 长度", 偏移和长度都不按块对齐, 且跨越多个块
+RANGES=("1000 3000" "2046 5" "4095 8194" "12287 7713")
+
+function write_range () {
+    _OFS=$1
+    _LEN=$2
+    _DST=$3
+    dd if="$PATCH" of="$_DST" bs=4096 count="$_LEN" seek="$_OFS" \
+       iflag=count_bytes oflag=seek_bytes conv=notrunc 2> /dev/null
+}
+
+function read_range () {
+    _OFS=$1
+    _LEN=$2
+    _SRC=$3
+    dd if="$_SRC" bs=4096 skip="$_OFS" count="$_LEN" iflag=skip_bytes,count_bytes 2> /dev/null
+}
+
+function check_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    _FILE="${MNTPOINT}"/unaligned
+
+    head -c "$FILE_SZ" /dev/urandom > "$CONTENT"
+    if ! cp "$CONTENT" "$_FILE"; then
+        fail "$_TEST_CASE: 写入文件$_FILE失败"
+        return 1
+    fi
+    for RANGE in "${RANGES[@]}"; do
+        read -r OFS LEN <<< "$RANGE"
+        head -c "$LEN" /dev/urandom > "$PATCH"
+        write_range "$OFS" "$LEN" "$CONTENT"
+        if ! write_range "$OFS" "$LEN" "$_FILE"; then
+            fail "$_TEST_CASE: 在偏移$OFS处写入${LEN}字节失败"
+            return 1
+        fi
+    done
+    if ! cmp -s "$CONTENT" "$_FILE"; then
+        fail "$_TEST_CASE: 非对齐写之后文件$_FILE内容不正确"
+        return 1
+    fi
+    return 0
+}
+
+function check_read () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    _FILE="${MNTPOINT}"/unaligned
+
+    for RANGE in "${RANGES[@]}" "777 3333" "1 $((FILE_SZ - 2))"; do
+        read -r OFS LEN <<< "$RANGE"
+        if ! cmp -s <(read_range "$OFS" "$LEN" "$CONTENT") <(read_range "$OFS" "$LEN" "$_FILE"); then
+            fail "$_TEST_CASE: 从偏移$OFS处读出的${LEN}字节不正确"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    sleep 1
+    umount "${MNTPOINT}"
+    mount_fuse
+    if ! check_mount; then
+        fail "$_TEST_CASE: 重新挂载失败"
+        return 1
+    fi
+    if ! cmp -s "$CONTENT" "${MNTPOINT}"/unaligned; then
+        fail "$_TEST_CASE: 重新挂载后文件${MNTPOINT}/unaligned内容不正确"
+        return 1
+    fi
+    if ! check_read "$_PARAM" "$_TEST_CASE"; then
+        return 1
+    fi
+    rm -f "$CONTENT" "$PATCH"
+    return 0
+}
+
+try_mount_or_fail
+
+TEST_CASE="case 12.1 - unaligned writes across blocks of ${MNTPOINT}/unaligned"
+core_tester echo "$TEST_CASE" check_write "$TEST_CASE"
+
+TEST_CASE="case 12.2 - unaligned reads across blocks of ${MNTPOINT}/unaligned"
+core_tester echo "$TEST_CASE" check_read "$TEST_CASE"
+
+TEST_CASE="case 12.3 - unaligned content after remount"
+core_tester echo "$TEST_CASE" check_remount "$TEST_CASE"
@@ -0,0 +1,114 @@
+/**
+ * @brief 格式化工具，按设备大小和每inode字节数计算布局并写入超级块
+ *
+ * Usage: ./mkfs.nfs [-i bytes-per-inode] [-g blocks-per-group] [-s size] device
+ *
+ * device的格式同--device；-s只用于镜像文件（file:、direct:、mmap:），
+ * 格式化前把镜像扩展或截断到size字节，可带K/M/G后缀
+ */
+#include "../include/nfs.h"
+#include <sys/stat.h>
+
+struct nfs_super      nfs_super;
+struct custom_options nfs_options;
+
+static void mkfs_usage() {
+    printf("Usage: mkfs.nfs [options] device\n");
+    printf("    -i bytes-per-inode     one inode per this many bytes (default %d, at least one block)\n",
+           NFS_DEFAULT_BYTES_PER_INODE);
+    printf("    -g blocks-per-group    blocks in each block group (default: bits in one bitmap block)\n");
+    printf("    -s size[K|M|G]         resize an image file (file:, direct:, mmap:) before formatting\n");
+}
+/**
+ * @brief 解析带K/M/G后缀的大小
+ *
+ * @param str
+ * @return long 非法时返回-1
+ */
+static long mkfs_parse_size(const char* str) {
+    char* end;
+    long  size = strtol(str, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g': size <<= 10;                  /* fall through */
+    case 'M': case 'm': size <<= 10;                  /* fall through */
+    case 'K': case 'k': size <<= 10; end++; break;
+    default: break;
+    }
+    return (size <= 0 || *end != '\0') ? -1 : size;
+}
+/**
+ * @brief 把镜像文件调整到size字节，ddriver设备不能调整
+ *
+ * @param device
+ * @param size
+ * @return int
+ */
+static int mkfs_resize_image(const char* device, long size) {
+    const char* sep  = strchr(device, ':');
+    const char* path = sep ? sep + 1 : device;
+    int fd;
+
+    if (sep == NULL || (strncmp(device, "file:", 5) != 0 && strncmp(device, "direct:", 7) != 0 &&
+                        strncmp(device, "mmap:", 5) != 0)) {
+        fprintf(stderr, "mkfs.nfs: -s needs an image file (file:, direct: or mmap:)\n");
+        return -NFS_ERROR_INVAL;
+    }
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        fprintf(stderr, "mkfs.nfs: resize %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -NFS_ERROR_IO;
+    }
+    close(fd);
+    return NFS_ERROR_NONE;
+}
+
+int main(int argc, char **argv) {
+    int  bytes_per_inode = NFS_DEFAULT_BYTES_PER_INODE;
+    int  blks_per_group  = 0;
+    long size            = 0;
+    int  opt, ret;
+
+    while ((opt = getopt(argc, argv, "i:g:s:h")) != -1) {
+        switch (opt) {
+        case 'i': bytes_per_inode = atoi(optarg); break;
+        case 'g': blks_per_group  = atoi(optarg); break;
+        case 's':
+            size = mkfs_parse_size(optarg);
+            if (size < 0) {
+                fprintf(stderr, "mkfs.nfs: bad size %s\n", optarg);
+                return NFS_ERROR_INVAL;
+            }
+            break;
+        default:
+            mkfs_usage();
+            return opt == 'h' ? 0 : NFS_ERROR_INVAL;
+        }
+    }
+    if (optind != argc - 1) {
+        mkfs_usage();
+        return NFS_ERROR_INVAL;
+    }
+    if (size > 0 && mkfs_resize_image(argv[optind], size) != NFS_ERROR_NONE) {
+        return NFS_ERROR_IO;
+    }
+
+    ret = nfs_backend_open(argv[optind], &nfs_super.sz_disk, &nfs_super.sz_io);
+    if (ret != NFS_ERROR_NONE) {
+        fprintf(stderr, "mkfs.nfs: cannot open %s\n", argv[optind]);
+        return -ret;
+    }
+    ret = nfs_mkfs(bytes_per_inode, blks_per_group);
+    if (ret == NFS_ERROR_NONE) {
+        ret = nfs_super.backend->sync();
+    }
+    nfs_super.backend->close();
+    if (ret != NFS_ERROR_NONE) {
+        fprintf(stderr, "mkfs.nfs: format failed (%d)\n", ret);
+        return -ret;
+    }
+    return 0;
+}